@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdbool.h>
 #include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
@@ -9,94 +10,408 @@
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <fcntl.h>
+#include <errno.h>
 #include "../src/lab.h"
 
-static void explain_waitpid(int status)
-{
-    if (!WIFEXITED(status))
-    {
-        fprintf(stderr, "Child exited with status %d\n", WEXITSTATUS(status));
+/**
+ * @brief Run one command of a line: a pipeline with its redirections, in
+ * the background if it ended with &. list_run calls this for every command
+ * of the line it does not skip. arg is the line as typed when it holds a
+ * single command, NULL otherwise.
+ *
+ * @return int The exit status of the command, 127 if it never started
+ */
+static int run_command(struct shell *sh, char **args, bool background, void *arg) {
+    bool pipeline = false;
+    bool redirected = false;
+    for (char **p = args; *p != NULL; p++) {
+        enum cmd_op op = cmd_op(*p);
+        pipeline |= op == OP_PIPE;
+        redirected |= op >= OP_IN && op <= OP_ERR_OUT;
     }
 
-    if (WIFSIGNALED(status))
-    {
-        fprintf(stderr, "Child exited via signal %d\n", WTERMSIG(status));
+    // check to see if we are launching a built in command, one with
+    // redirections still runs in the shell with its stdio swapped, a
+    // builtin in a pipeline is run by job_run like any other stage
+    bool plain = !pipeline && !redirected;
+    if (!pipeline && (redirected ? job_builtin(sh, args) : do_builtin(sh, args))) {
+        return sh->status;
     }
 
-    if (WIFSTOPPED(status))
+    // pick up binaries installed or removed since the last command
+    hash_drain();
+    // the job table shows the command itself when the line has several
+    char *cmdline = arg != NULL ? NULL : join_args(args);
+    // argument lists too long for exec are split when asked to, the
+    // batches run in the foreground
+    const char *name = arg != NULL ? arg : cmdline;
+    int status = background || !plain || !sh->argsplit ? -1 : argsplit_run(sh, args, name);
+    if (status < 0) {
+        status = job_run(sh, args, name, background);
+    }
+    free(cmdline);
+    // get control of the shell
+    if (sh->shell_is_interactive) {
+        tcsetpgrp(sh->shell_terminal, sh->shell_pgid);
+    }
+    sh->status = status < 0 ? 127 : status;
+
+    return sh->status;
+}
+
+/**
+ * @brief Run a line parsed from text. cmd is NULL if the line did not
+ * parse and is freed.
+ */
+static void run_parsed(struct shell *sh, char **cmd, char *text)
+{
+    // split the line at ;, &, && and || once
+    struct cmd_list *list = cmd != NULL ? list_compile(cmd) : NULL;
+    cmd_free(cmd);
+    if (list == NULL)
     {
-        fprintf(stderr, "Child stopped by %d\n", WSTOPSIG(status));
+        // syntax error, already reported
+        sh->status = 2;
+        return;
     }
+    list_run(sh, list, run_command, list->n == 1 ? text : NULL);
+    list_free(list);
+}
 
-    if (WIFCONTINUED(status))
+/**
+ * @brief Parse and run one trimmed line that is not blank. A line that
+ * starts with # is a comment.
+ */
+static void run_text(struct shell *sh, char *line)
+{
+    if (*line == '#')
     {
-        fprintf(stderr, "Child was resumed by delivery of SIGCONT\n");
+        return;
     }
+    // go through the parse cache, the same lines come back over and
+    // over from scripts and history recall; this is also the path of the
+    // prompt, where cmd_parse_inplace would save no copy: the line has to
+    // stay intact as the job's name, so it would be copied before every
+    // parse, while a cache hit skips the copy and the tokenizing both
+    run_parsed(sh, cmd_parse(line), line);
 }
 
-int main(int argc, char *argv[]) {
-    parse_args(argc, argv);
-    struct shell sh;
-    sh_init(&sh);
-    char *line = (char *)NULL;
+/**
+ * @brief Parse and run one line the user entered. raw is freed.
+ */
+static void run_line(struct shell *sh, char *raw)
+{
+    // do nothing on blank lines don't save history or attempt to exec
+    char *line = trim_white(raw);
+    if (*line)
+    {
+        add_history(line);
+        run_text(sh, line);
+    }
+    free(raw);
+}
 
-    while ((line = readline(sh.prompt))) {
-        // do nothing on blank lines don't save history or attempt to exec
-        line = trim_white(line);
-        if (!*line)
+/**
+ * @brief Run every line of script, or of standard input if script is
+ * NULL, without readline or history. The lines are read in large blocks
+ * and go through the same parse and run path as lines typed at the
+ * prompt.
+ *
+ * @return int The status the shell exits with
+ */
+static int run_batch(struct shell *sh, const char *script)
+{
+    int fd = STDIN_FILENO;
+    if (script != NULL)
+    {
+        fd = open(script, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
         {
-            free(line);
-            continue;
+            fprintf(stderr, "%s: %s\n", script, strerror(errno));
+            return 127;
         }
-        add_history(line);
-        // check to see if we are launching a built in command
-        char **cmd = cmd_parse(line);
-        if (!do_builtin(&sh, cmd))
+    }
+
+    // a thread reads and parses the lines while the commands in front of
+    // them run, so the shell only has to start them; on a single CPU the
+    // two would only take turns. Standard input is shared with the
+    // commands, which must find it where the last line ended, so it is
+    // never read ahead; a script is close on exec and only the shell's
+    bool smp = sysconf(_SC_NPROCESSORS_ONLN) > 1;
+    struct parse_ahead *pa = smp && script != NULL ? ahead_start(fd) : NULL;
+    if (pa != NULL)
+    {
+        // exit stops the thread through sh_destroy
+        sh->ahead = pa;
+        struct parsed_line pl;
+        while (ahead_next(pa, &pl))
         {
-            pid_t pid = fork();
-            if (pid == 0)
+            if (pl.err != NULL)
             {
-                /*This is the child process*/
-                pid_t child = getpid();
-                setpgid(child, child);
-                tcsetpgrp(sh.shell_terminal, child);
-                signal(SIGINT, SIG_DFL);
-                signal(SIGQUIT, SIG_DFL);
-                signal(SIGTSTP, SIG_DFL);
-                signal(SIGTTIN, SIG_DFL);
-                signal(SIGTTOU, SIG_DFL);
-                execvp(cmd[0], cmd);
-                perror("execvp failed");
-                exit(EXIT_FAILURE);
+                fprintf(stderr, "%s\n", pl.err);
             }
-            else if (pid < 0)
+            run_parsed(sh, pl.cmd, pl.line);
+            // drop background jobs that finished, they are only reported
+            // when there is a terminal
+            jobs_update(sh);
+            jobs_notify(sh);
+            queue_schedule(sh);
+        }
+        sh->ahead = NULL;
+        ahead_free(pa);
+    }
+    else
+    {
+        struct line_reader *r = reader_new(fd);
+        char *line;
+        while ((line = reader_next(r)) != NULL)
+        {
+            line = trim_white(line);
+            if (*line)
             {
-                // If fork failed we are in trouble!
-                perror("fork return < 0 Process creation failed!");
-                abort();
+                run_text(sh, line);
             }
+            jobs_update(sh);
+            jobs_notify(sh);
+            queue_schedule(sh);
+        }
+        reader_free(r);
+    }
+    if (fd != STDIN_FILENO)
+    {
+        close(fd);
+    }
+    // commands the script queued still have to run
+    queue_drain(sh);
+
+    return sh->status;
+}
+
+/**
+ * @brief Check if the last command of a one-shot run can replace the
+ * shell: it runs in the foreground, nothing is left in the queue to
+ * start after it and its argument list needs no splitting. job_exec
+ * turns down builtins and pipelines itself.
+ */
+static bool can_exec(struct shell *sh, const struct list_insn *insn)
+{
+    extern char **environ;
+    if (insn->background || sh->queue != NULL)
+    {
+        return false;
+    }
+
+    return !sh->argsplit || exec_args_size(insn->argv) + exec_args_size(environ) <= exec_args_limit();
+}
 
-            /*
-            This is in the parent put the child process into its own
-            process group and give it control of the terminal
-            to avoid a race condition
-            */
-            // printf("shell:%d , child%d\n",sh.shell_pgid, pid);
-            setpgid(pid, pid);
-            tcsetpgrp(sh.shell_terminal, pid);
-            int status;
-            int rval = waitpid(pid, &status, 0);
-            if (rval == -1)
+/**
+ * @brief Run the command string given with -e. Every command is run as
+ * it would be from the prompt except the last one, which when it runs and
+ * is an external command takes the place of the shell with exec instead
+ * of being forked and waited for.
+ *
+ * @return int The status the shell exits with
+ */
+static int run_string(struct shell *sh, const char *str)
+{
+    char **cmd = cmd_parse(str);
+    struct cmd_list *list = cmd != NULL ? list_compile(cmd) : NULL;
+    cmd_free(cmd);
+    if (list == NULL)
+    {
+        return 2;
+    }
+
+    int status = 0;
+    for (size_t i = 0; i < list->n; i++)
+    {
+        const struct list_insn *insn = &list->insn[i];
+        if (!list_runs(insn, status))
+        {
+            continue;
+        }
+        if (i == list->n - 1 && can_exec(sh, insn))
+        {
+            // only comes back if the command was not run in place
+            hash_drain();
+            status = job_exec(sh, insn->argv);
+            if (status >= 0)
             {
-                fprintf(stderr, "Wait pid failed with -1\n");
-		        explain_waitpid(status);
+                break;
             }
-            cmd_free(cmd);
-            // get control of the shell
-            tcsetpgrp(sh.shell_terminal, sh.shell_pgid);
         }
+        status = run_command(sh, insn->argv, insn->background, list->n == 1 ? (void *)str : NULL);
     }
-    
+    list_free(list);
+    queue_drain(sh);
+
+    return status;
+}
+
+// readline's callbacks take no context, this is the shell they work on
+static struct shell *shell;
+
+// The prompt is on screen waiting for input
+static bool prompting;
+
+// Standard input is at end of file
+static bool eof;
+
+/**
+ * @brief Print job reports without garbling the line being edited: clear
+ * it, print, then draw the prompt and the line again.
+ */
+static void notify_above_prompt(struct shell *sh)
+{
+    rl_clear_visible_line();
+    jobs_notify(sh);
+    fflush(stdout);
+    rl_forced_update_display();
+}
+
+/**
+ * @brief readline calls this with every complete line, NULL at end of
+ * file. The command runs right here, the terminal is paused in the loop
+ * while a foreground job may be reading it.
+ */
+static void on_line(char *raw)
+{
+    if (raw == NULL)
+    {
+        eof = true;
+        rl_callback_handler_remove();
+        return;
+    }
+
+    prompting = false;
+    loop_enable_fd(STDIN_FILENO, false);
+    run_line(shell, raw);
+    loop_enable_fd(STDIN_FILENO, true);
+    prompting = true;
+
+    // report what finished while the command ran, readline draws the
+    // next prompt when this returns; queued commands get their turn once
+    // the line is done
+    jobs_update(shell);
+    jobs_notify(shell);
+    queue_schedule(shell);
+}
+
+/**
+ * @brief The terminal has input, feed readline one character.
+ */
+static void on_input(struct shell *sh, int fd, void *arg)
+{
+    UNUSED(sh);
+    UNUSED(fd);
+    UNUSED(arg);
+    rl_callback_read_char();
+}
+
+/**
+ * @brief A child exited, stopped or continued. Reaping happens now, the
+ * report is shown right away at the prompt and after the command
+ * otherwise.
+ */
+static void on_child(struct shell *sh, int signo)
+{
+    UNUSED(signo);
+    if (jobs_update(sh) && prompting && sh->shell_is_interactive)
+    {
+        notify_above_prompt(sh);
+    }
+    // a queued job that exited leaves room for the next one
+    queue_schedule(sh);
+}
+
+/**
+ * @brief The terminal changed size.
+ */
+static void on_winch(struct shell *sh, int signo)
+{
+    UNUSED(sh);
+    UNUSED(signo);
+    rl_resize_terminal();
+}
+
+/**
+ * @brief Ctrl-C at the prompt throws the line away and starts a new one.
+ * A foreground job has the terminal and gets the signal instead.
+ */
+static void on_interrupt(struct shell *sh, int signo)
+{
+    UNUSED(sh);
+    UNUSED(signo);
+    if (!prompting)
+    {
+        return;
+    }
+    rl_callback_sigcleanup();
+    rl_replace_line("", 0);
+    rl_crlf();
+    rl_on_new_line();
+    rl_redisplay();
+}
+
+int main(int argc, char *argv[]) {
+    parse_args(argc, argv);
+    struct shell sh;
+    sh_init(&sh);
+    shell = &sh;
+    const char *command = get_command();
+
+    // child state changes, resizes and Ctrl-C all arrive through the loop
+    // instead of asynchronous handlers
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGCHLD);
+    sigaddset(&signals, SIGWINCH);
+    if (sh.shell_is_interactive)
+    {
+        sigaddset(&signals, SIGINT);
+    }
+    if (loop_init(&signals) < 0)
+    {
+        perror("Couldn't start the event loop");
+        exit(EXIT_FAILURE);
+    }
+    loop_on_signal(SIGCHLD, on_child);
+    if (command != NULL)
+    {
+        // one-shot, there is no prompt and no readline
+        int status = run_string(&sh, command);
+        loop_destroy();
+        sh_destroy(&sh);
+        return status;
+    }
+    if (get_script() != NULL || !sh.shell_is_interactive)
+    {
+        // nobody is typing, read the lines in bulk
+        int status = run_batch(&sh, get_script());
+        loop_destroy();
+        sh_destroy(&sh);
+        return status;
+    }
+    loop_on_signal(SIGWINCH, on_winch);
+    loop_on_signal(SIGINT, on_interrupt);
+    if (loop_add_fd(STDIN_FILENO, on_input, NULL) < 0)
+    {
+        perror("Couldn't watch standard input");
+        exit(EXIT_FAILURE);
+    }
+
+    // the loop owns the signals, readline must not install handlers
+    rl_catch_signals = 0;
+    rl_catch_sigwinch = 0;
+    rl_callback_handler_install(sh.prompt, on_line);
+    prompting = true;
+
+    while (!eof)
+    {
+        loop_once(&sh);
+    }
+
+    loop_destroy();
     sh_destroy(&sh);
     clear_history(); // clean up the readline history
 }
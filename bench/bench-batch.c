@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <readline/readline.h>
+#include <readline/history.h>
+#include "../src/lab.h"
+
+// Number of lines in the generated script
+#define SCRIPT_LINES 100000
+
+// Number of lines in the script of external commands
+#define EXEC_LINES 2000
+
+// How the script is read
+enum mode {
+    MODE_READLINE,  /* readline and history, as the shell did before */
+    MODE_READER,    /* the line reader, parsing in line */
+    MODE_AHEAD,     /* the parse-ahead thread */
+};
+
+/**
+ * Helper function
+ *
+ * @brief Monotonic clock in nanoseconds.
+ */
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Write a script of builtins to a temporary file, the builtins keep
+ * fork and exec out of the numbers.
+ */
+static FILE *make_script(void) {
+    FILE *f = tmpfile();
+    if (f == NULL) {
+        perror("tmpfile failed");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < SCRIPT_LINES; i++) {
+        fprintf(f, "cd /tmp %d\n", i);
+    }
+    fflush(f);
+
+    return f;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Write a script of external commands with long quoted argument
+ * lists, so parsing is a noticeable part of each line.
+ */
+static FILE *make_exec_script(void) {
+    FILE *f = tmpfile();
+    if (f == NULL) {
+        perror("tmpfile failed");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < EXEC_LINES; i++) {
+        fprintf(f, "/bin/true %d", i);
+        for (int j = 0; j < 200; j++) {
+            fprintf(f, " 'arg %d' \"x\\\"%d\"", j, j);
+        }
+        fprintf(f, "\n");
+    }
+    fflush(f);
+
+    return f;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Run a parsed line, builtins in the shell and anything else with
+ * job_run.
+ */
+static void run_cmd(struct shell *sh, char **cmd, char *line) {
+    if (!do_builtin(sh, cmd)) {
+        job_run(sh, cmd, line, false);
+    }
+}
+
+/**
+ * Helper function
+ *
+ * @brief Run the script in a child process, through readline and history
+ * the way the shell did before, through the line reader or through the
+ * parse-ahead thread.
+ */
+static void run(const char *name, FILE *script, enum mode mode) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        struct shell sh;
+        memset(&sh, 0, sizeof(sh));
+        sh.shell_terminal = -1;
+        lseek(fileno(script), 0, SEEK_SET);
+        FILE *null = fopen("/dev/null", "w");
+        int lines = 0;
+
+        double start = now_ns();
+        if (mode == MODE_READLINE) {
+            rl_instream = script;
+            rl_outstream = null;
+            using_history();
+            char *raw;
+            while ((raw = readline("")) != NULL) {
+                char *line = trim_white(raw);
+                add_history(line);
+                char **cmd = cmd_parse(line);
+                run_cmd(&sh, cmd, line);
+                cmd_free(cmd);
+                free(raw);
+                lines++;
+            }
+        } else if (mode == MODE_AHEAD) {
+            struct parse_ahead *pa = ahead_start(fileno(script));
+            struct parsed_line pl;
+            while (ahead_next(pa, &pl)) {
+                run_cmd(&sh, pl.cmd, pl.line);
+                cmd_free(pl.cmd);
+                lines++;
+            }
+            ahead_free(pa);
+        } else {
+            struct line_reader *r = reader_new(fileno(script));
+            char *line;
+            while ((line = reader_next(r)) != NULL) {
+                line = trim_white(line);
+                char **cmd = cmd_parse(line);
+                run_cmd(&sh, cmd, line);
+                cmd_free(cmd);
+                lines++;
+            }
+            reader_free(r);
+        }
+        double elapsed = now_ns() - start;
+
+        printf("  %-8s %8.1f ms %10.1f ns/line", name, elapsed / 1e6, elapsed / lines);
+        fflush(stdout);
+        _exit(EXIT_SUCCESS);
+    }
+
+    int status;
+    struct rusage ru;
+    wait4(pid, &status, 0, &ru);
+    printf("  maxrss %6ld KB\n", ru.ru_maxrss);
+}
+
+int main(void) {
+    FILE *script = make_script();
+
+    printf("batch: %d-line script of builtins\n", SCRIPT_LINES);
+    run("readline", script, MODE_READLINE);
+    run("reader", script, MODE_READER);
+    run("ahead", script, MODE_AHEAD);
+
+    // the parse of the next line hides behind the fork and wait of this one
+    FILE *exec_script = make_exec_script();
+    printf("batch: %d-line script of external commands\n", EXEC_LINES);
+    run("reader", exec_script, MODE_READER);
+    run("ahead", exec_script, MODE_AHEAD);
+
+    fclose(script);
+    fclose(exec_script);
+
+    return 0;
+}
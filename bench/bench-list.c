@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../src/lab.h"
+
+// Commands joined on each generated line
+#define CHAIN 500
+
+// Number of times each line is compiled and walked
+#define PASSES 2000
+
+// Number of times the chain of real commands is run
+#define EXEC_PASSES 2
+
+/**
+ * Helper function
+ *
+ * @brief Monotonic clock in nanoseconds.
+ */
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Build a line of CHAIN commands. sep joins them, NULL cycles
+ * through ;, && and ||.
+ */
+static char *make_chain(const char *cmd, const char *sep) {
+    static const char *seps[] = {" ; ", " && ", " || "};
+    size_t len = CHAIN * (strlen(cmd) + 4) + 1;
+    char *line = malloc(len);
+    if (line == NULL) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+
+    char *p = line;
+    for (int i = 0; i < CHAIN; i++) {
+        if (i > 0) {
+            p = stpcpy(p, sep != NULL ? sep : seps[i % 3]);
+        }
+        p = stpcpy(p, cmd);
+    }
+
+    return line;
+}
+
+/**
+ * Helper function
+ *
+ * @brief A list command that does nothing, so only compiling and walking
+ * the list is measured.
+ */
+static int nop(struct shell *sh, char **argv, bool background, void *arg) {
+    UNUSED(sh);
+    UNUSED(background);
+    UNUSED(arg);
+
+    return argv[0][0] == 'f';
+}
+
+/**
+ * Helper function
+ *
+ * @brief What a shell that parses one command at a time does: find the end
+ * of the next command in the text and tokenize it on its own. The
+ * generated lines have no quotes so a plain scan finds the separators.
+ */
+static void resplit(const char *line, char *buf) {
+    const char *p = line;
+    while (*p != '\0') {
+        size_t n = strcspn(p, ";&|");
+        memcpy(buf, p, n);
+        buf[n] = '\0';
+        char **cmd = cmd_parse_inplace(buf);
+        nop(NULL, cmd, false, NULL);
+        cmd_free(cmd);
+        p += n;
+        p += strspn(p, ";&|");
+    }
+}
+
+/**
+ * Helper function
+ *
+ * @brief Compile and walk line PASSES times, or split it up again for
+ * every command when legacy is set.
+ */
+static void run(const char *name, const char *line, bool legacy) {
+    char *buf = malloc(strlen(line) + 1);
+    if (buf == NULL) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+
+    double start = now_ns();
+    for (int pass = 0; pass < PASSES; pass++) {
+        if (legacy) {
+            resplit(line, buf);
+            continue;
+        }
+        char **cmd = cmd_parse(line);
+        struct cmd_list *list = list_compile(cmd);
+        cmd_free(cmd);
+        list_run(NULL, list, nop, NULL);
+        list_free(list);
+    }
+    double elapsed = now_ns() - start;
+    free(buf);
+
+    printf("  %-16s %8.1f us/line %8.1f ns/command\n", name,
+           elapsed / PASSES / 1e3, elapsed / ((double)PASSES * CHAIN));
+}
+
+/**
+ * Helper function
+ *
+ * @brief Run one command of the chain for real.
+ */
+static int run_job(struct shell *sh, char **argv, bool background, void *arg) {
+    return job_run(sh, argv, arg, background);
+}
+
+int main(void) {
+    struct shell sh;
+    memset(&sh, 0, sizeof(sh));
+    sh.shell_terminal = -1;
+
+    char *mixed = make_chain("echo -n x y z > /dev/null", NULL);
+    char *seq = make_chain("true", " ; ");
+    char *and = make_chain("/bin/true", " && ");
+
+    printf("list_compile: %d commands per line, %d passes\n", CHAIN, PASSES);
+    run("once mixed", mixed, false);
+    run("per command", mixed, true);
+    run("once ;", seq, false);
+    run("per command ;", seq, true);
+
+    // end to end, the fork and exec of every command dominates
+    printf("list_run: %d commands joined with &&, %d passes\n", CHAIN, EXEC_PASSES);
+    double start = now_ns();
+    for (int pass = 0; pass < EXEC_PASSES; pass++) {
+        char **cmd = cmd_parse(and);
+        struct cmd_list *list = list_compile(cmd);
+        cmd_free(cmd);
+        if (list_run(&sh, list, run_job, "chain") != 0) {
+            fprintf(stderr, "chain failed\n");
+            return EXIT_FAILURE;
+        }
+        list_free(list);
+    }
+    double elapsed = now_ns() - start;
+    printf("  %-16s %8.1f us/command\n", "fork", elapsed / ((double)EXEC_PASSES * CHAIN) / 1e3);
+
+    free(mixed);
+    free(seq);
+    free(and);
+
+    return 0;
+}
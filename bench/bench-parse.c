@@ -0,0 +1,155 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "../src/lab.h"
+
+// Number of lines in the generated script
+#define SCRIPT_LINES 10000
+
+// Number of passes over the script for each parser
+#define PASSES 20
+
+/**
+ * @brief The cmd_parse implementation the shell shipped with: one
+ * ARG_MAX-sized pointer array plus one strndup per token. Kept here so the
+ * benchmark always has a baseline to compare against.
+ */
+static char **legacy_cmd_parse(char const *line) {
+    size_t arg_max = sysconf(_SC_ARG_MAX);
+    char **cmd = malloc(arg_max * sizeof(char *));
+    if (cmd == NULL) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+
+    int i = 0;
+    const char *p = line;
+    while (*p != '\0') {
+        while (isspace(*p)) {
+            p++;
+        }
+        if (*p == '\0') {
+            break;
+        }
+        const char *start = p;
+        if (*p == '"') {
+            start = ++p;
+            while (*p != '"' && *p != '\0') {
+                p++;
+            }
+            if (*p == '\0') {
+                fprintf(stderr, "Unmatched quote\n");
+                exit(EXIT_FAILURE);
+            }
+            cmd[i] = strndup(start, p - start);
+            p++;
+        } else {
+            while (!isspace(*p) && *p != '\0') {
+                p++;
+            }
+            cmd[i] = strndup(start, p - start);
+        }
+        i++;
+    }
+    cmd[i] = NULL;
+
+    return cmd;
+}
+
+static void legacy_cmd_free(char **line) {
+    for (int i = 0; line[i] != NULL; i++) {
+        free(line[i]);
+    }
+    free(line);
+}
+
+/**
+ * Helper function
+ *
+ * @brief Build a script of SCRIPT_LINES command lines that look like what
+ * operators feed the shell: short commands, option flags, paths and quoted
+ * or escaped arguments.
+ */
+static char **make_script(void) {
+    static const char *cmds[] = {"ls", "grep", "cp", "echo", "find", "tar"};
+    char **lines = malloc(SCRIPT_LINES * sizeof(char *));
+    char buf[256];
+
+    for (int i = 0; i < SCRIPT_LINES; i++) {
+        snprintf(buf, sizeof(buf), "%s -%c /var/log/app/%d.log \"arg %d\" 'pat*%d' out\\ %d",
+                 cmds[i % 6], 'a' + (i % 26), i, i * 7, i % 5, i % 13);
+        lines[i] = strdup(buf);
+    }
+
+    return lines;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Run one parser in a child process so that its peak RSS and page
+ * fault counts are not polluted by the other parser.
+ */
+static void run(const char *name, char **lines, int mode) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        char buf[256];
+        double start = now_ns();
+        for (int pass = 0; pass < PASSES; pass++) {
+            for (int i = 0; i < SCRIPT_LINES; i++) {
+                if (mode == 0) {
+                    legacy_cmd_free(legacy_cmd_parse(lines[i]));
+                } else if (mode == 1) {
+                    cmd_free(cmd_parse(lines[i]));
+                } else if (mode == 3) {
+                    // a handful of lines re-run over and over, every parse
+                    // after the first pass is a cache hit
+                    cmd_free(cmd_parse(lines[i % 16]));
+                } else {
+                    // the shell hands readline's buffer over, the copy
+                    // stands in for the line the REPL already owns
+                    strcpy(buf, lines[i]);
+                    cmd_free(cmd_parse_inplace(buf));
+                }
+            }
+        }
+        double elapsed = now_ns() - start;
+        printf("%-8s %10.1f ns/line", name, elapsed / ((double)PASSES * SCRIPT_LINES));
+        fflush(stdout);
+        _exit(EXIT_SUCCESS);
+    }
+
+    int status;
+    struct rusage ru;
+    wait4(pid, &status, 0, &ru);
+    printf("  maxrss %6ld KB  minflt %8ld\n", ru.ru_maxrss, ru.ru_minflt);
+}
+
+int main(void) {
+    char **lines = make_script();
+
+    printf("cmd_parse: %d-line script, %d passes\n", SCRIPT_LINES, PASSES);
+    run("legacy", lines, 0);
+    run("arena", lines, 1);
+    run("inplace", lines, 2);
+    run("repeat", lines, 3);
+
+    for (int i = 0; i < SCRIPT_LINES; i++) {
+        free(lines[i]);
+    }
+    free(lines);
+
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/lab.h"
+
+// Size of the generated command line
+#define LINE_BYTES (512 * 1024)
+
+// Number of passes over the line for each measurement
+#define PASSES 200
+
+/**
+ * Helper function
+ *
+ * @brief Build one machine-generated command line: a command followed by a
+ * long list of file paths, roughly what a glob expansion hands the shell.
+ */
+static char *make_line(void) {
+    char *line = malloc(LINE_BYTES + 128);
+    size_t len = (size_t)sprintf(line, "rm -f");
+
+    for (int i = 0; len < LINE_BYTES; i++) {
+        len += (size_t)sprintf(line + len, " /srv/data/project-%05d/build/output/object-%d.o", i % 977, i);
+    }
+
+    return line;
+}
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Walk the whole line from delimiter to delimiter.
+ */
+static size_t count_delims(const char *p, const char *end) {
+    size_t n = 0;
+    while ((p = scan_delim(p, end)) < end) {
+        n++;
+        p++;
+    }
+
+    return n;
+}
+
+int main(void) {
+    static const struct {
+        const char *name;
+        enum scan_impl impl;
+    } impls[] = {{"scalar", SCAN_SCALAR}, {"sse2", SCAN_SSE2}, {"avx2", SCAN_AVX2}};
+
+    char *line = make_line();
+    size_t len = strlen(line);
+    const char *end = line + len;
+    char **reference = NULL;
+
+    printf("scan: %zu byte line, %d passes\n", len, PASSES);
+    for (size_t k = 0; k < sizeof(impls) / sizeof(impls[0]); k++) {
+        if (!scan_use(impls[k].impl)) {
+            printf("%-8s not supported on this CPU\n", impls[k].name);
+            continue;
+        }
+
+        // raw boundary scanning
+        size_t delims = 0;
+        double start = now_s();
+        for (int pass = 0; pass < PASSES; pass++) {
+            delims += count_delims(line, end);
+        }
+        double scan_gbs = (double)len * PASSES / (now_s() - start) / 1e9;
+
+        // the full tokenizer on top of it
+        start = now_s();
+        for (int pass = 0; pass < PASSES; pass++) {
+            cmd_free(cmd_parse(line));
+        }
+        double parse_gbs = (double)len * PASSES / (now_s() - start) / 1e9;
+
+        // every implementation must produce exactly the same tokens
+        char **cmd = cmd_parse(line);
+        if (reference == NULL) {
+            reference = cmd;
+        } else {
+            for (int i = 0; reference[i] != NULL || cmd[i] != NULL; i++) {
+                if (reference[i] == NULL || cmd[i] == NULL || strcmp(reference[i], cmd[i]) != 0) {
+                    fprintf(stderr, "%s: token %d differs from scalar\n", impls[k].name, i);
+                    return 1;
+                }
+            }
+            cmd_free(cmd);
+        }
+
+        printf("%-8s scan %6.2f GB/s  cmd_parse %6.2f GB/s  (%zu delimiters)\n",
+               impls[k].name, scan_gbs, parse_gbs, delims / PASSES);
+    }
+
+    cmd_free(reference);
+    free(line);
+
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../src/lab.h"
+
+// Children started per backend and heap size
+#define SPAWNS 500
+
+// Heap the shell has touched before spawning, in MB. fork copies the page
+// tables for all of it, the other backends do not look at it. The zygote is
+// started before any of it is allocated, the way sh_init starts it.
+static const size_t heap_mb[] = {0, 64, 512};
+
+/**
+ * Helper function
+ *
+ * @brief Monotonic clock in nanoseconds.
+ */
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Start and reap /bin/true SPAWNS times with one backend.
+ */
+static void run(struct shell *sh, enum spawn_backend backend) {
+    char *argv[] = {"/bin/true", NULL};
+    struct spawn_attr attr = {.pgid = 0, .foreground = false};
+
+    sh->spawn = backend;
+    double start = now_ns();
+    for (int i = 0; i < SPAWNS; i++) {
+        pid_t pid = sh_spawn(sh, argv, &attr);
+        if (pid < 0) {
+            exit(EXIT_FAILURE);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    double elapsed = now_ns() - start;
+
+    printf("  %-12s %8.1f us/spawn %8.0f spawns/s\n", spawn_backend_name(backend),
+           elapsed / SPAWNS / 1e3, SPAWNS / (elapsed / 1e9));
+}
+
+int main(void) {
+    struct shell sh;
+    memset(&sh, 0, sizeof(sh));
+    sh.shell_terminal = -1;
+
+    if (zygote_start() < 0) {
+        perror("zygote_start failed");
+        return EXIT_FAILURE;
+    }
+
+    printf("sh_spawn: %d spawns of /bin/true\n", SPAWNS);
+    for (size_t h = 0; h < sizeof(heap_mb) / sizeof(heap_mb[0]); h++) {
+        // touch every page so it is mapped and has to be accounted for
+        size_t size = heap_mb[h] << 20;
+        char *heap = NULL;
+        if (size > 0) {
+            heap = malloc(size);
+            if (heap == NULL) {
+                perror("malloc failed");
+                return EXIT_FAILURE;
+            }
+            memset(heap, 1, size);
+        }
+
+        printf("heap %zu MB\n", heap_mb[h]);
+        for (int b = SPAWN_FORK; b <= SPAWN_ZYGOTE; b++) {
+            run(&sh, (enum spawn_backend)b);
+        }
+        free(heap);
+    }
+    zygote_stop();
+
+    return 0;
+}
@@ -0,0 +1,137 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "../src/lab.h"
+
+// Bytes pushed through tee per run
+#define STREAM_BYTES (2048ULL << 20)
+
+// Chunk the producer writes at a time
+#define CHUNK (1 << 20)
+
+// Where tee writes its copy
+#define OUT_FILE "/tmp/bench-tee.out"
+
+// Pipe capacities to compare, 0 is the kernel default of 64 KB
+static const int pipe_sizes[] = {0, 1 << 20};
+
+/**
+ * Helper function
+ *
+ * @brief Monotonic clock in seconds.
+ */
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Write STREAM_BYTES to fd and exit.
+ */
+static void produce(int fd) {
+    char *buf = malloc(CHUNK);
+    if (buf == NULL) {
+        _exit(EXIT_FAILURE);
+    }
+    memset(buf, 'x', CHUNK);
+    for (unsigned long long left = STREAM_BYTES; left > 0; left -= CHUNK) {
+        for (size_t off = 0; off < CHUNK;) {
+            ssize_t n = write(fd, buf + off, CHUNK - off);
+            if (n < 0) {
+                _exit(EXIT_FAILURE);
+            }
+            off += (size_t)n;
+        }
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+/**
+ * Helper function
+ *
+ * @brief Run producer | tee OUT_FILE | consumer once and report the rate.
+ * The consumer is this process, it splices the stream to /dev/null so it
+ * costs the same for both tees.
+ */
+static void run(bool builtin, int pipe_size) {
+    int in[2], out[2];
+    if (pipe2(in, O_CLOEXEC) < 0 || pipe2(out, O_CLOEXEC) < 0) {
+        perror("pipe2 failed");
+        exit(EXIT_FAILURE);
+    }
+    if (pipe_size > 0) {
+        fcntl(in[1], F_SETPIPE_SZ, pipe_size);
+        fcntl(out[1], F_SETPIPE_SZ, pipe_size);
+    }
+
+    // the builtin flushes stdio on its way in, nothing of ours may be left
+    fflush(stdout);
+    double start = now_s();
+    pid_t producer = fork();
+    if (producer == 0) {
+        produce(in[1]);
+    }
+    pid_t tee = fork();
+    if (tee == 0) {
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        // the builtin does not exec, close on exec does not help it
+        close(in[0]);
+        close(in[1]);
+        close(out[0]);
+        close(out[1]);
+        char *argv[] = {"tee", OUT_FILE, NULL};
+        if (builtin) {
+            _exit(tee_run(argv));
+        }
+        execvp("tee", argv);
+        _exit(127);
+    }
+    close(in[0]);
+    close(in[1]);
+    close(out[1]);
+
+    int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    unsigned long long total = 0;
+    ssize_t n;
+    while ((n = splice(out[0], NULL, null, NULL, CHUNK, SPLICE_F_MOVE)) > 0) {
+        total += (unsigned long long)n;
+    }
+    close(null);
+    close(out[0]);
+    int status;
+    waitpid(producer, NULL, 0);
+    waitpid(tee, &status, 0);
+    double elapsed = now_s() - start;
+
+    struct stat st;
+    if (total != STREAM_BYTES || stat(OUT_FILE, &st) < 0 ||
+        (unsigned long long)st.st_size != STREAM_BYTES || status != 0) {
+        fprintf(stderr, "tee lost data: %llu bytes through, status %d\n", total, status);
+        exit(EXIT_FAILURE);
+    }
+    unlink(OUT_FILE);
+
+    printf("  %-14s pipe %5d KB %8.0f MB/s\n", builtin ? "tee builtin" : "/usr/bin/tee",
+           pipe_size > 0 ? pipe_size >> 10 : 64, (STREAM_BYTES >> 20) / elapsed);
+}
+
+int main(void) {
+    printf("producer | tee %s | consumer: %llu MB\n", OUT_FILE, STREAM_BYTES >> 20);
+    for (size_t p = 0; p < sizeof(pipe_sizes) / sizeof(pipe_sizes[0]); p++) {
+        run(false, pipe_sizes[p]);
+        run(true, pipe_sizes[p]);
+    }
+
+    return 0;
+}
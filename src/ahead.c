@@ -0,0 +1,243 @@
+#include <linux/futex.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "lab.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ahead_relax() __builtin_ia32_pause()
+#else
+#define ahead_relax() atomic_signal_fence(memory_order_seq_cst)
+#endif
+
+// Times a side looks at the ring again before it goes to sleep
+#define AHEAD_SPIN 200
+
+/**
+ * @brief A ring of parsed lines with one writer, the parse-ahead thread,
+ * and one reader, the shell. Each side only stores to its own index so
+ * neither takes a lock. A side that finds the ring empty or full says so
+ * in its waiting flag and sleeps on the other side's index with a futex,
+ * the other side only makes the wake up call when the flag is set. A full
+ * ring is left to drain to half before the thread is woken, so it parses
+ * lines in batches instead of being woken for every one.
+ */
+struct parse_ahead {
+    _Alignas(64) atomic_uint head;  /* next slot the thread fills */
+    atomic_int reader_waiting;
+    _Alignas(64) atomic_uint tail;  /* next slot the shell takes */
+    atomic_int writer_waiting;
+    atomic_bool stop;               /* the shell is done with the script */
+    _Alignas(64) struct parsed_line slots[AHEAD_LINES];
+    struct line_reader *reader;
+    pthread_t thread;
+};
+
+/**
+ * Helper function
+ *
+ * @brief Sleep while *word still holds seen.
+ */
+static void ahead_sleep(atomic_uint *word, unsigned seen) {
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+}
+
+/**
+ * Helper function
+ *
+ * @brief Wake the side sleeping on word.
+ */
+static void ahead_wake(atomic_uint *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/**
+ * Helper function
+ *
+ * @brief Wait a moment for the other side to move word away from seen
+ * before going to sleep, most waits are shorter than a futex round trip.
+ *
+ * @return unsigned The value of word
+ */
+static unsigned ahead_spin(atomic_uint *word, unsigned seen) {
+    unsigned now = seen;
+    for (int i = 0; i < AHEAD_SPIN && now == seen; i++) {
+        ahead_relax();
+        now = atomic_load_explicit(word, memory_order_acquire);
+    }
+
+    return now;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Put a parsed line in the ring, waiting for the shell to take one
+ * if it is full. A line that comes in after ahead_free has said stop is
+ * dropped.
+ *
+ * @return bool False if the shell wants no more lines
+ */
+static bool ahead_push(struct parse_ahead *pa, const struct parsed_line *pl) {
+    unsigned head = atomic_load_explicit(&pa->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&pa->tail, memory_order_acquire);
+    if (head - tail == AHEAD_LINES) {
+        tail = ahead_spin(&pa->tail, tail);
+    }
+    if (head - tail == AHEAD_LINES) {
+        while (head - tail > AHEAD_LINES / 2 && !atomic_load(&pa->stop)) {
+            // say we are going to sleep before looking again, so a shell
+            // that takes a slot after the second look sees the flag
+            atomic_store(&pa->writer_waiting, 1);
+            tail = atomic_load(&pa->tail);
+            if (head - tail > AHEAD_LINES / 2) {
+                ahead_sleep(&pa->tail, tail);
+                tail = atomic_load(&pa->tail);
+            }
+        }
+        atomic_store(&pa->writer_waiting, 0);
+    }
+    if (atomic_load(&pa->stop)) {
+        cmd_free(pl->cmd);
+        return false;
+    }
+
+    pa->slots[head % AHEAD_LINES] = *pl;
+    atomic_store(&pa->head, head + 1);
+    if (atomic_load(&pa->reader_waiting)) {
+        ahead_wake(&pa->head);
+    }
+
+    return true;
+}
+
+/**
+ * Helper function
+ *
+ * @brief The parse-ahead thread: read, trim and parse every line of the
+ * script, the end of the script goes in the ring as an empty line.
+ */
+static void *ahead_run(void *arg) {
+    struct parse_ahead *pa = arg;
+
+    // signals are the shell's business
+    sigset_t mask;
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    // ahead_free may cancel the thread, but only while it waits in read,
+    // anywhere else it could be holding the allocator's locks
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+    while (true) {
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        char *line = reader_next(pa->reader);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        if (line == NULL) {
+            break;
+        }
+        line = trim_white(line);
+        if (*line == '\0' || *line == '#') {
+            continue;
+        }
+        // syntax errors go through the ring as well, so they are reported
+        // after the output of the lines in front of them
+        struct parsed_line pl = {NULL, NULL, NULL};
+        pl.cmd = cmd_parse_detached(line, &pl.line, &pl.err);
+        if (!ahead_push(pa, &pl)) {
+            return NULL;
+        }
+    }
+    struct parsed_line end = {NULL, NULL, NULL};
+    ahead_push(pa, &end);
+
+    return NULL;
+}
+
+/* Start parsing ahead of the shell */
+struct parse_ahead *ahead_start(int fd) {
+    struct parse_ahead *pa = aligned_alloc(_Alignof(struct parse_ahead), sizeof(struct parse_ahead));
+    if (pa == NULL) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    atomic_init(&pa->head, 0);
+    atomic_init(&pa->tail, 0);
+    atomic_init(&pa->reader_waiting, 0);
+    atomic_init(&pa->writer_waiting, 0);
+    atomic_init(&pa->stop, false);
+    pa->reader = reader_new(fd);
+
+    int err = pthread_create(&pa->thread, NULL, ahead_run, pa);
+    if (err != 0) {
+        fprintf(stderr, "pthread_create failed: %s\n", strerror(err));
+        reader_free(pa->reader);
+        free(pa);
+        return NULL;
+    }
+
+    return pa;
+}
+
+/* Take the next parsed line */
+bool ahead_next(struct parse_ahead *pa, struct parsed_line *out) {
+    unsigned tail = atomic_load_explicit(&pa->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&pa->head, memory_order_acquire);
+    if (head == tail) {
+        head = ahead_spin(&pa->head, head);
+    }
+    while (head == tail) {
+        atomic_store(&pa->reader_waiting, 1);
+        head = atomic_load(&pa->head);
+        if (head == tail) {
+            ahead_sleep(&pa->head, head);
+            head = atomic_load(&pa->head);
+        }
+        atomic_store(&pa->reader_waiting, 0);
+    }
+
+    *out = pa->slots[tail % AHEAD_LINES];
+    atomic_store(&pa->tail, tail + 1);
+    if (atomic_load(&pa->writer_waiting) && head - (tail + 1) <= AHEAD_LINES / 2) {
+        ahead_wake(&pa->tail);
+    }
+
+    return out->cmd != NULL || out->err != NULL;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Take every line in the ring without running it, as the shell
+ * would, so a thread waiting for room goes on.
+ */
+static void ahead_discard(struct parse_ahead *pa) {
+    unsigned tail = atomic_load(&pa->tail);
+    unsigned head = atomic_load(&pa->head);
+    for (; tail != head; tail++) {
+        cmd_free(pa->slots[tail % AHEAD_LINES].cmd);
+    }
+    atomic_store(&pa->tail, tail);
+    ahead_wake(&pa->tail);
+}
+
+/* Stop the thread and free the parse-ahead stage */
+void ahead_free(struct parse_ahead *pa) {
+    if (pa != NULL) {
+        // the thread is done once it has handed out the end of the script,
+        // before that it is either reading, which the cancel ends, or
+        // parsing and pushing, which the flag ends
+        atomic_store(&pa->stop, true);
+        pthread_cancel(pa->thread);
+        ahead_discard(pa);
+        pthread_join(pa->thread, NULL);
+        ahead_discard(pa);
+        reader_free(pa->reader);
+        free(pa);
+    }
+}
@@ -0,0 +1,186 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "lab.h"
+
+/* Bytes execve copies for a vector: the strings and the pointers to them */
+size_t exec_args_size(char **argv) {
+    size_t size = sizeof(char *);  // the NULL terminator
+
+    for (size_t i = 0; argv[i] != NULL; i++) {
+        size += strlen(argv[i]) + 1 + sizeof(char *);
+    }
+
+    return size;
+}
+
+/* The room execve has for argv and envp together */
+size_t exec_args_limit(void) {
+    long arg_max = sysconf(_SC_ARG_MAX);
+    if (arg_max <= ARGSPLIT_HEADROOM) {
+        return 0;
+    }
+
+    return (size_t)arg_max - ARGSPLIT_HEADROOM;
+}
+
+/* Leading arguments that every batch repeats */
+size_t argsplit_fixed(char **argv) {
+    if (argv[0] == NULL) {
+        return 0;
+    }
+
+    // the command and its leading options, up to and including "--"
+    size_t fixed = 1;
+    while (argv[fixed] != NULL && argv[fixed][0] == '-') {
+        if (strcmp(argv[fixed++], "--") == 0) {
+            break;
+        }
+    }
+
+    return fixed;
+}
+
+/* Pack the trailing arguments into as few batches as fit */
+size_t argsplit_plan(char **argv, size_t fixed, size_t budget, size_t *ends) {
+    // every batch repeats the fixed prefix
+    size_t base = sizeof(char *);
+    for (size_t i = 0; i < fixed; i++) {
+        base += strlen(argv[i]) + 1 + sizeof(char *);
+    }
+    if (base >= budget) {
+        return 0;
+    }
+
+    // greedy packing: each batch takes as many arguments as still fit, no
+    // split into contiguous batches can use fewer
+    size_t batches = 0;
+    size_t size = base;
+    size_t i = fixed;
+    for (; argv[i] != NULL; i++) {
+        size_t arg = strlen(argv[i]) + 1 + sizeof(char *);
+        if (base + arg > budget) {
+            return 0;  // this argument does not fit even on its own
+        }
+        if (size + arg > budget) {
+            ends[batches++] = i;
+            size = base;
+        }
+        size += arg;
+    }
+    if (i > fixed) {
+        ends[batches++] = i;
+    }
+
+    return batches;
+}
+
+/* Run a command that does not fit in ARG_MAX as several */
+int argsplit_run(struct shell *sh, char **argv, const char *cmdline) {
+    extern char **environ;
+    size_t limit = exec_args_limit();
+    size_t env_size = exec_args_size(environ);
+    if (exec_args_size(argv) + env_size <= limit || env_size >= limit) {
+        return -1;
+    }
+
+    size_t argc = 0;
+    while (argv[argc] != NULL) {
+        argc++;
+    }
+    size_t fixed = argsplit_fixed(argv);
+    size_t *ends = malloc(argc * sizeof(size_t));
+    char **batch = malloc((argc + 1) * sizeof(char *));
+    pid_t *pids = malloc((size_t)sh->argsplit * sizeof(pid_t));
+    if (ends == NULL || batch == NULL || pids == NULL) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    size_t batches = argsplit_plan(argv, fixed, limit - env_size, ends);
+    if (batches == 0) {
+        // a single argument is too big, let exec report it
+        free(ends);
+        free(batch);
+        free(pids);
+        return -1;
+    }
+
+    // the fixed prefix is shared by every batch, only the tail is rewritten
+    memcpy(batch, argv, fixed * sizeof(char *));
+    size_t start = fixed;
+    size_t b = 0;
+    size_t running = 0;
+    pid_t pgid = 0;
+    int status = 0;
+    bool stopped = false;
+    while (!stopped && (b < batches || running > 0)) {
+        if (b < batches && running < (size_t)sh->argsplit) {
+            size_t n = ends[b] - start;
+            memcpy(batch + fixed, argv + start, n * sizeof(char *));
+            batch[fixed + n] = NULL;
+            start = ends[b++];
+
+            // the child copies batch on exec so it can be reused straight
+            // away, once every batch has exited the group is gone and a new
+            // one starts
+            struct spawn_attr attr = {.pgid = running == 0 ? 0 : pgid, .foreground = true};
+            pid_t pid = sh_spawn(sh, batch, &attr);
+            if (pid < 0) {
+                // the rest would not start either
+                status = status == 0 ? 127 : status;
+                b = batches;
+                continue;
+            }
+            if (running == 0) {
+                pgid = pid;
+            }
+            pids[running++] = pid;
+            continue;
+        }
+
+        // Ctrl-Z stops the group, the shell has to take the prompt back
+        int ws;
+        pid_t pid = waitpid(-pgid, &ws, WUNTRACED);
+        if (pid < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("waitpid failed");
+            break;
+        }
+        if (WIFSTOPPED(ws)) {
+            stopped = true;
+            break;
+        }
+        for (size_t i = 0; i < running; i++) {
+            if (pids[i] == pid) {
+                pids[i] = pids[--running];
+                break;
+            }
+        }
+        // any batch that fails fails the command, the first one says how
+        int code = WIFSIGNALED(ws) ? 128 + WTERMSIG(ws) : WEXITSTATUS(ws);
+        if (status == 0) {
+            status = code;
+        }
+    }
+
+    if (stopped) {
+        job_adopt(sh, pgid, pids, running, cmdline);
+        if (b < batches) {
+            fprintf(stderr, "%zu of %zu argument batches not started\n", batches - b, batches);
+        }
+        status = 128 + SIGTSTP;
+    }
+    free(ends);
+    free(batch);
+    free(pids);
+
+    return status;
+}
@@ -0,0 +1,360 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "lab.h"
+
+// Hash buckets for the command table, a power of two
+#define HASH_BUCKETS 256
+
+// Changes in a PATH directory that can make a remembered lookup wrong
+#define WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                      IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+
+/**
+ * @brief One remembered command: where name was found and how many times the
+ * shell has used that location. A NULL path remembers that name is not in
+ * any PATH directory.
+ */
+struct hash_entry {
+    char *name;
+    char *path;
+    unsigned long hits;
+    struct hash_entry *chain;
+};
+
+static struct hash_entry *buckets[HASH_BUCKETS];
+
+// The PATH the table was filled under, a different PATH empties the table
+static char *hashed_path;
+
+// inotify instance watching every PATH directory
+static int watch_fd = -1;
+
+// Every PATH directory is absolute and watched, so a miss stays a miss
+// until an event says otherwise and can be remembered
+static bool watch_complete;
+
+// Result of the last lookup that went through a relative PATH entry, those
+// are never remembered because they depend on the working directory, even
+// when the match itself is in an absolute one
+static char *uncached_path;
+
+/**
+ * Helper function
+ *
+ * @brief The search path execvp would use.
+ */
+static const char *search_path(void) {
+    const char *path = getenv("PATH");
+
+    return path != NULL ? path : "/bin:/usr/bin";
+}
+
+/**
+ * Helper function
+ *
+ * @brief Find the entry for name or the link where it would go.
+ */
+static struct hash_entry **hash_find(const char *name) {
+    size_t len = strlen(name);
+    struct hash_entry **link = &buckets[pcache_hash(name, len) & (HASH_BUCKETS - 1)];
+    while (*link != NULL && strcmp((*link)->name, name) != 0) {
+        link = &(*link)->chain;
+    }
+
+    return link;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Insert or replace the entry for name, path may be NULL.
+ */
+static void hash_store(const char *name, const char *path) {
+    struct hash_entry **link = hash_find(name);
+    struct hash_entry *e = *link;
+    if (e == NULL) {
+        e = calloc(1, sizeof(struct hash_entry));
+        if (e == NULL) {
+            perror("calloc failed");
+            exit(EXIT_FAILURE);
+        }
+        e->name = strdup(name);
+        if (e->name == NULL) {
+            perror("strdup failed");
+            exit(EXIT_FAILURE);
+        }
+        *link = e;
+    } else {
+        free(e->path);
+        e->hits = 0;
+    }
+
+    e->path = NULL;
+    if (path != NULL && (e->path = strdup(path)) == NULL) {
+        perror("strdup failed");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Helper function
+ *
+ * @brief Drop whatever is remembered about name.
+ */
+static void hash_forget(const char *name) {
+    struct hash_entry **link = hash_find(name);
+    struct hash_entry *e = *link;
+    if (e != NULL) {
+        *link = e->chain;
+        free(e->name);
+        free(e->path);
+        free(e);
+    }
+}
+
+/**
+ * Helper function
+ *
+ * @brief Watch every directory in path. Misses are only remembered when all
+ * of them are watched, otherwise a new file could appear unnoticed.
+ */
+static void watch_dirs(const char *path) {
+    watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    watch_complete = watch_fd >= 0;
+
+    char *dirs = strdup(path);
+    if (dirs == NULL) {
+        perror("strdup failed");
+        exit(EXIT_FAILURE);
+    }
+
+    // an empty entry means the working directory, like "." does
+    char *dir = dirs;
+    while (dir != NULL) {
+        char *colon = strchr(dir, ':');
+        if (colon != NULL) {
+            *colon = '\0';
+        }
+
+        if (dir[0] != '/') {
+            watch_complete = false;
+        } else if (watch_fd >= 0 && inotify_add_watch(watch_fd, dir, WATCH_EVENTS) < 0) {
+            watch_complete = false;
+        }
+
+        dir = colon != NULL ? colon + 1 : NULL;
+    }
+
+    free(dirs);
+}
+
+/**
+ * Helper function
+ *
+ * @brief Empty the table when PATH is not what it was filled under and
+ * start watching the directories of the new one.
+ */
+static void hash_check_path(void) {
+    const char *path = search_path();
+    if (hashed_path != NULL && strcmp(hashed_path, path) == 0) {
+        return;
+    }
+
+    hash_clear();
+    hashed_path = strdup(path);
+    if (hashed_path == NULL) {
+        perror("strdup failed");
+        exit(EXIT_FAILURE);
+    }
+    watch_dirs(path);
+}
+
+/**
+ * Helper function
+ *
+ * @brief Walk PATH the way execvp does and return the first executable
+ * regular file called name.
+ *
+ * @param name The command to find
+ * @param relative Set to true if the match came from a relative PATH entry
+ * or one was searched before it
+ * @return char* The path, the caller must free it, or NULL
+ */
+static char *path_search(const char *name, bool *relative) {
+    const char *dirs = search_path();
+    size_t name_len = strlen(name);
+    *relative = false;
+
+    while (true) {
+        const char *colon = strchr(dirs, ':');
+        size_t dir_len = colon != NULL ? (size_t)(colon - dirs) : strlen(dirs);
+
+        // an empty entry is the working directory
+        const char *dir = dir_len > 0 ? dirs : ".";
+        size_t len = dir_len > 0 ? dir_len : 1;
+
+        char *path = malloc(len + 1 + name_len + 1);
+        if (path == NULL) {
+            perror("malloc failed");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(path, dir, len);
+        path[len] = '/';
+        memcpy(path + len + 1, name, name_len + 1);
+
+        // a relative entry in front of the match can hold name in another
+        // working directory, and then execvp would run that one
+        *relative |= dir[0] != '/';
+        struct stat st;
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0) {
+            return path;
+        }
+        free(path);
+
+        if (colon == NULL) {
+            return NULL;
+        }
+        dirs = colon + 1;
+    }
+}
+
+/* Resolve a command name through the table, searching PATH on a miss */
+const char *hash_lookup(const char *name) {
+    // names with a slash are run as they are
+    if (strchr(name, '/') != NULL) {
+        return name;
+    }
+
+    hash_check_path();
+
+    struct hash_entry **link = hash_find(name);
+    if (*link == NULL) {
+        bool relative = false;
+        char *path = path_search(name, &relative);
+
+        if (relative) {
+            // only valid in the current directory, do not remember it
+            free(uncached_path);
+            uncached_path = path;
+            return path;
+        }
+        if (path == NULL && !watch_complete) {
+            // a new file could show up unnoticed, do not remember the miss
+            return NULL;
+        }
+
+        hash_store(name, path);
+        free(path);
+        link = hash_find(name);
+    }
+
+    (*link)->hits++;
+
+    return (*link)->path;
+}
+
+/* Remember path as the location of name */
+void hash_add(const char *name, const char *path) {
+    hash_check_path();
+    hash_store(name, path);
+}
+
+/* Apply the changes inotify saw in the PATH directories */
+void hash_drain(void) {
+    if (watch_fd < 0) {
+        return;
+    }
+
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool flush = false;
+    ssize_t n;
+    while ((n = read(watch_fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + n; ) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+
+            if (ev->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                // lost events or a directory went away, nothing can be trusted
+                flush = true;
+            } else if (ev->len > 0) {
+                // a file came or went, only lookups of that name are affected
+                hash_forget(ev->name);
+            }
+
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+
+    // everything is found again and the directories watched afresh
+    if (flush) {
+        hash_clear();
+    }
+}
+
+/* Stop watching the PATH directories */
+void hash_unwatch(void) {
+    if (watch_fd >= 0) {
+        close(watch_fd);
+        watch_fd = -1;
+    }
+    // nothing tells the table about new files any more
+    watch_complete = false;
+}
+
+/* The inotify descriptor for event loops */
+int hash_watch_fd(void) {
+    return watch_fd;
+}
+
+/* Forget every remembered command */
+void hash_clear(void) {
+    for (size_t i = 0; i < HASH_BUCKETS; i++) {
+        while (buckets[i] != NULL) {
+            struct hash_entry *e = buckets[i];
+            buckets[i] = e->chain;
+            free(e->name);
+            free(e->path);
+            free(e);
+        }
+    }
+
+    free(hashed_path);
+    hashed_path = NULL;
+    free(uncached_path);
+    uncached_path = NULL;
+
+    // the watches belong to the PATH that was just forgotten
+    if (watch_fd >= 0) {
+        close(watch_fd);
+        watch_fd = -1;
+    }
+    watch_complete = false;
+}
+
+/* Print the table the way bash's hash builtin does */
+void hash_print(struct writer *w) {
+    bool empty = true;
+
+    for (size_t i = 0; i < HASH_BUCKETS; i++) {
+        for (struct hash_entry *e = buckets[i]; e != NULL; e = e->chain) {
+            // remembered misses are not locations
+            if (e->path == NULL) {
+                continue;
+            }
+            if (empty) {
+                writer_printf(w, "hits\tcommand\n");
+                empty = false;
+            }
+            writer_printf(w, "%4lu\t%s\n", e->hits, e->path);
+        }
+    }
+
+    if (empty) {
+        writer_printf(w, "hash: hash table empty\n");
+    }
+}
@@ -0,0 +1,988 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/pidfd.h>
+#include <sys/wait.h>
+
+#include "lab.h"
+
+/**
+ * Helper function
+ *
+ * @brief Add an empty job to the end of the table. Like bash the new job
+ * gets the number after the highest one in use.
+ */
+static struct job *job_new(struct shell *sh, const char *cmdline) {
+    struct job *job = calloc(1, sizeof(struct job));
+    if (job == NULL) {
+        perror("calloc failed");
+        exit(EXIT_FAILURE);
+    }
+    job->cmdline = strdup(cmdline);
+    if (job->cmdline == NULL) {
+        perror("strdup failed");
+        exit(EXIT_FAILURE);
+    }
+    job->state = JOB_RUNNING;
+    job->tmodes = sh->shell_tmodes;
+
+    struct job **link = &sh->jobs;
+    job->id = 1;
+    while (*link != NULL) {
+        job->id = (*link)->id + 1;
+        link = &(*link)->next;
+    }
+    *link = job;
+
+    return job;
+}
+
+static bool job_poll(struct job *job);
+
+/**
+ * @brief A builtin stage run on a thread of the shell instead of in a
+ * forked copy of it.
+ */
+struct job_worker {
+    struct shell *sh;
+    char **argv;       /* the stage, the words belong to the caller */
+    int fd;            /* where the output goes, closed when it is done */
+    pthread_t thread;
+    struct writer w;
+};
+
+/**
+ * Helper function
+ *
+ * @brief Close the worker's output so the next stage sees end of file,
+ * also run when the worker is cancelled in the middle of a write.
+ */
+static void job_worker_close(void *arg) {
+    struct job_worker *wk = arg;
+    close(wk->fd);
+    wk->fd = -1;
+}
+
+/**
+ * Helper function
+ *
+ * @brief The worker thread: run the builtin and write its output.
+ */
+static void *job_worker_run(void *arg) {
+    struct job_worker *wk = arg;
+
+    // a reader that went away must fail the write with EPIPE, SIGPIPE
+    // would take the whole shell down; a pending one dies with the thread
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    pthread_cleanup_push(job_worker_close, wk);
+    writer_init(&wk->w, wk->fd);
+    builtin_write(wk->sh, wk->argv, &wk->w);
+    writer_flush(&wk->w);
+    pthread_cleanup_pop(1);
+
+    return NULL;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Set up a worker for the builtin stage writing to fd. The worker
+ * gets its own copy of fd and of the stage vector, the words are shared.
+ */
+static struct job_worker *job_worker_new(struct shell *sh, char **stage, int fd) {
+    size_t argc = 0;
+    while (stage[argc] != NULL) {
+        argc++;
+    }
+    struct job_worker *wk = malloc(sizeof(struct job_worker));
+    char **argv = malloc((argc + 1) * sizeof(char *));
+    if (wk == NULL || argv == NULL) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(argv, stage, (argc + 1) * sizeof(char *));
+    wk->sh = sh;
+    wk->argv = argv;
+    wk->fd = fcntl(fd, F_DUPFD_CLOEXEC, 3);
+    if (wk->fd < 0) {
+        perror("fcntl failed");
+        free(argv);
+        free(wk);
+        return NULL;
+    }
+
+    return wk;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Wait for a worker and free it, cancelling it first if cancel is
+ * set. A worker that never started only has its descriptor to close.
+ */
+static void job_worker_free(struct job_worker *wk, bool started, bool cancel) {
+    if (!started) {
+        close(wk->fd);
+    } else {
+        if (cancel) {
+            pthread_cancel(wk->thread);
+        }
+        pthread_join(wk->thread, NULL);
+    }
+    free(wk->argv);
+    free(wk);
+}
+
+/**
+ * Helper function
+ *
+ * @brief A pidfd of job became readable: one of its processes exited.
+ */
+static void job_proc_exited(struct shell *sh, int fd, void *arg) {
+    UNUSED(sh);
+    UNUSED(fd);
+    job_poll(arg);
+}
+
+/**
+ * Helper function
+ *
+ * @brief Record a process that belongs to job. The pid is turned into a
+ * pidfd straight away, the child can not have been reaped yet so the pid
+ * still names it.
+ */
+static void job_add_proc(struct job *job, pid_t pid) {
+    struct job_proc *procs = realloc(job->procs, (job->nprocs + 1) * sizeof(struct job_proc));
+    if (procs == NULL) {
+        perror("realloc failed");
+        exit(EXIT_FAILURE);
+    }
+    job->procs = procs;
+
+    // kernels without pidfds fall back to waiting on the pid, pidfds are
+    // always close on exec
+    int pidfd = pidfd_open(pid, 0);
+    if (pidfd >= 0 && loop_active()) {
+        loop_add_fd(pidfd, job_proc_exited, job);
+    }
+    job->procs[job->nprocs++] = (struct job_proc){.pid = pid, .pidfd = pidfd};
+    job->live++;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Stop watching a process that is gone.
+ */
+static void job_proc_close(struct job_proc *proc) {
+    if (proc->pidfd >= 0) {
+        loop_remove_fd(proc->pidfd);
+        close(proc->pidfd);
+        proc->pidfd = -1;
+    }
+}
+
+/**
+ * Helper function
+ *
+ * @brief Unlink a job from the table and free it.
+ */
+static void job_remove(struct shell *sh, struct job *job) {
+    struct job **link = &sh->jobs;
+    while (*link != job) {
+        link = &(*link)->next;
+    }
+    *link = job->next;
+
+    for (size_t i = 0; i < job->nprocs; i++) {
+        job_proc_close(&job->procs[i]);
+    }
+    // every process is gone, a worker still writing gets EPIPE and ends
+    if (job->worker != NULL) {
+        job_worker_free(job->worker, true, false);
+    }
+    if (job->timer != 0) {
+        loop_cancel(job->timer);
+    }
+    free(job->cmdline);
+    free(job->procs);
+    free(job);
+}
+
+/**
+ * Helper function
+ *
+ * @brief Apply a status from waitpid to the process it belongs to.
+ */
+static void job_mark(struct job *job, pid_t pid, int status) {
+    if (WIFSTOPPED(status)) {
+        // one stopped process stops the whole job, the terminal sent the
+        // signal to the process group; the others are no news
+        if (job->state != JOB_STOPPED) {
+            job->state = JOB_STOPPED;
+            job->notified = false;
+        }
+        return;
+    }
+    if (WIFCONTINUED(status)) {
+        job->state = JOB_RUNNING;
+        return;
+    }
+
+    for (size_t i = 0; i < job->nprocs; i++) {
+        struct job_proc *proc = &job->procs[i];
+        if (proc->pid == pid && !proc->done) {
+            proc->done = true;
+            proc->status = status;
+            job_proc_close(proc);
+            if (--job->live == 0) {
+                job->state = JOB_DONE;
+                job->notified = false;
+            }
+            return;
+        }
+    }
+}
+
+/**
+ * Helper function
+ *
+ * @brief Turn what waitid reports into a waitpid status.
+ */
+static int wait_status(const siginfo_t *info) {
+    switch (info->si_code) {
+        case CLD_EXITED:
+            return W_EXITCODE(info->si_status, 0);
+        case CLD_KILLED:
+            return W_EXITCODE(0, info->si_status);
+        case CLD_DUMPED:
+            return W_EXITCODE(0, info->si_status) | WCOREFLAG;
+        case CLD_STOPPED:
+        case CLD_TRAPPED:
+            return W_STOPCODE(info->si_status);
+        default:
+            return 0xffff;  // CLD_CONTINUED
+    }
+}
+
+/**
+ * Helper function
+ *
+ * @brief Collect every state change of one job without blocking. Stops and
+ * continues are read for the whole process group, exits one process at a
+ * time through its pidfd.
+ */
+static bool job_poll(struct job *job) {
+    bool changed = false;
+    siginfo_t info;
+
+    while (job->state != JOB_DONE) {
+        // waitid leaves si_pid alone when there is nothing to report
+        info.si_pid = 0;
+        if (waitid(P_PGID, job->pgid, &info, WSTOPPED | WCONTINUED | WNOHANG) < 0 ||
+            info.si_pid == 0) {
+            break;
+        }
+        job_mark(job, info.si_pid, wait_status(&info));
+        changed = true;
+    }
+
+    for (size_t i = 0; i < job->nprocs; i++) {
+        struct job_proc *proc = &job->procs[i];
+        if (proc->done) {
+            continue;
+        }
+        info.si_pid = 0;
+        int rc = proc->pidfd >= 0
+            ? waitid(P_PIDFD, proc->pidfd, &info, WEXITED | WNOHANG)
+            : waitid(P_PID, proc->pid, &info, WEXITED | WNOHANG);
+        if (rc == 0 && info.si_pid != 0) {
+            job_mark(job, proc->pid, wait_status(&info));
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+/**
+ * Helper function
+ *
+ * @brief The exit status of a job is the status of its last process, like
+ * a pipeline's.
+ */
+static int job_status(const struct job *job) {
+    int status = job->procs[job->nprocs - 1].status;
+    // the statuses GNU timeout reports
+    if (job->timed_out != 0) {
+        return job->timed_out == SIGKILL ? 128 + SIGKILL : 124;
+    }
+    if (job->state == JOB_STOPPED) {
+        return 128 + SIGTSTP;
+    }
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+
+    return WEXITSTATUS(status);
+}
+
+/**
+ * Helper function
+ *
+ * @brief Print one line of the job table, marker is + for the current job,
+ * - for the previous one and a space otherwise.
+ */
+static void job_print(const struct job *job, char marker) {
+    char state[32];
+    if (job->state == JOB_RUNNING) {
+        snprintf(state, sizeof(state), "Running");
+    } else if (job->state == JOB_STOPPED) {
+        snprintf(state, sizeof(state), "Stopped");
+    } else {
+        int status = job->procs[job->nprocs - 1].status;
+        if (WIFSIGNALED(status)) {
+            snprintf(state, sizeof(state), "%s", strsignal(WTERMSIG(status)));
+        } else if (WEXITSTATUS(status) != 0) {
+            snprintf(state, sizeof(state), "Exit %d", WEXITSTATUS(status));
+        } else {
+            snprintf(state, sizeof(state), "Done");
+        }
+    }
+
+    printf("[%d]%c  %-24s%s\n", job->id, marker, state, job->cmdline);
+}
+
+/**
+ * Helper function
+ *
+ * @brief The +/- marker bash shows for a job.
+ */
+static char job_marker(const struct job *job) {
+    if (job->next == NULL) {
+        return '+';
+    }
+
+    return job->next->next == NULL ? '-' : ' ';
+}
+
+/**
+ * Helper function
+ *
+ * @brief Record a stage that never started, it counts as a process that
+ * exited with code: 127 for a command the shell could not find, 1 for a
+ * redirection that failed.
+ */
+static void job_add_exited(struct job *job, int code) {
+    struct job_proc *procs = realloc(job->procs, (job->nprocs + 1) * sizeof(struct job_proc));
+    if (procs == NULL) {
+        perror("realloc failed");
+        exit(EXIT_FAILURE);
+    }
+    job->procs = procs;
+    job->procs[job->nprocs++] = (struct job_proc){
+        .pid = -1, .pidfd = -1, .status = W_EXITCODE(code, 0), .done = true};
+}
+
+/**
+ * Helper function
+ *
+ * @brief Open the redirections of one stage and take them out of it, the
+ * words move up in place. stdio starts out as the pipes and is updated
+ * left to right, so 2>&1 copies whatever stdout is at that point. The
+ * files are opened close on exec and added to opened, the child only
+ * keeps the copies it makes.
+ *
+ * @return bool False if a file could not be opened, the reason has been
+ * printed
+ */
+static bool stage_redirect(char **stage, int *stdio, int *opened, size_t *nopened) {
+    char **word = stage;
+    for (char **p = stage; *p != NULL; p++) {
+        enum cmd_op op = cmd_op(*p);
+        if (op < OP_IN || op > OP_ERR_OUT) {
+            *word++ = *p;
+            continue;
+        }
+        if (op == OP_ERR_OUT) {
+            stdio[STDERR_FILENO] = stdio[STDOUT_FILENO];
+            continue;
+        }
+        if (p[1] == NULL || cmd_op(p[1]) != OP_NONE) {
+            fprintf(stderr, "syntax error near unexpected token `%s'\n",
+                    p[1] != NULL ? p[1] : "newline");
+            return false;
+        }
+
+        const char *path = *++p;
+        int flags = O_WRONLY | O_CREAT | O_TRUNC;
+        int target = op == OP_ERR ? STDERR_FILENO : STDOUT_FILENO;
+        if (op == OP_IN) {
+            flags = O_RDONLY;
+            target = STDIN_FILENO;
+        } else if (op == OP_APPEND) {
+            flags = O_WRONLY | O_CREAT | O_APPEND;
+        }
+        int fd = open(path, flags | O_CLOEXEC, 0666);
+        if (fd < 0) {
+            fprintf(stderr, "%s: %s\n", path, strerror(errno));
+            return false;
+        }
+        opened[(*nopened)++] = fd;
+        stdio[target] = fd;
+    }
+    *word = NULL;
+
+    return true;
+}
+
+/* Start a pipeline as a new job without waiting */
+struct job *job_start(struct shell *sh, char **argv, const char *cmdline, bool background) {
+    struct job *job = job_new(sh, cmdline);
+    job->pgid = sh->job_pgid;
+
+    // cut the pipeline into stages on a private copy, argv may be shared
+    size_t argc = 0;
+    while (argv[argc] != NULL) {
+        argc++;
+    }
+    char **stages = malloc((argc + 1) * sizeof(char *));
+    if (stages == NULL) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(stages, argv, (argc + 1) * sizeof(char *));
+    // every redirection takes at least one token
+    int *opened = malloc((argc + 1) * sizeof(int));
+    if (opened == NULL) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+
+    // every stage is started before any is waited for, the pipes are close
+    // on exec so each child keeps only the two ends it was given
+    int in = STDIN_FILENO;
+    struct job_worker *worker = NULL;
+    for (char **stage = stages; stage != NULL;) {
+        char **next = stage;
+        while (*next != NULL && cmd_op(*next) != OP_PIPE) {
+            next++;
+        }
+        int fds[2] = {-1, STDOUT_FILENO};
+        if (*next != NULL) {
+            *next++ = NULL;
+            if (pipe2(fds, O_CLOEXEC) < 0) {
+                // the stages started so far see a closed pipe and go away
+                perror("pipe2 failed");
+                job_add_exited(job, 127);
+                break;
+            }
+            // a bigger pipe means fewer context switches between the stages,
+            // a size the kernel refuses leaves the default
+            if (sh->pipe_size > 0) {
+                fcntl(fds[1], F_SETPIPE_SZ, sh->pipe_size);
+            }
+        } else {
+            next = NULL;
+        }
+
+        int stdio[3] = {in, fds[1], STDERR_FILENO};
+        size_t nopened = 0;
+        struct spawn_attr attr = {.pgid = job->pgid, .foreground = !background, .stdio = stdio};
+        pid_t pid = -1;
+        int code = 127;
+        if (!stage_redirect(stage, stdio, opened, &nopened)) {
+            code = 1;
+        } else if (stage[0] == NULL) {
+            // only redirections, the files are created and that is all
+            code = 0;
+        } else if (!background && stage == stages && next != NULL && builtin_writes(stage) &&
+                   stdio[STDIN_FILENO] == STDIN_FILENO && stdio[STDERR_FILENO] == STDERR_FILENO) {
+            // a builtin that only prints feeds the pipe from a thread, the
+            // shell is not copied; the thread starts after the last fork of
+            // the job and queue_schedule starts nothing while it runs, so
+            // no child is made with the thread live
+            worker = job_worker_new(sh, stage, stdio[STDOUT_FILENO]);
+            code = worker != NULL ? 0 : 1;
+        } else if (is_builtin(stage[0])) {
+            // like bash a builtin in a pipeline runs in a copy of the shell
+            pid = sh_fork(sh, &attr);
+            if (pid == 0) {
+                // the next stage's end is close on exec, but there is no exec
+                if (fds[0] >= 0) {
+                    close(fds[0]);
+                }
+                do_builtin(sh, stage);
+                fflush(NULL);
+                _exit(sh->status);
+            }
+        } else {
+            pid = sh_spawn(sh, stage, &attr);
+        }
+        if (pid < 0) {
+            job_add_exited(job, code);
+        } else {
+            if (job->pgid == 0) {
+                job->pgid = pid;
+            }
+            job_add_proc(job, pid);
+        }
+
+        // the children have their copies now
+        while (nopened > 0) {
+            close(opened[--nopened]);
+        }
+        if (in != STDIN_FILENO) {
+            close(in);
+        }
+        if (fds[1] != STDOUT_FILENO) {
+            close(fds[1]);
+        }
+        in = fds[0];
+        stage = next;
+    }
+    if (in >= 0 && in != STDIN_FILENO) {
+        close(in);
+    }
+    free(opened);
+    free(stages);
+
+    if (job->live == 0) {
+        // not a single stage started, nobody would read the worker
+        if (worker != NULL) {
+            job_worker_free(worker, false, false);
+        }
+        job_remove(sh, job);
+        return NULL;
+    }
+    if (worker != NULL) {
+        int err = pthread_create(&worker->thread, NULL, job_worker_run, worker);
+        if (err != 0) {
+            fprintf(stderr, "pthread_create failed: %s\n", strerror(err));
+            job_worker_free(worker, false, false);
+        } else {
+            job->worker = worker;
+        }
+    }
+
+    return job;
+}
+
+/* Start a command as a new job */
+int job_run(struct shell *sh, char **argv, const char *cmdline, bool background) {
+    struct job *job = job_start(sh, argv, cmdline, background);
+    if (job == NULL) {
+        return -1;
+    }
+
+    if (background) {
+        if (sh->shell_is_interactive) {
+            printf("[%d] %d\n", job->id, job->pgid);
+        }
+        return 0;
+    }
+
+    return job_foreground(sh, job, false);
+}
+
+/**
+ * Helper function
+ *
+ * @brief Find the command name of a stage without opening anything, it
+ * may be behind redirections.
+ *
+ * @return char* The name or NULL if the stage is only redirections
+ */
+static char *stage_name(char **stage) {
+    char **word = stage;
+    while (*word != NULL && cmd_op(*word) != OP_NONE) {
+        word += cmd_op(*word) == OP_ERR_OUT || word[1] == NULL ? 1 : 2;
+    }
+
+    return *word;
+}
+
+/* Run a builtin with redirections in the shell process */
+bool job_builtin(struct shell *sh, char **argv) {
+    char *name = stage_name(argv);
+    if (name == NULL || !is_builtin(name)) {
+        return false;
+    }
+    if (builtin_forks(sh, name)) {
+        // the copy of the shell opens the files itself
+        char *cmdline = join_args(argv);
+        int code = job_run(sh, argv, cmdline, false);
+        free(cmdline);
+        sh->status = code < 0 ? 1 : code;
+        return true;
+    }
+
+    size_t argc = 0;
+    while (argv[argc] != NULL) {
+        argc++;
+    }
+    char **stage = malloc((argc + 1) * sizeof(char *));
+    int *opened = malloc((argc + 1) * sizeof(int));
+    if (stage == NULL || opened == NULL) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(stage, argv, (argc + 1) * sizeof(char *));
+    int stdio[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    size_t nopened = 0;
+
+    sh->status = 1;
+    if (stage_redirect(stage, stdio, opened, &nopened)) {
+        // save every descriptor that is replaced before touching any, so
+        // 2>&1 > f still finds the old stdout; the copies are close on
+        // exec and above 2 so commands the builtin starts never see them
+        int saved[3] = {-1, -1, -1};
+        fflush(stdout);
+        fflush(stderr);
+        for (int i = 0; i < 3; i++) {
+            if (stdio[i] != i) {
+                saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 3);
+            }
+        }
+        for (int i = 0; i < 3; i++) {
+            if (stdio[i] != i) {
+                int from = stdio[i] < 3 && saved[stdio[i]] >= 0 ? saved[stdio[i]] : stdio[i];
+                dup2(from, i);
+            }
+        }
+
+        do_builtin(sh, stage);
+
+        fflush(stdout);
+        fflush(stderr);
+        for (int i = 0; i < 3; i++) {
+            if (saved[i] >= 0) {
+                dup2(saved[i], i);
+                close(saved[i]);
+            }
+        }
+    }
+
+    while (nopened > 0) {
+        close(opened[--nopened]);
+    }
+    free(opened);
+    free(stage);
+
+    return true;
+}
+
+/* Replace the shell with a command */
+int job_exec(struct shell *sh, char **argv) {
+    char *name = stage_name(argv);
+    if (name != NULL && is_builtin(name)) {
+        return -1;
+    }
+    size_t argc = 0;
+    while (argv[argc] != NULL) {
+        if (cmd_op(argv[argc++]) == OP_PIPE) {
+            return -1;
+        }
+    }
+
+    char **stage = malloc((argc + 1) * sizeof(char *));
+    int *opened = malloc((argc + 1) * sizeof(int));
+    if (stage == NULL || opened == NULL) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(stage, argv, (argc + 1) * sizeof(char *));
+    int stdio[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    size_t nopened = 0;
+
+    // the files are close on exec like for a job, the command only keeps
+    // the copies on 0, 1 and 2
+    int status = 1;
+    if (stage_redirect(stage, stdio, opened, &nopened)) {
+        status = stage[0] == NULL ? 0 : sh_exec(sh, stage, stdio);
+    }
+
+    while (nopened > 0) {
+        close(opened[--nopened]);
+    }
+    free(opened);
+    free(stage);
+
+    return status;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Send sig to a job. A job with a group of its own gets it as a
+ * group, one in the group every job of a copy of the shell shares (see
+ * job_pgid) gets it process by process, so the other jobs and the copy
+ * itself are left alone.
+ *
+ * @return int 0 on success, -1 with errno set otherwise
+ */
+static int job_signal(struct shell *sh, struct job *job, int sig) {
+    if (sh->job_pgid == 0 || job->pgid != sh->job_pgid) {
+        return kill(-job->pgid, sig);
+    }
+
+    int rc = 0;
+    for (size_t i = 0; i < job->nprocs; i++) {
+        const struct job_proc *proc = &job->procs[i];
+        if (proc->done) {
+            continue;
+        }
+        if (proc->pidfd >= 0 ? pidfd_send_signal(proc->pidfd, sig, NULL, 0) : kill(proc->pid, sig)) {
+            rc = -1;
+        }
+    }
+
+    return rc;
+}
+
+/**
+ * Helper function
+ *
+ * @brief The timeout of a job ran out: SIGTERM first, SIGKILL if the job
+ * is still around kill_after later. The group is only signalled while one
+ * of its processes is alive, so the pgid can not have been reused.
+ */
+static void job_expired(struct shell *sh, void *arg) {
+    struct job *job = arg;
+    job->timer = 0;
+    if (job->live == 0) {
+        return;
+    }
+
+    int sig = job->timed_out == 0 ? SIGTERM : SIGKILL;
+    job->timed_out = sig;
+    job_signal(sh, job, sig);
+    // a stopped job has to run to act on SIGTERM
+    job_signal(sh, job, SIGCONT);
+    if (sig == SIGTERM) {
+        job->timer = loop_timer(job->kill_after, job_expired, job);
+    }
+}
+
+/* Send SIGTERM and later SIGKILL when the job runs too long */
+int job_timeout(struct shell *sh, struct job *job, unsigned ms, unsigned kill_after) {
+    UNUSED(sh);
+    if (!loop_active()) {
+        return -1;
+    }
+
+    job->kill_after = kill_after;
+    job->timer = loop_timer(ms, job_expired, job);
+
+    return 0;
+}
+
+/* Give a job the terminal and wait until it exits or stops */
+int job_foreground(struct shell *sh, struct job *job, bool cont) {
+    job->state = JOB_RUNNING;
+
+    /* Put the job into the foreground.  */
+    if (sh->shell_is_interactive) {
+        tcsetpgrp(sh->shell_terminal, job->pgid);
+        if (cont) {
+            tcsetattr(sh->shell_terminal, TCSADRAIN, &job->tmodes);
+        }
+    }
+    if (cont && job_signal(sh, job, SIGCONT) < 0) {
+        perror("kill (SIGCONT)");
+    }
+
+    // every process of the job is in its group, stops are reported too so
+    // Ctrl-Z hands the prompt back
+    while (loop_active() && job->state == JOB_RUNNING) {
+        // wake up for SIGCHLD without giving up on timers and other jobs,
+        // the SIGCHLD handler may already have collected this job
+        loop_once(sh);
+        job_poll(job);
+    }
+    // a copy of the shell has no prompt to hand back, a job stopped along
+    // with it is waited for until it goes on and exits
+    bool copy = sh->job_pgid != 0;
+    while (job->state == JOB_RUNNING || (copy && job->state == JOB_STOPPED)) {
+        // in a copy of the shell the group is shared with its other jobs,
+        // only this one's processes are waited for
+        pid_t wait_for = -job->pgid;
+        for (size_t i = 0; job->pgid == sh->job_pgid && i < job->nprocs; i++) {
+            if (!job->procs[i].done) {
+                wait_for = job->procs[i].pid;
+                break;
+            }
+        }
+        int status;
+        pid_t pid = waitpid(wait_for, &status, WUNTRACED);
+        if (pid < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // nothing left to wait for, someone else reaped the job
+            job->state = JOB_DONE;
+            break;
+        }
+        job_mark(job, pid, status);
+    }
+
+    /* Put the shell back in the foreground.  */
+    if (sh->shell_is_interactive) {
+        tcsetpgrp(sh->shell_terminal, sh->shell_pgid);
+        /* Restore the shell's terminal modes.  */
+        tcgetattr(sh->shell_terminal, &job->tmodes);
+        tcsetattr(sh->shell_terminal, TCSADRAIN, &sh->shell_tmodes);
+    }
+
+    int status = job_status(job);
+    if (job->state == JOB_STOPPED && job->worker != NULL) {
+        // the shell is about to take commands again and may change what
+        // the worker reads, the rest of the builtin's output is lost
+        job_worker_free(job->worker, true, true);
+        job->worker = NULL;
+    }
+    if (job->state == JOB_STOPPED) {
+        printf("\n");
+        job_print(job, '+');
+        job->notified = true;
+    } else {
+        job_remove(sh, job);
+    }
+
+    return status;
+}
+
+/* Take a stopped process group into the job table */
+struct job *job_adopt(struct shell *sh, pid_t pgid, const pid_t *pids, size_t n, const char *cmdline) {
+    struct job *job = job_new(sh, cmdline);
+    job->pgid = pgid;
+    for (size_t i = 0; i < n; i++) {
+        job_add_proc(job, pids[i]);
+    }
+    job->state = JOB_STOPPED;
+
+    // the rest of the group stops as well, job_poll collects those stops
+    if (sh->shell_is_interactive) {
+        tcsetpgrp(sh->shell_terminal, sh->shell_pgid);
+        tcgetattr(sh->shell_terminal, &job->tmodes);
+        tcsetattr(sh->shell_terminal, TCSADRAIN, &sh->shell_tmodes);
+    }
+    printf("\n");
+    job_print(job, '+');
+    job->notified = true;
+
+    return job;
+}
+
+/* Continue a stopped job without giving it the terminal */
+void job_background(struct shell *sh, struct job *job) {
+    job->state = JOB_RUNNING;
+    if (job_signal(sh, job, SIGCONT) < 0) {
+        perror("kill (SIGCONT)");
+        return;
+    }
+    printf("[%d]%c %s\n", job->id, job_marker(job), job->cmdline);
+}
+
+/* Look up a job by job spec */
+struct job *job_find(struct shell *sh, const char *spec) {
+    struct job *job = sh->jobs;
+
+    // no spec, %% and %+ all mean the current job
+    if (spec == NULL || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0) {
+        while (job != NULL && job->next != NULL) {
+            job = job->next;
+        }
+        return job;
+    }
+
+    if (spec[0] == '%') {
+        spec++;
+    }
+    char *end;
+    long id = strtol(spec, &end, 10);
+    if (*spec == '\0' || *end != '\0') {
+        return NULL;
+    }
+    while (job != NULL && job->id != id) {
+        job = job->next;
+    }
+
+    return job;
+}
+
+/* Reap children that changed state without blocking */
+bool jobs_update(struct shell *sh) {
+    // only wait on the jobs' own process groups, other children of the
+    // shell such as the zygote are not ours to reap here
+    bool pending = false;
+    for (struct job *job = sh->jobs; job != NULL; job = job->next) {
+        job_poll(job);
+        // a pidfd callback may have collected the change already
+        pending |= job->state != JOB_RUNNING && !job->notified;
+    }
+
+    return pending;
+}
+
+/* Report and drop finished jobs */
+void jobs_notify(struct shell *sh) {
+    struct job *job = sh->jobs;
+    while (job != NULL) {
+        struct job *next = job->next;
+        bool report = sh->shell_is_interactive && !job->notified;
+        if (job->state == JOB_DONE) {
+            if (report) {
+                job_print(job, job_marker(job));
+            }
+            job_remove(sh, job);
+        } else if (job->state == JOB_STOPPED && report) {
+            job_print(job, job_marker(job));
+            job->notified = true;
+        }
+        job = next;
+    }
+}
+
+/* List every job */
+void jobs_print(struct shell *sh) {
+    for (struct job *job = sh->jobs; job != NULL; job = job->next) {
+        job_print(job, job_marker(job));
+        // a finished job is shown once and then dropped by jobs_notify
+        job->notified = true;
+    }
+}
+
+/* Forget every job */
+void jobs_free(struct shell *sh) {
+    while (sh->jobs != NULL) {
+        job_remove(sh, sh->jobs);
+    }
+}
+
+/* Drop the job table a forked copy inherited */
+void jobs_forget(struct shell *sh) {
+    while (sh->jobs != NULL) {
+        struct job *job = sh->jobs;
+        sh->jobs = job->next;
+        // the pidfds are closed with the copy's other descriptors and the
+        // worker thread stayed behind in the shell
+        if (job->worker != NULL) {
+            free(job->worker->argv);
+            free(job->worker);
+        }
+        free(job->cmdline);
+        free(job->procs);
+        free(job);
+    }
+}
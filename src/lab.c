@@ -1,8 +1,12 @@
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <stdint.h>
 #include <string.h>
 #include <pwd.h>
 #include <signal.h>
@@ -17,6 +21,8 @@
 // static variables for the argument parsing
 static int flags = 0;
 static const char *cvalue = NULL;
+static const char *evalue = NULL;
+static const char *script = NULL;
 
 /**
  * Helper function
@@ -35,7 +41,7 @@ void parse_args(int argc, char **argv) {
     int opt;
 
     // parse args/options
-    while ((opt = getopt(argc, argv, "vc:dh")) != -1) {
+    while ((opt = getopt(argc, argv, "vc:dhx:s:p:e:a:r")) != -1) {
         switch (opt) {
             case 'v':
                 flags |= FLAG_VERSION; // enable the version flag
@@ -54,17 +60,49 @@ void parse_args(int argc, char **argv) {
             case 'd':
                 flags |= FLAG_DEBUG; // enable the debug flag
                 break;
+            case 'x':
+                // split argument lists that exceed ARG_MAX, the value is
+                // how many batches may run at once
+                setenv("MY_ARGSPLIT", optarg, 1);
+                break;
+            case 's':
+                // how external commands are started, see sh_spawn
+                setenv("MY_SPAWN", optarg, 1);
+                break;
+            case 'p':
+                // capacity of the pipes between pipeline stages
+                setenv("MY_PIPESZ", optarg, 1);
+                break;
+            case 'e':
+                // run the command string and exit, -c is the prompt
+                evalue = optarg;
+                break;
+            case 'a':
+                // CPUs the children run on
+                setenv("MY_AFFINITY", optarg, 1);
+                break;
+            case 'r':
+                // one CPU of the -a list per child, in turn
+                setenv("MY_AFFINITY_RR", "1", 1);
+                break;
             case 'h':
                 // prints the usage message and options to the standard output
-                printf("Usage: %s [-option1] [-option2] [-option3] [...]\n", argv[0]);
+                printf("Usage: %s [-option1] [-option2] [-option3] [...] [script]\n", argv[0]);
                 printf("Options:\n");
                 printf("  -c \"MY_PROMPT\"\tSet the value for the enviornment variable MY_PROMPT\n");
                 printf("  -d\t\t\tTurn on the debug flag\n");
                 printf("  -h\t\t\tDisplay the help message\n");
                 printf("  -v\t\t\tPrint the version number\n");
+                printf("  -x N\t\t\tSplit argument lists too long for exec into batches, N at a time\n");
+                printf("  -s BACKEND\t\tStart commands with fork, vfork, posix_spawn, clone3 or zygote (MY_SPAWN)\n");
+                printf("  -p SIZE\t\tGive pipeline pipes SIZE bytes, k and m suffixes allowed (MY_PIPESZ)\n");
+                printf("  -e \"COMMANDS\"\tRun COMMANDS and exit, the last command replaces the shell\n");
+                printf("  -a CPULIST\t\tRun commands on the CPUs in CPULIST, as in 0-3,8 (MY_AFFINITY)\n");
+                printf("  -r\t\t\tGive each command one CPU of the -a list in turn (MY_AFFINITY_RR)\n");
                 return; // exit the function 
             case '?':
-                if (optopt == 'c') {
+                if (optopt == 'c' || optopt == 'x' || optopt == 's' || optopt == 'p' ||
+                    optopt == 'e' || optopt == 'a') {
                     fprintf(stderr, "Option -%c requires an argument.\n", optopt);
                 } else if (isprint(optopt)) {
                     fprintf(stderr, "Unknown option '-%c'.\n", optopt);
@@ -78,18 +116,34 @@ void parse_args(int argc, char **argv) {
         }
     }
 
+    // the first argument that is not an option is a script to run
+    if (optind < argc) {
+        script = argv[optind];
+    }
+
     // print argument values if the debug flag is set
     if (flags & FLAG_DEBUG) {
         print_args_values();
     }
 
-    // print usage message if no arguments are provided
-    if (argc < 2) {
+    // print usage message if no arguments are provided, commands piped
+    // in are run without it so their output is not mixed with it
+    if (argc < 2 && isatty(STDIN_FILENO)) {
         printf("Usage: %s [-option1] [-option2] [-option3] [...]\n", argv[0]);
         printf("For help: %s -h\n", argv[0]);
     }
 }
 
+/* The command string to run instead of reading commands */
+const char *get_command(void) {
+    return evalue;
+}
+
+/* The script to run instead of reading commands */
+const char *get_script(void) {
+    return script;
+}
+
 /* set the shell prompt */
 char *get_prompt(const char *env) {
     // get the value of the environment variable
@@ -163,78 +217,328 @@ int change_dir(char **dir) {
     return 0;
 }
 
-/* Handle parsing and double quotes */
-char **cmd_parse(char const *line) {
-    size_t arg_max = sysconf(_SC_ARG_MAX);
-    char **cmd = malloc(arg_max * sizeof(char *));
-    if (cmd == NULL) {
+/* Create a bump allocator backed by one block */
+struct arena *arena_new(size_t cap) {
+    struct arena *a = malloc(sizeof(struct arena) + cap);
+    if (a == NULL) {
         perror("malloc failed");
         exit(EXIT_FAILURE);
     }
 
-    int i = 0;
-    const char *p = line;
-    while (*p != '\0') {
-        // Skip leading whitespace
-        while (isspace(*p)) {
-            p++;
+    a->refs = 1;
+    a->cap = cap;
+    a->used = 0;
+
+    return a;
+}
+
+/* Carve an aligned allocation off the front of the arena */
+void *arena_alloc(struct arena *a, size_t size, size_t align) {
+    // round the bump pointer up to the requested alignment
+    size_t start = (a->used + align - 1) & ~(align - 1);
+
+    // check that the allocation fits in what is left of the block
+    if (start > a->cap || size > a->cap - start) {
+        return NULL;
+    }
+
+    a->used = start + size;
+
+    return a->data + start;
+}
+
+/* The first allocation sits at the front of the block */
+struct arena *arena_head(void *first) {
+    return (struct arena *)((unsigned char *)first - offsetof(struct arena, data));
+}
+
+/* Take another reference to the arena */
+void arena_retain(struct arena *a) {
+    a->refs++;
+}
+
+/* Drop a reference, the last one releases everything allocated from it */
+void arena_free(struct arena *a) {
+    if (--a->refs == 0) {
+        free(a);
+    }
+}
+
+// Byte classes seen by the lexer
+enum lex_class {
+    C_ORD,      // anything without a special meaning
+    C_SPACE,    // separates tokens outside of quotes
+    C_SQUOTE,   // '
+    C_DQUOTE,   // "
+    C_BSLASH,   // backslash
+    C_DQESC,    // $ and ` which a backslash escapes inside double quotes
+    C_OP,       // starts an operator outside of quotes
+    C_COUNT
+};
+
+// Lexer states
+enum lex_state {
+    S_BLANK,    // between tokens
+    S_WORD,     // in the unquoted part of a token
+    S_SQUOTE,   // inside '...'
+    S_DQUOTE,   // inside "..."
+    S_ESC,      // after a backslash outside quotes
+    S_DQESC,    // after a backslash inside "..."
+    S_COUNT
+};
+
+// Actions packed above the next state in each transition
+#define A_START  (1 << 3)   // a new token starts at this byte
+#define A_EMIT   (1 << 4)   // copy this byte into the token
+#define A_EMITBS (1 << 5)   // copy a backslash in front of this byte
+#define A_END    (1 << 6)   // the token ends at this byte
+#define A_OP     (1 << 7)   // an operator starts at this byte
+#define A_STATE  0x07
+
+static const unsigned char lex_class[256] = {
+    [' '] = C_SPACE, ['\t'] = C_SPACE, ['\n'] = C_SPACE,
+    ['\v'] = C_SPACE, ['\f'] = C_SPACE, ['\r'] = C_SPACE,
+    ['\''] = C_SQUOTE, ['"'] = C_DQUOTE, ['\\'] = C_BSLASH,
+    ['$'] = C_DQESC, ['`'] = C_DQESC,
+    ['&'] = C_OP, ['|'] = C_OP, ['<'] = C_OP, ['>'] = C_OP, [';'] = C_OP,
+};
+
+// Operator tokens, indexed by enum cmd_op. The vector holds pointers to
+// these strings and not copies so a quoted "&" is never taken for one.
+static const char op_text[OP_COUNT][8] = {
+    [OP_BG] = "&",
+    [OP_PIPE] = "|",
+    [OP_IN] = "<",
+    [OP_OUT] = ">",
+    [OP_APPEND] = ">>",
+    [OP_ERR] = "2>",
+    [OP_ERR_OUT] = "2>&1",
+    [OP_SEQ] = ";",
+    [OP_AND] = "&&",
+    [OP_OR] = "||",
+};
+
+// The next state and actions for every (state, class) pair
+static const unsigned char lex_table[S_COUNT][C_COUNT] = {
+    [S_BLANK] = {
+        [C_ORD]    = S_WORD   | A_START | A_EMIT,
+        [C_SPACE]  = S_BLANK,
+        [C_SQUOTE] = S_SQUOTE | A_START,
+        [C_DQUOTE] = S_DQUOTE | A_START,
+        [C_BSLASH] = S_ESC    | A_START,
+        [C_DQESC]  = S_WORD   | A_START | A_EMIT,
+        [C_OP]     = S_BLANK  | A_OP,
+    },
+    [S_WORD] = {
+        [C_ORD]    = S_WORD   | A_EMIT,
+        [C_SPACE]  = S_BLANK  | A_END,
+        [C_SQUOTE] = S_SQUOTE,
+        [C_DQUOTE] = S_DQUOTE,
+        [C_BSLASH] = S_ESC,
+        [C_DQESC]  = S_WORD   | A_EMIT,
+        [C_OP]     = S_BLANK  | A_END | A_OP,
+    },
+    [S_SQUOTE] = {
+        // nothing is special inside single quotes except the closing quote
+        [C_ORD]    = S_SQUOTE | A_EMIT,
+        [C_SPACE]  = S_SQUOTE | A_EMIT,
+        [C_SQUOTE] = S_WORD,
+        [C_DQUOTE] = S_SQUOTE | A_EMIT,
+        [C_BSLASH] = S_SQUOTE | A_EMIT,
+        [C_DQESC]  = S_SQUOTE | A_EMIT,
+        [C_OP]     = S_SQUOTE | A_EMIT,
+    },
+    [S_DQUOTE] = {
+        [C_ORD]    = S_DQUOTE | A_EMIT,
+        [C_SPACE]  = S_DQUOTE | A_EMIT,
+        [C_SQUOTE] = S_DQUOTE | A_EMIT,
+        [C_DQUOTE] = S_WORD,
+        [C_BSLASH] = S_DQESC,
+        [C_DQESC]  = S_DQUOTE | A_EMIT,
+        [C_OP]     = S_DQUOTE | A_EMIT,
+    },
+    [S_ESC] = {
+        // an escaped byte is always taken literally
+        [C_ORD]    = S_WORD   | A_EMIT,
+        [C_SPACE]  = S_WORD   | A_EMIT,
+        [C_SQUOTE] = S_WORD   | A_EMIT,
+        [C_DQUOTE] = S_WORD   | A_EMIT,
+        [C_BSLASH] = S_WORD   | A_EMIT,
+        [C_DQESC]  = S_WORD   | A_EMIT,
+        [C_OP]     = S_WORD   | A_EMIT,
+    },
+    [S_DQESC] = {
+        // inside double quotes a backslash only escapes " \ $ and `
+        [C_ORD]    = S_DQUOTE | A_EMITBS | A_EMIT,
+        [C_SPACE]  = S_DQUOTE | A_EMITBS | A_EMIT,
+        [C_SQUOTE] = S_DQUOTE | A_EMITBS | A_EMIT,
+        [C_DQUOTE] = S_DQUOTE | A_EMIT,
+        [C_BSLASH] = S_DQUOTE | A_EMIT,
+        [C_DQESC]  = S_DQUOTE | A_EMIT,
+        [C_OP]     = S_DQUOTE | A_EMITBS | A_EMIT,
+    },
+};
+
+// Bytes that end a run of plain bytes inside quotes, scan_delim knows the
+// set for unquoted words
+static const bool lex_stop[S_DQUOTE + 1][256] = {
+    [S_SQUOTE] = {['\''] = true},
+    [S_DQUOTE] = {['"'] = true, ['\\'] = true},
+};
+
+/**
+ * Helper function
+ *
+ * @brief Copy a run of bytes that leave state unchanged from *src to *dst
+ * and advance both. The end of an unquoted run is found with the vector
+ * scanner, quoted runs stop on so few bytes that a table walk is enough.
+ */
+static void lex_copy_run(unsigned state, const char **src, char **dst, const char *lend) {
+    const char *p = *src;
+    const char *run;
+
+    if (state == S_WORD) {
+        run = scan_delim(p, lend);
+    } else {
+        const bool *stop = lex_stop[state];
+        for (run = p; run < lend && !stop[(unsigned char)*run]; run++) {
         }
+    }
 
-        // Break if end of the string
-        if (*p == '\0') {
-            break;
+    // the source and destination overlap when parsing in place
+    memmove(*dst, p, run - p);
+    *dst += run - p;
+    *src = run;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Match the longest operator starting at p.
+ *
+ * @return size_t The length of the operator, its kind is stored in *op
+ */
+static size_t lex_op(const char *p, const char *end, enum cmd_op *op) {
+    size_t best = 0;
+    for (int k = OP_NONE + 1; k < OP_COUNT; k++) {
+        size_t len = strlen(op_text[k]);
+        if (len > best && (size_t)(end - p) >= len && memcmp(p, op_text[k], len) == 0) {
+            best = len;
+            *op = (enum cmd_op)k;
         }
+    }
 
-        // Handle quoted strings
-        if (*p == '"') {
-            p++;
-            const char *start = p;
-            while (*p != '"' && *p != '\0') {
-                p++;
-            }
+    return best;
+}
 
-            // Check for unmatched quote
-            if (*p == '\0') {
-                perror("Unmatched quote");
-                exit(EXIT_FAILURE);
-            }
+/* Tell an operator token from a word */
+enum cmd_op cmd_op(const char *token) {
+    // operator tokens point into op_text, words never do
+    uintptr_t offset = (uintptr_t)token - (uintptr_t)op_text;
+    if (offset < sizeof(op_text) && offset % sizeof(op_text[0]) == 0) {
+        return (enum cmd_op)(offset / sizeof(op_text[0]));
+    }
 
-            size_t len = p - start;
-            cmd[i] = strndup(start, len);
-            if (cmd[i] == NULL) {
-                perror("strndup failed");
-                exit(EXIT_FAILURE);
-            }
-            p++; // Skip closing quote
+    return OP_NONE;
+}
 
-        } else {
-            // Handle unquoted strings
-            const char *start = p;
-            while (!isspace(*p) && *p != '\0') {
-                p++;
-            }
+/**
+ * Helper function
+ *
+ * @brief Split line into tokens with the lexer table, writing the token
+ * bytes to out and a pointer to each token into cmd. out may point at line
+ * itself, tokens never grow while being copied so the writer can not
+ * overtake the reader.
+ *
+ * @param line The line to split
+ * @param len The length of line
+ * @param out Where the token bytes are written
+ * @param cmd Where the token pointers are written, NULL terminated
+ * @param debug Print the tokens as they are found
+ * @return NULL on success or a message describing the syntax error
+ */
+static const char *tokenize(const char *line, size_t len, char *out, char **cmd, bool debug) {
+    int i = 0;
+    unsigned state = S_BLANK;
+    const char *p = line;
+    const char *lend = line + len;
+    while (p < lend) {
+        // one lookup decides what to do with this byte
+        unsigned char c = (unsigned char)*p++;
+        unsigned t = lex_table[state][lex_class[c]];
+        // a 2 that starts a token right before > names stderr, anywhere
+        // else it is an ordinary byte
+        if (state == S_BLANK && c == '2' && p < lend && *p == '>') {
+            t = S_BLANK | A_OP;
+        }
+        state = t & A_STATE;
+
+        // match the operator before the terminator of the word in front of
+        // it is written, in place that terminator lands on the operator
+        enum cmd_op op = OP_NONE;
+        size_t op_len = t & A_OP ? lex_op(p - 1, lend, &op) : 0;
 
-            size_t len = p - start;
-            cmd[i] = strndup(start, len);
-            if (cmd[i] == NULL) {
-                perror("strndup failed");
-                exit(EXIT_FAILURE);
+        if (t & A_START) {
+            cmd[i] = out;
+        }
+        if (t & A_EMITBS) {
+            *out++ = '\\';
+        }
+        if (t & A_EMIT) {
+            *out++ = c;
+        }
+        if (t & A_END) {
+            *out++ = '\0';
+
+            // Print the token if the debug flag is set
+            if (debug) {
+                printf("cmd[%d]: %s\n", i, cmd[i]);
+            }
+            i++;
+        }
+        if (t & A_OP) {
+            // operators are their own tokens whether or not space surrounds
+            // them, the vector points at the shared operator text
+            p += op_len - 1;
+            cmd[i] = (char *)op_text[op];
+            if (debug) {
+                printf("cmd[%d]: %s\n", i, cmd[i]);
             }
+            i++;
         }
 
-        // Print the token if the debug flag is set
-        if (flags & FLAG_DEBUG) {
-            printf("cmd[%d]: %s\n", i, cmd[i]);
+        // inside a word or quote, bytes that can not change the state only
+        // need copying so find the end of the run and copy it in one go
+        bool in_run = state - S_WORD <= S_DQUOTE - S_WORD;
+        if (in_run && p < lend && lex_class[(unsigned char)*p] == C_ORD) {
+            lex_copy_run(state, &p, &out, lend);
         }
+    }
 
-        i++;
+    // the line must not end in the middle of a quote or escape
+    switch (state) {
+        case S_SQUOTE:
+            return "Unmatched single quote";
+        case S_DQUOTE:
+        case S_DQESC:
+            return "Unmatched double quote";
+        case S_ESC:
+            return "Backslash at end of line";
+        case S_WORD:
+            // terminate the last token
+            *out = '\0';
+            if (debug) {
+                printf("cmd[%d]: %s\n", i, cmd[i]);
+            }
+            i++;
+            break;
     }
 
     // Set the last element to NULL
     cmd[i] = NULL;
 
     // Print the final command array if the debug flag is set
-    if (flags & FLAG_DEBUG) {
+    if (debug) {
         printf("Parsed command: ");
         for (int j = 0; cmd[j] != NULL; j++) {
             printf("%s ", cmd[j]);
@@ -242,6 +546,109 @@ char **cmd_parse(char const *line) {
         printf("\n");
     }
 
+    return NULL;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Size of the argument vector for a line of len bytes. Operators
+ * need no space around them so every byte can start a token, as in a&b&c.
+ */
+static size_t cmd_vec_size(size_t len) {
+    return (len + 1) * sizeof(char *);
+}
+
+/* Handle parsing with POSIX quoting */
+char **cmd_parse(char const *line) {
+    size_t len = strlen(line);
+
+    // repeated lines are served from the cache without tokenizing again,
+    // long machine generated lines are not worth hashing
+    bool cacheable = len <= PCACHE_MAX_LEN;
+    unsigned long hash = 0;
+    char **cmd = NULL;
+    if (cacheable) {
+        hash = pcache_hash(line, len);
+        cmd = pcache_lookup(line, len, hash);
+        if (flags & FLAG_DEBUG) {
+            unsigned long hits, misses;
+            pcache_stats(&hits, &misses);
+            printf("Parse cache %s: %lu hits, %lu misses\n", cmd ? "hit" : "miss", hits, misses);
+        }
+        if (cmd != NULL) {
+            return cmd;
+        }
+    }
+
+    // a token never needs more bytes than it spans in the line plus its
+    // terminator and that terminator replaces the separator after it, so
+    // len + 1 bytes always hold every token, another len + 1 hold the copy
+    // of the line the cache compares against
+    size_t vec_size = cmd_vec_size(len);
+    size_t key_size = cacheable ? len + 1 : 0;
+    struct arena *a = arena_new(vec_size + len + 1 + key_size);
+    cmd = arena_alloc(a, vec_size, _Alignof(char *));
+    char *out = arena_alloc(a, len + 1, 1);
+
+    // report syntax errors to the caller instead of exiting the shell
+    const char *err = tokenize(line, len, out, cmd, flags & FLAG_DEBUG);
+    if (err != NULL) {
+        fprintf(stderr, "%s\n", err);
+        arena_free(a);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (cacheable) {
+        char *key = arena_alloc(a, key_size, 1);
+        memcpy(key, line, key_size);
+        pcache_insert(key, len, hash, cmd);
+    }
+
+    return cmd;
+}
+
+/* Tokenize the caller's buffer without copying */
+char **cmd_parse_inplace(char *line) {
+    // only the vector is allocated, the tokens stay in line
+    size_t len = strlen(line);
+    size_t vec_size = cmd_vec_size(len);
+    struct arena *a = arena_new(vec_size);
+    char **cmd = arena_alloc(a, vec_size, _Alignof(char *));
+
+    const char *err = tokenize(line, len, line, cmd, flags & FLAG_DEBUG);
+    if (err != NULL) {
+        fprintf(stderr, "%s\n", err);
+        arena_free(a);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return cmd;
+}
+
+/* Tokenize a copy of the line away from the parse cache */
+char **cmd_parse_detached(char const *line, char **copy, const char **err) {
+    // the same layout as a cache miss in cmd_parse, the copy takes the
+    // place of the cache key; the tokens are not printed under -d, from
+    // this thread they would land in the middle of the output of lines
+    // that run before this one
+    size_t len = strlen(line);
+    size_t vec_size = cmd_vec_size(len);
+    struct arena *a = arena_new(vec_size + 2 * (len + 1));
+    char **cmd = arena_alloc(a, vec_size, _Alignof(char *));
+    char *out = arena_alloc(a, len + 1, 1);
+
+    *err = tokenize(line, len, out, cmd, false);
+    if (*err != NULL) {
+        arena_free(a);
+        errno = EINVAL;
+        return NULL;
+    }
+    *copy = arena_alloc(a, len + 1, 1);
+    memcpy(*copy, line, len + 1);
+
     return cmd;
 }
 
@@ -251,13 +658,11 @@ char **cmd_parse(char const *line) {
  * @param line the line to free
  */
 void cmd_free(char ** line) {
-    // free the memory allocated for the command
-    for (int i = 0; line[i] != NULL; i++) {
-        free(line[i]);
+    // the vector is the first allocation in the arena that also holds
+    // every token so releasing the arena frees the whole command
+    if (line != NULL) {
+        arena_free(arena_head(line));
     }
-
-    // free the memory allocated for the command
-    free(line);
 }
 
 /* Trim whitespaces from user input */
@@ -269,12 +674,12 @@ char *trim_white(char *line) {
     char *end = line + strlen(line) - 1;
 
     // move the start pointer to the first non-whitespace character
-    while (isspace(*start)) {
+    while (scan_is_space(*start)) {
         start++;
     }
 
     // move the end pointer to the last non-whitespace character
-    while (end > start && isspace(*end)) {
+    while (end > start && scan_is_space(*end)) {
         end--;
     }
 
@@ -284,13 +689,8 @@ char *trim_white(char *line) {
     return start;
 }
 
-/**
- * Helper function
- * 
- * @brief Print the history of the shell
- * @param print_to_stdout flag to print to stdout
- */
-void print_history(int print_to_stdout) {
+/* Format the history of the shell into a writer */
+void history_write(struct writer *w) {
     // print the history
     HIST_ENTRY **the_history_list;
     the_history_list = history_list();
@@ -298,17 +698,237 @@ void print_history(int print_to_stdout) {
     // check if the history list is not NULL
     if (the_history_list) {
         // get the length of the history list
-        if (print_to_stdout) {
-            printf("History length: %d\n", history_length);
-        }
+        writer_printf(w, "History length: %d\n", history_length);
 
         // print the history list
         for (int i = 0; the_history_list[i]; i++) {
-            if (print_to_stdout) {
-                printf("%d: %s\n", i, the_history_list[i]->line);
-            }
+            writer_printf(w, "%d: %s\n", i, the_history_list[i]->line);
+        }
+    }
+}
+
+/**
+ * Helper function
+ *
+ * @brief Run a builtin that only prints with its output going to fd.
+ * The output goes out in large blocks instead of through stdio, which has
+ * to be flushed first to keep the order.
+ *
+ * @return int 0 on success, -1 if the output could not be written
+ */
+static int builtin_print(struct shell *sh, char **argv, int fd) {
+    fflush(stdout);
+    struct writer *w = malloc(sizeof(struct writer));
+    if (w == NULL) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    writer_init(w, fd);
+    builtin_write(sh, argv, w);
+    int status = writer_flush(w);
+    free(w);
+
+    return status;
+}
+
+/* Print the history of the shell */
+int print_history(int fd) {
+    static char *argv[] = {"printhistory", NULL};
+
+    return builtin_print(NULL, argv, fd);
+}
+
+/**
+ * Helper function
+ *
+ * @brief Parse a duration the way GNU timeout does: a non-negative number
+ * with an optional s, m, h or d suffix, seconds by default.
+ *
+ * @param arg The duration
+ * @param ms Set to the duration in milliseconds, rounded up
+ * @return True if arg is a valid duration
+ */
+static bool parse_duration(const char *arg, unsigned *ms) {
+    char *end;
+    double value = strtod(arg, &end);
+    if (end == arg || value < 0) {
+        return false;
+    }
+
+    double scale = 1000;
+    if (*end != '\0') {
+        switch (*end) {
+            case 's':
+                break;
+            case 'm':
+                scale *= 60;
+                break;
+            case 'h':
+                scale *= 60 * 60;
+                break;
+            case 'd':
+                scale *= 24 * 60 * 60;
+                break;
+            default:
+                return false;
         }
+        if (end[1] != '\0') {
+            return false;
+        }
+    }
+
+    // anything past what a timer can hold is as good as forever
+    double total = value * scale;
+    *ms = total >= UINT_MAX ? UINT_MAX : (unsigned)total + (total > (unsigned)total);
+
+    return true;
+}
+
+/* Join argv with spaces for the job table */
+char *join_args(char **argv) {
+    size_t len = 1;
+    for (int i = 0; argv[i] != NULL; i++) {
+        len += strlen(argv[i]) + 1;
+    }
+
+    char *line = malloc(len);
+    if (line == NULL) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    char *p = line;
+    for (int i = 0; argv[i] != NULL; i++) {
+        p = stpcpy(p, argv[i]);
+        *p++ = ' ';
+    }
+    p[p > line ? -1 : 0] = '\0';
+
+    return line;
+}
+
+/**
+ * Helper function
+ *
+ * @brief The timeout builtin: timeout [-k KILL_AFTER] DURATION COMMAND...
+ * runs COMMAND as a foreground job and stops it when DURATION runs out.
+ */
+static void do_timeout(struct shell *sh, char **argv) {
+    unsigned kill_after = TIMEOUT_KILL_AFTER_MS;
+    // usage errors are 125 like GNU timeout
+    sh->status = 125;
+    int i = 1;
+    if (argv[i] != NULL && strcmp(argv[i], "-k") == 0) {
+        if (argv[i + 1] == NULL || !parse_duration(argv[i + 1], &kill_after)) {
+            fprintf(stderr, "timeout: invalid kill duration\n");
+            return;
+        }
+        i += 2;
+    }
+
+    unsigned ms;
+    if (argv[i] == NULL || argv[i + 1] == NULL) {
+        fprintf(stderr, "timeout: usage: timeout [-k duration] duration command [arg]...\n");
+        return;
+    }
+    if (!parse_duration(argv[i], &ms)) {
+        fprintf(stderr, "timeout: invalid time interval '%s'\n", argv[i]);
+        return;
+    }
+
+    // the command is an ordinary job, the limit is a timer in the event
+    // loop rather than a watchdog process
+    hash_drain();
+    char *cmdline = join_args(argv);
+    struct job *job = job_start(sh, argv + i + 1, cmdline, false);
+    free(cmdline);
+    if (job == NULL) {
+        sh->status = 127;
+        return;
+    }
+    // a duration of 0 disables the timeout
+    if (ms > 0 && job_timeout(sh, job, ms, kill_after) < 0) {
+        fprintf(stderr, "timeout: no event loop, running without a limit\n");
+    }
+    sh->status = job_foreground(sh, job, false);
+}
+
+/**
+ * Helper function
+ *
+ * @brief Parse a byte count with an optional k or m suffix.
+ *
+ * @param arg The size
+ * @param size Set to the size in bytes
+ * @return True if arg is a valid size that fits in an int
+ */
+static bool parse_size(const char *arg, int *size) {
+    char *end;
+    errno = 0;
+    unsigned long value = strtoul(arg, &end, 10);
+    if (end == arg || errno != 0 || arg[0] == '-') {
+        return false;
+    }
+
+    if (*end == 'k' || *end == 'K') {
+        value <<= 10;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        value <<= 20;
+        end++;
     }
+    if (*end != '\0' || value > INT_MAX) {
+        return false;
+    }
+    *size = (int)value;
+
+    return true;
+}
+
+// Commands do_builtin handles
+static const char *builtin_names[] = {
+    "exit", "cd", "hash", "jobs", "fg", "bg", "timeout", "tee", "printhistory",
+    "parallel", "queue", "pin",
+};
+
+/* Check if a builtin does nothing but print */
+bool builtin_writes(char **argv) {
+    if (argv[0] == NULL) {
+        return false;
+    }
+
+    // only the main thread adds to the history, and not while a job runs;
+    // hash is left out because the loop looks names up and drains the
+    // watches while the job runs, a forked copy prints its own table
+    return strcmp(argv[0], "printhistory") == 0;
+}
+
+/* Run a builtin that only prints into a writer */
+void builtin_write(struct shell *sh, char **argv, struct writer *w) {
+    UNUSED(sh);
+    if (strcmp(argv[0], "printhistory") == 0) {
+        history_write(w);
+    } else if (strcmp(argv[0], "hash") == 0) {
+        hash_print(w);
+    }
+}
+
+/* Check if a builtin runs as a foreground job */
+bool builtin_forks(struct shell *sh, const char *name) {
+    // tee can wait on the terminal or an endless pipe for good, the shell
+    // only sees Ctrl-C at the prompt; a copy of the shell in the foreground
+    // gets Ctrl-C and Ctrl-Z from the terminal
+    return sh->shell_is_interactive && strcmp(name, "tee") == 0;
+}
+
+/* Check if a command is a builtin */
+bool is_builtin(const char *name) {
+    for (size_t i = 0; i < sizeof(builtin_names) / sizeof(builtin_names[0]); i++) {
+        if (strcmp(name, builtin_names[i]) == 0) {
+            return true;
+        }
+    }
+
+    return false;
 }
 
 /* Handle defined builtin commands */
@@ -321,6 +941,11 @@ bool do_builtin(struct shell *sh, char **argv) {
         return status;
     }
 
+    // a builtin succeeds unless it says otherwise
+    if (is_builtin(argv[0])) {
+        sh->status = 0;
+    }
+
     // handle the "exit" command
     if (strcmp(argv[0], "exit") == 0) {
         // destroy the shell
@@ -341,6 +966,7 @@ bool do_builtin(struct shell *sh, char **argv) {
             if (change_dir(argv) != 0) {
                 // print the error message
                 perror("cd failed");
+                sh->status = 1;
             }
 
             // update the status
@@ -353,6 +979,39 @@ bool do_builtin(struct shell *sh, char **argv) {
         if (change_dir(argv) != 0) {
             // print the error message
             perror("cd failed");
+            sh->status = 1;
+        }
+
+        // update the status
+        status = true;
+
+        return status;
+    }
+
+    // handle the "hash" command
+    if (strcmp(argv[0], "hash") == 0) {
+        if (argv[1] == NULL) {
+            // list the remembered commands
+            sh->status = builtin_print(sh, argv, STDOUT_FILENO) < 0;
+        } else if (strcmp(argv[1], "-r") == 0) {
+            // forget every remembered command
+            hash_clear();
+        } else if (strcmp(argv[1], "-p") == 0) {
+            // remember a location given by the user
+            if (argv[2] == NULL || argv[3] == NULL) {
+                fprintf(stderr, "hash: usage: hash -p path name\n");
+                sh->status = 2;
+            } else {
+                hash_add(argv[3], argv[2]);
+            }
+        } else {
+            // look the names up now so later runs are hits
+            for (int i = 1; argv[i] != NULL; i++) {
+                if (hash_lookup(argv[i]) == NULL) {
+                    fprintf(stderr, "hash: %s: not found\n", argv[i]);
+                    sh->status = 1;
+                }
+            }
         }
 
         // update the status
@@ -361,10 +1020,101 @@ bool do_builtin(struct shell *sh, char **argv) {
         return status;
     }
 
+    // handle the "jobs" command
+    if (strcmp(argv[0], "jobs") == 0) {
+        // pick up jobs that finished or stopped since the prompt
+        jobs_update(sh);
+        jobs_print(sh);
+
+        // update the status
+        status = true;
+
+        return status;
+    }
+
+    // handle the "fg" and "bg" commands
+    if (strcmp(argv[0], "fg") == 0 || strcmp(argv[0], "bg") == 0) {
+        jobs_update(sh);
+        struct job *job = job_find(sh, argv[1]);
+        if (job == NULL || job->state == JOB_DONE) {
+            fprintf(stderr, "%s: %s: no such job\n", argv[0], argv[1] != NULL ? argv[1] : "current");
+            sh->status = 1;
+        } else if (argv[0][0] == 'f') {
+            // like bash, say which job is being resumed
+            printf("%s\n", job->cmdline);
+            fflush(stdout);
+            sh->status = job_foreground(sh, job, true);
+        } else if (job->state == JOB_RUNNING) {
+            fprintf(stderr, "bg: job %d already in background\n", job->id);
+            sh->status = 1;
+        } else {
+            job_background(sh, job);
+        }
+
+        // update the status
+        status = true;
+
+        return status;
+    }
+
+    // handle the "timeout" command
+    if (strcmp(argv[0], "timeout") == 0) {
+        do_timeout(sh, argv);
+
+        // update the status
+        status = true;
+
+        return status;
+    }
+
+    // handle the "tee" command
+    if (strcmp(argv[0], "tee") == 0) {
+        if (builtin_forks(sh, argv[0])) {
+            job_builtin(sh, argv);
+        } else {
+            sh->status = tee_run(argv);
+        }
+
+        // update the status
+        status = true;
+
+        return status;
+    }
+
+    // handle the "parallel" command
+    if (strcmp(argv[0], "parallel") == 0) {
+        sh->status = parallel_run(sh, argv);
+
+        // update the status
+        status = true;
+
+        return status;
+    }
+
+    // handle the "queue" command
+    if (strcmp(argv[0], "queue") == 0) {
+        sh->status = queue_run(sh, argv);
+
+        // update the status
+        status = true;
+
+        return status;
+    }
+
+    // handle the "pin" command
+    if (strcmp(argv[0], "pin") == 0) {
+        sh->status = pin_run(sh, argv);
+
+        // update the status
+        status = true;
+
+        return status;
+    }
+
     // handle built-in "printhistory" command
     if (strcmp(argv[0], "printhistory") == 0) {
         // print the history
-        print_history(1);
+        sh->status = print_history(STDOUT_FILENO) < 0;
 
         // update the status
         status = true;
@@ -385,11 +1135,22 @@ void sh_init(struct shell *sh) {
         perror("NULL shell pointer");
     }
 
+    // children start with the mask the shell was started with, whatever
+    // the shell blocks for itself later
+    sigprocmask(SIG_SETMASK, NULL, &sh->child_mask);
+
     /* See if we are running interactively.  */
     sh->shell_terminal = STDIN_FILENO;
     sh->shell_is_interactive = isatty (sh->shell_terminal);
 
     if (sh->shell_is_interactive) {
+        // a builtin with < swaps fd 0 while it runs, the jobs it starts
+        // still have to get the terminal
+        int terminal = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 3);
+        if (terminal >= 0) {
+            sh->shell_terminal = terminal;
+        }
+
         /* Loop until we are in the foreground.  */
         while (tcgetpgrp (sh->shell_terminal) != (sh->shell_pgid = getpgrp ()))
             kill (sh->shell_pgid, SIGTTIN);
@@ -414,10 +1175,70 @@ void sh_init(struct shell *sh) {
 
         /* Save default terminal attributes for shell.  */
         tcgetattr (sh->shell_terminal, &sh->shell_tmodes);
+    } else {
+        sh->shell_pgid = getpgrp();
+    }
+
+    // Splitting oversized argument lists is opt in through "MY_ARGSPLIT"
+    const char *argsplit = getenv("MY_ARGSPLIT");
+    sh->argsplit = 0;
+    if (argsplit != NULL) {
+        char *end;
+        errno = 0;
+        long n = strtol(argsplit, &end, 10);
+        if (end == argsplit || *end != '\0' || errno != 0 || n < 0) {
+            fprintf(stderr, "Invalid argument split limit '%s', not splitting\n", argsplit);
+        } else if (n > ARGSPLIT_MAX_JOBS) {
+            fprintf(stderr, "Argument split limit '%s' too large, using %d\n", argsplit, ARGSPLIT_MAX_JOBS);
+            sh->argsplit = ARGSPLIT_MAX_JOBS;
+        } else {
+            sh->argsplit = (int)n;
+        }
+    }
+
+    // The spawn backend comes from "MY_SPAWN", fork unless asked otherwise
+    const char *spawn = getenv("MY_SPAWN");
+    int backend = spawn != NULL ? spawn_backend_parse(spawn) : SPAWN_FORK;
+    if (backend < 0) {
+        fprintf(stderr, "Unknown spawn backend '%s', using fork\n", spawn);
+        backend = SPAWN_FORK;
+    }
+    sh->spawn = (enum spawn_backend)backend;
+    // the zygote has to be forked before readline and history grow the heap
+    if (sh->spawn == SPAWN_ZYGOTE && zygote_start() < 0) {
+        perror("Couldn't start the zygote, using fork");
+        sh->spawn = SPAWN_FORK;
+    }
+
+    // Pipe capacity comes from "MY_PIPESZ", the kernel rounds it up to a
+    // power of two pages and caps it at /proc/sys/fs/pipe-max-size
+    const char *pipe_size = getenv("MY_PIPESZ");
+    sh->pipe_size = 0;
+    if (pipe_size != NULL && !parse_size(pipe_size, &sh->pipe_size)) {
+        fprintf(stderr, "Invalid pipe size '%s', using the default\n", pipe_size);
     }
 
     // Set the prompt from the environment variable "MY_PROMPT"
     sh->prompt = get_prompt("MY_PROMPT");
+
+    // no jobs yet, each one gets a group of its own
+    sh->jobs = NULL;
+    sh->job_pgid = 0;
+    sh->ahead = NULL;
+    sh->status = 0;
+    queue_init(sh);
+
+    // children may be kept off some CPUs, see pin_set
+    pin_clear(sh);
+    const char *affinity = getenv("MY_AFFINITY");
+    struct cpu_mask mask;
+    if (affinity != NULL) {
+        const char *rr = getenv("MY_AFFINITY_RR");
+        if (!cpu_list_parse(affinity, &mask) ||
+            pin_set(sh, &mask, rr != NULL && strcmp(rr, "0") != 0) < 0) {
+            fprintf(stderr, "Invalid cpu list '%s', children are not pinned\n", affinity);
+        }
+    }
 }
 
 /* Free shell members and reset the terminal settings */
@@ -426,6 +1247,9 @@ void sh_destroy(struct shell *sh) {
     if (sh->shell_is_interactive) {
         // Put the shell back in the foreground
         tcsetattr(sh->shell_terminal, TCSADRAIN, &sh->shell_tmodes);
+        if (sh->shell_terminal != STDIN_FILENO) {
+            close(sh->shell_terminal);
+        }
     }
 
     // free the prompt
@@ -433,5 +1257,20 @@ void sh_destroy(struct shell *sh) {
         free(sh->prompt);
     }
 
+    // show whether the parse cache paid for itself
+    if (flags & FLAG_DEBUG) {
+        unsigned long hits, misses;
+        pcache_stats(&hits, &misses);
+        printf("Parse cache: %lu hits, %lu misses\n", hits, misses);
+    }
+    // the parse-ahead thread may still be reading the script
+    ahead_free(sh->ahead);
+    sh->ahead = NULL;
+    pcache_clear();
+    zygote_stop();
+    queue_free(sh);
+    jobs_free(sh);
+    hash_clear();
+
     // Do not free the shell structure itself 
 }
\ No newline at end of file
@@ -2,6 +2,8 @@
 #define LAB_H
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <termios.h>
 #include <unistd.h>
@@ -10,11 +12,113 @@
 #define lab_VERSION_MINOR 0
 #define UNUSED(x) (void)x;
 
+// Number of lines the parse cache remembers
+#define PCACHE_ENTRIES 64
+// Longest line the parse cache will hold
+#define PCACHE_MAX_LEN 4096
+// Bytes of ARG_MAX left free when splitting argument lists, as xargs does
+#define ARGSPLIT_HEADROOM 2048
+// Most split batches that may run at once, larger -x values are capped
+#define ARGSPLIT_MAX_JOBS 256
+// Time the timeout builtin gives a command between SIGTERM and SIGKILL
+#define TIMEOUT_KILL_AFTER_MS 5000
+// Bytes a builtin's writer collects before writing them out
+#define WRITER_BUF_SIZE (64 * 1024)
+// Bytes the batch reader asks read(2) for at a time
+#define READER_BUF_SIZE (64 * 1024)
+// Parsed lines the batch parse-ahead thread may run in front of the shell
+#define AHEAD_LINES 64
+// Time between looks at the load while queued commands wait for it
+#define QUEUE_RECHECK_MS 1000
+// Time a script that ended waits for the load to let its queue start
+#define QUEUE_DRAIN_MS 60000
+// CPUs a child can be pinned to, the size of glibc's cpu_set_t
+#define CPU_MASK_BITS 1024
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
+  /**
+   * @brief How the shell creates the processes that run external commands.
+   */
+  enum spawn_backend
+  {
+    SPAWN_FORK,  /* fork then exec, copies the page tables of the shell */
+    SPAWN_VFORK, /* vfork then exec, the child borrows the shell's memory */
+    SPAWN_POSIX, /* posix_spawn, glibc runs the child setup for us */
+    SPAWN_CLONE3,/* clone3 with CLONE_VM and CLONE_VFORK on its own stack */
+    SPAWN_ZYGOTE,/* a small helper forked at startup forks for the shell */
+  };
+
+  /**
+   * @brief Where a job is in its life.
+   */
+  enum job_state
+  {
+    JOB_RUNNING,
+    JOB_STOPPED,
+    JOB_DONE,
+  };
+
+  /**
+   * @brief One process of a job.
+   */
+  struct job_proc
+  {
+    pid_t pid;
+    int pidfd;   /* exits are collected through this, -1 once done */
+    int status;  /* wait status once done */
+    bool done;
+  };
+
+  struct job_worker;
+
+  /**
+   * @brief A command started by the shell, in the foreground or with a
+   * trailing &. All of its processes share one process group so the job
+   * can be stopped, continued and given the terminal as a whole.
+   */
+  struct job
+  {
+    int id;                  /* the N in %N */
+    pid_t pgid;
+    enum job_state state;
+    char *cmdline;           /* the line as the user typed it */
+    struct job_proc *procs;
+    size_t nprocs;
+    size_t live;             /* processes that have not exited */
+    bool notified;           /* the state change was reported */
+    struct termios tmodes;   /* terminal modes to restore on fg */
+    unsigned timer;          /* loop timer of a timeout, 0 if none */
+    unsigned kill_after;     /* ms from SIGTERM to SIGKILL */
+    int timed_out;           /* the last signal a timeout sent or 0 */
+    struct job_worker *worker; /* thread running a builtin stage or NULL */
+    bool queued;             /* started by the queue builtin */
+    struct job *next;
+  };
+
+  /**
+   * @brief A set of CPUs laid out like cpu_set_t, so it can be kept
+   * without _GNU_SOURCE.
+   */
+  struct cpu_mask
+  {
+    unsigned long bits[CPU_MASK_BITS / (8 * sizeof(unsigned long))];
+  };
+
+  /**
+   * @brief A command the queue builtin holds until the machine has room
+   * for it. The words and cmdline belong to the entry.
+   */
+  struct queue_entry
+  {
+    char **argv;
+    char *cmdline;
+    struct queue_entry *next;
+  };
+
   struct shell
   {
     int shell_is_interactive;
@@ -22,8 +126,183 @@ extern "C"
     struct termios shell_tmodes;
     int shell_terminal;
     char *prompt;
+    int argsplit;   /* 0 off, else how many split batches may run at once */
+    enum spawn_backend spawn;
+    struct job *jobs; /* the job table in order of job id */
+    pid_t job_pgid;   /* group every new job joins, 0 gives each its own */
+    sigset_t child_mask; /* signal mask children exec with */
+    int pipe_size;  /* capacity of pipeline pipes in bytes, 0 for the default */
+    int status;     /* exit status of the last command */
+    struct queue_entry *queue; /* commands waiting to start, oldest first */
+    unsigned queue_timer;      /* loop timer of the next load check, 0 if none */
+    int queue_jobs;            /* queued jobs that may run at once */
+    double queue_load;         /* start nothing at this load average, 0 off */
+    double queue_psi;          /* or at this CPU pressure in percent, 0 off */
+    struct cpu_mask cpus;      /* CPUs children run on when cpus_count > 0 */
+    int cpus_count;            /* CPUs in cpus, 0 leaves children the shell's */
+    bool cpus_rr;              /* each child gets the next CPU of cpus alone */
+    int cpus_next;             /* the next CPU of cpus to hand out */
+    struct parse_ahead *ahead; /* thread parsing the script, NULL if none */
   };
 
+  /**
+   * @brief Output of a builtin that prints a lot. Text collects in buf and
+   * goes to fd in blocks of WRITER_BUF_SIZE with plain write(2), so it does
+   * not depend on where stdio's stdout points or how it is buffered.
+   */
+  struct writer
+  {
+    int fd;
+    size_t len;  /* bytes waiting in buf */
+    bool failed; /* a write failed, the rest is dropped */
+    char buf[WRITER_BUF_SIZE];
+  };
+
+  /**
+   * @brief Lines of a script or of standard input when it is not a
+   * terminal, read in blocks of READER_BUF_SIZE without readline. Lines
+   * are split in place inside buf, a line longer than the buffer grows it.
+   */
+  struct line_reader
+  {
+    int fd;
+    char *buf;
+    size_t cap;  /* bytes buf can hold, one more is kept for a terminator */
+    size_t pos;  /* start of the next line */
+    size_t len;  /* bytes read into buf */
+    bool eof;    /* fd has nothing more */
+  };
+
+  /**
+   * @brief A line of a script parsed ahead of the shell. The end of the
+   * script has neither cmd nor err set.
+   */
+  struct parsed_line
+  {
+    char **cmd;       /* the parsed line, NULL on a syntax error */
+    char *line;       /* the line as written, lives with cmd */
+    const char *err;  /* the syntax error to report in place of running it */
+  };
+
+  struct parse_ahead;
+
+  /**
+   * @brief When a command of a list runs, decided by the operator in front
+   * of it and the status of the last command that ran.
+   */
+  enum list_cond
+  {
+    LIST_ALWAYS,  /* the first command or one after ; or & */
+    LIST_IF_OK,   /* after &&, runs if the status is 0 */
+    LIST_IF_FAIL, /* after ||, runs if it is not */
+  };
+
+  /**
+   * @brief One command of a list.
+   */
+  struct list_insn
+  {
+    enum list_cond cond;
+    bool background; /* ended with & */
+    char **argv;     /* a pipeline with its redirections, NULL terminated */
+  };
+
+  /**
+   * @brief A line of commands joined with ;, &, && and || compiled into a
+   * flat array that is walked from front to back. The array and the
+   * vectors of every command are in one arena, the words are shared with
+   * the parsed line the list was compiled from.
+   */
+  struct cmd_list
+  {
+    char **cmd;  /* the parsed line, the list holds a reference to it */
+    size_t n;
+    struct list_insn insn[];
+  };
+
+  /**
+   * @brief Runs one command of a list, see list_run.
+   */
+  typedef int (*list_cmd_fn)(struct shell *sh, char **argv, bool background, void *arg);
+
+  /**
+   * @brief Callbacks run by the event loop.
+   */
+  typedef void (*loop_fn)(struct shell *sh, void *arg);
+  typedef void (*loop_fd_fn)(struct shell *sh, int fd, void *arg);
+  typedef void (*loop_signal_fn)(struct shell *sh, int signo);
+
+  /**
+   * @brief Where a new child goes: the process group to join, whether the
+   * group is given the terminal and what its standard descriptors are.
+   */
+  struct spawn_attr
+  {
+    pid_t pgid;      /* 0 starts a new group led by the child */
+    bool foreground; /* hand the terminal to the group */
+    const int *stdio;/* descriptors for the child's 0, 1 and 2, NULL for the shell's */
+  };
+
+  /**
+   * @brief A bump allocator backed by a single malloc'd block. Allocations
+   * are carved off the front of the block and are never freed individually,
+   * the whole arena is released at once with arena_free. The arena is
+   * reference counted so that several owners can share what was built in
+   * it, the block is freed when the last owner lets go.
+   */
+  struct arena
+  {
+    size_t refs;
+    size_t cap;
+    size_t used;
+    _Alignas(max_align_t) unsigned char data[];
+  };
+
+  /**
+   * @brief Create an arena that can hold cap bytes of allocations. The
+   * caller holds the only reference. This function calls malloc internally
+   * and the arena must be released with arena_free.
+   *
+   * @param cap The number of bytes the arena can hand out
+   * @return struct arena* The new arena, exits on allocation failure
+   */
+  struct arena *arena_new(size_t cap);
+
+  /**
+   * @brief Carve size bytes aligned to align off the arena.
+   *
+   * @param a The arena
+   * @param size The number of bytes to allocate
+   * @param align The required alignment, must be a power of two
+   * @return void* The memory, or NULL if the arena does not have room
+   */
+  void *arena_alloc(struct arena *a, size_t size, size_t align);
+
+  /**
+   * @brief Recover the arena from the pointer returned by its first
+   * arena_alloc call. The first allocation always starts at the front of the
+   * block so this is a constant offset.
+   *
+   * @param first The first allocation made from the arena
+   * @return struct arena* The arena that owns first
+   */
+  struct arena *arena_head(void *first);
+
+  /**
+   * @brief Take another reference to the arena.
+   *
+   * @param a The arena
+   */
+  void arena_retain(struct arena *a);
+
+  /**
+   * @brief Drop a reference to the arena. When the last reference is
+   * dropped the arena and every allocation made from it are released.
+   *
+   * @param a The arena to free
+   */
+  void arena_free(struct arena *a);
+
 
   /**
    * @brief Set the shell prompt. This function will attempt to load a prompt
@@ -49,23 +328,668 @@ extern "C"
 
   /**
    * @brief Convert line read from the user into to format that will work with
-   * execvp. We limit the number of arguments to ARG_MAX loaded from sysconf.
-   * This function allocates memory that must be reclaimed with the cmd_free
-   * function.
+   * execvp. Quoting follows POSIX: single quotes, double quotes, backslash
+   * escapes and adjacent quoted fragments that join into one token
+   * (a"b c"d is the single token ab cd). Unquoted operators such as & are
+   * tokens of their own, see cmd_op. The argument vector and the bytes of
+   * every token are placed in a single arena sized from the length of the
+   * line, so parsing costs one allocation no matter how many tokens the line
+   * holds. Recently parsed lines are served from the parse cache (see
+   * pcache_lookup) so the returned vector may be shared and must never be
+   * modified. This function allocates memory that must be reclaimed with the
+   * cmd_free function.
    *
    * @param line The line to process
    *
-   * @return The line read in a format suitable for exec
+   * @return The line read in a format suitable for exec. On a syntax error
+   * such as an unmatched quote a message is printed to stderr, NULL is
+   * returned and errno is set to EINVAL.
    */
   char **cmd_parse(char const *line);
 
   /**
-   * @brief Free the line that was constructed with parse_cmd
+   * @brief Same as cmd_parse but the tokens are NUL terminated in place
+   * inside line and the returned vector points into it, so no token bytes
+   * are copied. Only the vector is allocated and it must be reclaimed with
+   * cmd_free. The contents of line are destroyed and line must outlive the
+   * returned vector. This variant never goes through the parse cache.
+   *
+   * @param line The line to process, modified in place
+   *
+   * @return The line read in a format suitable for exec or NULL on a syntax
+   * error, see cmd_parse
+   */
+  char **cmd_parse_inplace(char *line);
+
+  /**
+   * @brief Same as cmd_parse but safe to call from a thread other than
+   * the one that runs the commands: the parse cache is not used, a syntax
+   * error is handed back instead of printed and nothing is printed for the
+   * debug flag. A copy of line is kept
+   * in the same allocation as the vector, it goes away with cmd_free.
+   *
+   * @param line The line to process, not modified
+   * @param copy Set to the copy of line
+   * @param err Set to the syntax error message or NULL
+   *
+   * @return The line read in a format suitable for exec or NULL on a syntax
+   * error
+   */
+  char **cmd_parse_detached(char const *line, char **copy, const char **err);
+
+  /**
+   * @brief The operators the lexer recognises outside of quotes. A 2 that
+   * starts a token right before > is part of the operator, as in 2> and
+   * 2>&1, anywhere else it is part of a word.
+   */
+  enum cmd_op
+  {
+    OP_NONE, /* a word */
+    OP_BG,   /* & */
+    OP_PIPE, /* | */
+    OP_IN,      /* < file, the redirections run from here to OP_ERR_OUT */
+    OP_OUT,     /* > file */
+    OP_APPEND,  /* >> file */
+    OP_ERR,     /* 2> file */
+    OP_ERR_OUT, /* 2>&1, the only redirection without a file */
+    OP_SEQ,  /* ; */
+    OP_AND,  /* && */
+    OP_OR,   /* || */
+    OP_COUNT
+  };
+
+  /**
+   * @brief Tell an operator token in a vector from cmd_parse apart from a
+   * word. Operator tokens point at shared operator text so a quoted or
+   * escaped "&" is a word even though it reads the same.
+   *
+   * @param token A token from cmd_parse or cmd_parse_inplace
+   * @return enum cmd_op The operator or OP_NONE for a word
+   */
+  enum cmd_op cmd_op(const char *token);
+
+  /**
+   * @brief Free the line that was constructed with parse_cmd. The tokens
+   * live in the same arena as the vector so this drops a single reference,
+   * a vector still held by the parse cache stays alive.
    *
    * @param line the line to free
    */
   void cmd_free(char ** line);
 
+  /**
+   * @brief Compile a line from cmd_parse into a command list. The line is
+   * split at ;, &, && and || once, every command gets a NULL terminated
+   * vector of its words, pipes and redirections, so running the list never
+   * looks at the tokens again. The syntax of every operator is checked
+   * here: a separator needs a command in front of it, the line may not end
+   * in |, && or || and a redirection needs a file name. Only a command
+   * that is not part of an && or || list may end with &. This function
+   * allocates memory that must be reclaimed with list_free.
+   *
+   * @param cmd The parsed line, it is not modified and may be freed once
+   * the list is compiled
+   * @return struct cmd_list* The list or NULL after reporting a syntax
+   * error
+   */
+  struct cmd_list *list_compile(char **cmd);
+
+  /**
+   * @brief Run a command list. Each command is handed to run unless the
+   * status says to skip it: && runs the next command when the status is
+   * 0, || when it is not, and a skipped command leaves the status as it
+   * was, so and-or lists group from the left like in sh.
+   *
+   * @param sh The shell
+   * @param list The list
+   * @param run Runs one command and returns its exit status
+   * @param arg Passed to run
+   * @return int The status of the last command that ran
+   */
+  int list_run(struct shell *sh, const struct cmd_list *list, list_cmd_fn run, void *arg);
+
+  /**
+   * @brief Check if a command of a list runs, see list_run.
+   *
+   * @param insn The command
+   * @param status The status of the last command that ran, 0 before the
+   * first
+   * @return True if the command runs
+   */
+  bool list_runs(const struct list_insn *insn, int status);
+
+  /**
+   * @brief Free a list from list_compile and drop its reference to the
+   * parsed line.
+   *
+   * @param list The list to free
+   */
+  void list_free(struct cmd_list *list);
+
+  /**
+   * @brief Look up a line in the parse cache, an LRU of recently parsed
+   * lines keyed by a hash of the line. A hit moves the entry to the front and
+   * returns its vector with a new reference that the caller drops with
+   * cmd_free. Cached vectors are shared and must never be modified.
+   *
+   * @param line The line to look up
+   * @param len The length of line
+   * @param hash The hash of line from pcache_hash
+   * @return The cached vector or NULL on a miss
+   */
+  char **pcache_lookup(const char *line, size_t len, unsigned long hash);
+
+  /**
+   * @brief Add a freshly parsed line to the parse cache, evicting the least
+   * recently used entry if the cache is full. The cache takes its own
+   * reference to cmd. Lines longer than PCACHE_MAX_LEN are not cached.
+   *
+   * @param key A copy of the line that lives in the same arena as cmd
+   * @param len The length of key
+   * @param hash The hash of key from pcache_hash
+   * @param cmd The vector cmd_parse built for key
+   */
+  void pcache_insert(const char *key, size_t len, unsigned long hash, char **cmd);
+
+  /**
+   * @brief Hash a line for the parse cache (64 bit FNV-1a).
+   *
+   * @param line The line to hash
+   * @param len The length of line
+   * @return unsigned long The hash
+   */
+  unsigned long pcache_hash(const char *line, size_t len);
+
+  /**
+   * @brief Read the parse cache counters.
+   *
+   * @param hits Set to the number of lookups that found the line
+   * @param misses Set to the number of lookups that did not
+   */
+  void pcache_stats(unsigned long *hits, unsigned long *misses);
+
+  /**
+   * @brief Drop every entry in the parse cache and reset the counters.
+   * Vectors still held by callers stay valid until they are freed.
+   */
+  void pcache_clear(void);
+
+  /**
+   * @brief The number of bytes execve needs to copy argv into the new
+   * process: every string with its terminator plus the pointer vector.
+   * Works for envp as well.
+   *
+   * @param argv The NULL terminated vector
+   * @return size_t The size in bytes
+   */
+  size_t exec_args_size(char **argv);
+
+  /**
+   * @brief The number of bytes argv and envp may take together, ARG_MAX
+   * from sysconf less ARGSPLIT_HEADROOM.
+   *
+   * @return size_t The limit in bytes
+   */
+  size_t exec_args_limit(void);
+
+  /**
+   * @brief The number of leading arguments every batch of a split command
+   * repeats: the command name and its leading options up to and including
+   * "--". Everything after them is taken to be a list of operands, the way
+   * xargs appends operands to a fixed command.
+   *
+   * @param argv The command
+   * @return size_t The length of the fixed prefix
+   */
+  size_t argsplit_fixed(char **argv);
+
+  /**
+   * @brief Split the arguments after the fixed prefix into the fewest
+   * batches whose argv fits in budget bytes when the prefix is repeated in
+   * front of each.
+   *
+   * @param argv The command
+   * @param fixed The length of the prefix, see argsplit_fixed
+   * @param budget The bytes each batch may use for its argv
+   * @param ends Set to the index one past the last argument of each batch,
+   * must have room for one entry per argument
+   * @return size_t The number of batches or 0 if a single argument does not
+   * fit on its own
+   */
+  size_t argsplit_plan(char **argv, size_t fixed, size_t budget, size_t *ends);
+
+  /**
+   * @brief Run a command whose argv and environment do not fit in ARG_MAX
+   * as several commands, the way xargs would. The fixed prefix (see
+   * argsplit_fixed) is repeated in front of each batch of trailing
+   * arguments. Up to sh->argsplit batches run at once, all in one process
+   * group that gets the terminal. If the batches are stopped the ones
+   * running go to the job table as a stopped job and the ones not started
+   * yet are dropped.
+   *
+   * @param sh The shell
+   * @param argv The command
+   * @param cmdline The line shown by jobs if the batches are stopped
+   * @return int The status of the first batch that failed (128 + the signal
+   * if it was killed or stopped), 0 if every batch succeeded and -1 if the
+   * command fits as is or can not be split
+   */
+  int argsplit_run(struct shell *sh, char **argv, const char *cmdline);
+
+  /**
+   * @brief Find where a command lives, like bash's command hash. The first
+   * lookup of a name walks PATH and remembers the result, later lookups are
+   * served from the table without touching the file system. A match is
+   * not remembered when a relative PATH entry comes before it or gives
+   * it, which entry wins depends on the working directory. Misses are
+   * remembered too when every PATH directory is absolute and watched with
+   * inotify, see hash_drain. The table is emptied whenever PATH differs
+   * from the value it was filled under.
+   *
+   * @param name The command name
+   * @return const char* The file execvp would run: name itself if it
+   * contains a slash, otherwise the full path owned by the table. NULL if
+   * name is not in any PATH directory.
+   */
+  const char *hash_lookup(const char *name);
+
+  /**
+   * @brief Remember path as the location of name (hash -p).
+   *
+   * @param name The command name
+   * @param path Where to run it from
+   */
+  void hash_add(const char *name, const char *path);
+
+  /**
+   * @brief Read the pending inotify events for the PATH directories and
+   * forget every lookup, hit or miss, of a name that was created, removed,
+   * renamed or had its mode changed. Lost events or a removed directory
+   * empty the whole table. Call this before looking up commands to run.
+   */
+  void hash_drain(void);
+
+  /**
+   * @brief The inotify descriptor watching the PATH directories, it becomes
+   * readable when hash_drain has work to do.
+   *
+   * @return int The descriptor or -1 if nothing is watched
+   */
+  int hash_watch_fd(void);
+
+  /**
+   * @brief Close the inotify descriptor but keep what the table holds, for
+   * a copy made with sh_fork. Misses are no longer remembered.
+   */
+  void hash_unwatch(void);
+
+  /**
+   * @brief Forget every remembered location and stop watching the PATH
+   * directories (hash -r).
+   */
+  void hash_clear(void);
+
+  /**
+   * @brief Print every remembered location with its hit count (hash).
+   *
+   * @param w Where the list goes
+   */
+  void hash_print(struct writer *w);
+
+  /**
+   * @brief Start argv in a new child with the shell's spawn backend. The
+   * command is located through the command hash, the child joins the
+   * process group in attr with the job control signals back at their
+   * defaults and, when attr asks for it and the shell is interactive, the
+   * group gets the terminal. The descriptors in attr->stdio become the
+   * child's standard input, output and error. They should be close on exec,
+   * the child only keeps the copies it makes and every other descriptor is
+   * closed before exec. Every backend does the same setup so the choice
+   * only changes how fast the child is created.
+   *
+   * @param sh The shell
+   * @param argv The command to run
+   * @param attr The process group and terminal for the child
+   * @return pid_t The pid of the child or -1 if the command was not found or
+   * could not be started, the reason has been printed to stderr
+   */
+  pid_t sh_spawn(struct shell *sh, char **argv, const struct spawn_attr *attr);
+
+  /**
+   * @brief Fork a copy of the shell that gets the same setup as a child of
+   * sh_spawn but runs shell code instead of a command, the way a builtin
+   * runs inside a pipeline. The child has no event loop and no zygote of
+   * its own, see loop_forget, and must leave with _exit. It is not
+   * interactive and the jobs it starts stay in its process group. It does
+   * not see the shell's jobs and keeps no descriptor above 2: the loop's,
+   * the inotify watch, pidfds and pipe ends of other stages are closed,
+   * a stray pipe write end would keep a reader from seeing end of file.
+   *
+   * @param sh The shell
+   * @param attr The process group, terminal and stdio for the child
+   * @return pid_t 0 in the child, the pid of the child in the shell or -1
+   * if it could not be created
+   */
+  pid_t sh_fork(struct shell *sh, const struct spawn_attr *attr);
+
+  /**
+   * @brief Replace the shell with argv, the way the last command of a
+   * one-shot run is started. The command is set up like a child of
+   * sh_spawn but stays in the shell's process group and keeps the
+   * terminal as it is. stdio is flushed and the zygote stopped first.
+   *
+   * @param sh The shell
+   * @param argv The command to run
+   * @param stdio Descriptors for 0, 1 and 2, NULL to keep the shell's
+   * @return int Only returns, with 127, if the command was not found; a
+   * failed exec exits the process with 127
+   */
+  int sh_exec(struct shell *sh, char **argv, const int *stdio);
+
+  /**
+   * @brief Run argv as a new job. argv may be a pipeline: stages separated
+   * by | tokens, each with at least one word. Each stage may redirect its
+   * stdin, stdout and stderr with <, >, >>, 2> and 2>&1, applied left to
+   * right after the pipes are connected. A foreground job gets the
+   * terminal and the shell waits until every stage exits or the job is
+   * stopped, a stopped job stays in the job table. A background job is
+   * added to the table and the shell returns at once.
+   *
+   * @param sh The shell
+   * @param argv The command to run
+   * @param cmdline The line shown by jobs
+   * @param background True to run the job in the background
+   * @return int The exit status of the last stage of a foreground job
+   * (128 + the signal if it was killed or stopped), 0 for a background job
+   * and -1 if no stage was started
+   */
+  int job_run(struct shell *sh, char **argv, const char *cmdline, bool background);
+
+  /**
+   * @brief Run a builtin that has redirections but no pipes in the shell
+   * process, so something like printhistory > file costs no fork. The
+   * files are opened as for job_run, the descriptors they replace are
+   * saved with F_DUPFD_CLOEXEC, the builtin runs and 0, 1 and 2 are put
+   * back. Redirections may come before the command name. A builtin that
+   * builtin_forks names runs as a foreground job instead.
+   *
+   * @param sh The shell
+   * @param argv The command with its redirections
+   * @return True if argv was a builtin and has been handled, a file that
+   * could not be opened has been reported and the builtin did not run, with
+   * sh->status set to 1
+   */
+  bool job_builtin(struct shell *sh, char **argv);
+
+  /**
+   * @brief Run argv in place of the shell instead of as a job: its
+   * redirections are opened as for job_run and the shell process execs the
+   * command with sh_exec, so no process is forked and none waited for.
+   * Nothing is done for a builtin or a pipeline.
+   *
+   * @param sh The shell
+   * @param argv The command with its redirections
+   * @return int Only returns if argv was not run in place: -1 for a builtin
+   * or a pipeline, which have to be run as usual, otherwise the status the
+   * shell should exit with, 1 if a file could not be opened, 0 if there
+   * was nothing but redirections and 127 if the command was not found
+   */
+  int job_exec(struct shell *sh, char **argv);
+
+  /**
+   * @brief Start argv as a new job without waiting for it, see job_run.
+   * Every stage of a pipeline is started, in one process group and joined
+   * by close on exec pipes, before the shell waits for any of them.
+   * Redirection files are opened by the shell close on exec and handed to
+   * the child as its stdio. A stage that can not be started counts as
+   * having exited with 127, or 1 if a file could not be opened. Every
+   * process of a job is tracked through a pidfd that the event loop
+   * watches, so its exit wakes the loop like any other descriptor and the
+   * shell never signals or waits on a bare pid that may have been reused.
+   * In a foreground job a first stage that is a builtin which only prints
+   * (see builtin_writes) is not forked: a worker thread runs it in the
+   * shell, writing to the pipe, and counts as a stage that exited with 0.
+   * The worker starts once every process has, uses the words of argv
+   * until the job is waited for and is cancelled if the job stops. No
+   * child is forked while it runs, queue_schedule waits for it.
+   *
+   * @param sh The shell
+   * @param argv The command to run
+   * @param cmdline The line shown by jobs
+   * @param background True to leave the terminal with the shell
+   * @return struct job* The job or NULL if no stage was started
+   */
+  struct job *job_start(struct shell *sh, char **argv, const char *cmdline, bool background);
+
+  /**
+   * @brief Limit how long a job may run. When ms have passed the job's
+   * process group gets SIGTERM, if it is still there kill_after ms later it
+   * gets SIGKILL. The timers run in the event loop, no watchdog process is
+   * involved. A job that timed out reports 124 as its status, or 137 if it
+   * had to be killed, like GNU timeout.
+   *
+   * @param sh The shell
+   * @param job The job
+   * @param ms Time until SIGTERM
+   * @param kill_after Time from SIGTERM to SIGKILL
+   * @return int 0 on success, -1 if there is no event loop to run timers
+   */
+  int job_timeout(struct shell *sh, struct job *job, unsigned ms, unsigned kill_after);
+
+  /**
+   * @brief Put a job in the foreground and wait for it, continuing it
+   * first if cont is set (fg).
+   *
+   * @param sh The shell
+   * @param job The job
+   * @param cont Send SIGCONT to the job's process group
+   * @return int The exit status as for job_run
+   */
+  int job_foreground(struct shell *sh, struct job *job, bool cont);
+
+  /**
+   * @brief Add a process group the shell started and waited for itself to
+   * the job table once it has stopped, the way job_foreground leaves a job
+   * that was stopped: the shell takes the terminal back and the job is
+   * reported.
+   *
+   * @param sh The shell
+   * @param pgid The process group
+   * @param pids The processes of the group that have not exited
+   * @param n The number of pids
+   * @param cmdline The line shown by jobs
+   * @return struct job* The new job
+   */
+  struct job *job_adopt(struct shell *sh, pid_t pgid, const pid_t *pids, size_t n, const char *cmdline);
+
+  /**
+   * @brief Continue a stopped job in the background (bg).
+   *
+   * @param sh The shell
+   * @param job The job
+   */
+  void job_background(struct shell *sh, struct job *job);
+
+  /**
+   * @brief Find a job from a job spec: %N or N for job N, nothing for the
+   * current job, the one added last.
+   *
+   * @param sh The shell
+   * @param spec The job spec or NULL
+   * @return struct job* The job or NULL if there is no such job
+   */
+  struct job *job_find(struct shell *sh, const char *spec);
+
+  /**
+   * @brief Collect the status of every child that exited, stopped or was
+   * continued without blocking and update the job table.
+   *
+   * @param sh The shell
+   * @return True if a job finished or stopped and that was not reported
+   * yet, see jobs_notify
+   */
+  bool jobs_update(struct shell *sh);
+
+  /**
+   * @brief Report background jobs that finished since the last call and
+   * drop them from the job table. Reports are only printed when the shell
+   * is interactive.
+   *
+   * @param sh The shell
+   */
+  void jobs_notify(struct shell *sh);
+
+  /**
+   * @brief Print the job table the way bash's jobs builtin does.
+   *
+   * @param sh The shell
+   */
+  void jobs_print(struct shell *sh);
+
+  /**
+   * @brief Forget every job. The processes are left running.
+   *
+   * @param sh The shell
+   */
+  void jobs_free(struct shell *sh);
+
+  /**
+   * @brief Forget the jobs in a copy made with sh_fork. They are the
+   * shell's: nothing is closed, waited for or signalled, the memory is
+   * only freed.
+   *
+   * @param sh The shell
+   */
+  void jobs_forget(struct shell *sh);
+
+  /**
+   * @brief Create the event loop: an epoll instance and a signalfd for
+   * signals. The signals are blocked so they are only ever seen through the
+   * loop, children get sh->child_mask instead. Handlers run from loop_once
+   * like any other callback so they may call anything.
+   *
+   * @param signals The signals to route through the loop
+   * @return int 0 on success, -1 with errno set
+   */
+  int loop_init(const sigset_t *signals);
+
+  /**
+   * @brief Close the loop, drop every watch and timer and unblock the
+   * signals again.
+   */
+  void loop_destroy(void);
+
+  /**
+   * @brief Forget the loop in a child made with fork. The watches and
+   * timers are dropped and the descriptors closed without touching the
+   * epoll instance, which the child shares with the shell. Signals are left
+   * as they are, the child has set its own mask.
+   */
+  void loop_forget(void);
+
+  /**
+   * @brief Check if loop_init has been called.
+   *
+   * @return True if there is a loop to wait in
+   */
+  bool loop_active(void);
+
+  /**
+   * @brief Call fn from loop_once whenever fd has input. Regular files,
+   * which epoll can not watch, are treated as always readable.
+   *
+   * @param fd The descriptor
+   * @param fn The callback
+   * @param arg Passed to fn
+   * @return int 0 on success, -1 with errno set
+   */
+  int loop_add_fd(int fd, loop_fd_fn fn, void *arg);
+
+  /**
+   * @brief Stop watching fd.
+   *
+   * @param fd The descriptor
+   */
+  void loop_remove_fd(int fd);
+
+  /**
+   * @brief Pause or resume the watch on fd. A paused descriptor does not
+   * wake the loop even if it has input, the shell pauses the terminal while
+   * a foreground job owns it.
+   *
+   * @param fd The descriptor
+   * @param enabled False to pause, true to resume
+   */
+  void loop_enable_fd(int fd, bool enabled);
+
+  /**
+   * @brief Call fn from loop_once when signo arrives. signo must be one of
+   * the signals given to loop_init.
+   *
+   * @param signo The signal
+   * @param fn The handler or NULL to drop the signal
+   */
+  void loop_on_signal(int signo, loop_signal_fn fn);
+
+  /**
+   * @brief Call fn once from loop_once after ms milliseconds.
+   *
+   * @param ms The delay
+   * @param fn The callback
+   * @param arg Passed to fn
+   * @return unsigned An id for loop_cancel
+   */
+  unsigned loop_timer(unsigned ms, loop_fn fn, void *arg);
+
+  /**
+   * @brief Cancel a timer. Does nothing if it already fired.
+   *
+   * @param id The id from loop_timer
+   */
+  void loop_cancel(unsigned id);
+
+  /**
+   * @brief Wait in epoll_wait until a watched descriptor has input, a
+   * signal arrives or a timer is due and run the callbacks, signals first.
+   *
+   * @param sh The shell passed to the callbacks
+   */
+  void loop_once(struct shell *sh);
+
+  /**
+   * @brief Fork the zygote, a helper process the zygote backend asks for
+   * children. It is forked while the shell is still small so every child
+   * it creates copies the helper's page tables and not the shell's. The
+   * children are created with CLONE_PARENT and belong to the shell. Does
+   * nothing if the zygote is already running.
+   *
+   * @return int 0 on success, -1 with errno set if the zygote could not be
+   * started
+   */
+  int zygote_start(void);
+
+  /**
+   * @brief Stop the zygote and reap it. Does nothing if it is not running.
+   */
+  void zygote_stop(void);
+
+  /**
+   * @brief Look up a spawn backend by name: fork, vfork, posix_spawn,
+   * clone3 or zygote.
+   *
+   * @param name The name of the backend
+   * @return int The backend or -1 if there is no backend called name
+   */
+  int spawn_backend_parse(const char *name);
+
+  /**
+   * @brief The name of a spawn backend, the inverse of spawn_backend_parse.
+   *
+   * @param backend The backend
+   * @return const char* Its name
+   */
+  const char *spawn_backend_name(enum spawn_backend backend);
+
   /**
    * @brief Trim the whitespace from the start and end of a string.
    * For example "   ls -a   " becomes "ls -a". This function modifies
@@ -77,13 +1001,377 @@ extern "C"
    */
   char *trim_white(char *line);
 
+  /**
+   * @brief Join argv with spaces, the way a command is shown by jobs. This
+   * function calls malloc internally and the caller must free the result.
+   *
+   * @param argv The command
+   * @return char* The joined line
+   */
+  char *join_args(char **argv);
+
+
+  /**
+   * @brief The implementations available to scan_delim.
+   */
+  enum scan_impl
+  {
+    SCAN_AUTO,   /* widest unit the CPU supports */
+    SCAN_SCALAR, /* one byte at a time */
+    SCAN_SSE2,   /* 16 bytes at a time */
+    SCAN_AVX2,   /* 32 bytes at a time */
+  };
+
+  /**
+   * @brief Select the implementation used by scan_delim. Without a call to
+   * this function the widest implementation the CPU supports is picked the
+   * first time scan_delim runs, on whichever thread gets there first. All
+   * implementations return the same result.
+   *
+   * @param impl The implementation to use
+   * @return True if the CPU supports impl and it is now in use
+   */
+  bool scan_use(enum scan_impl impl);
+
+  /**
+   * @brief Find the first byte in [p, end) that can change the state of the
+   * lexer: whitespace, a quote, a backslash or the start of an operator.
+   *
+   * @param p The first byte to look at
+   * @param end One past the last byte to look at
+   * @return const char* The delimiter or end if there is none
+   */
+  const char *scan_delim(const char *p, const char *end);
+
+  /**
+   * @brief Skip whitespace starting at p.
+   *
+   * @param p The first byte to look at
+   * @param end One past the last byte to look at
+   * @return const char* The first byte that is not whitespace or end
+   */
+  const char *scan_skip_space(const char *p, const char *end);
+
+  /**
+   * @brief Check if c is whitespace. Unlike isspace this does not depend on
+   * the current locale, it always matches the C locale set.
+   *
+   * @param c The byte to check
+   * @return True if c is whitespace
+   */
+  bool scan_is_space(char c);
+
+  /**
+   * @brief Copy everything read from in to every descriptor in fds until
+   * end of file, like tee(1). When in is a pipe the data never enters the
+   * shell: tee(2) duplicates it into a scratch pipe for each output and
+   * splice(2) hands it on. Outputs that can not be spliced to and input
+   * that is not a pipe fall back to a read and write loop. An output that
+   * fails is reported and dropped, the others carry on.
+   *
+   * @param in The descriptor to read
+   * @param fds The descriptors to write, they are not closed
+   * @param nouts The number of descriptors in fds
+   * @return int 0 on success, -1 if anything failed
+   */
+  int tee_fds(int in, const int *fds, size_t nouts);
+
+  /**
+   * @brief The tee builtin: tee [-a] FILE... copies standard input to
+   * standard output and every FILE with tee_fds. Files are truncated, or
+   * opened at their end with -a. An interactive shell runs it as a
+   * foreground job instead, see builtin_forks.
+   *
+   * @param argv The command
+   * @return int The exit status, 1 if a file could not be opened or written
+   */
+  int tee_run(char **argv);
+
+  /**
+   * @brief The parallel builtin: parallel [-j slots] [-k] [command [arg]...]
+   * reads lines from standard input and runs a job for each, at most
+   * slots at a time, the number of online CPUs by default. Without a
+   * command every line is a command line of its own, with one the line is
+   * put in place of every {} in the arguments or added at the end. Jobs
+   * read /dev/null. With -k the standard output of each job is held back
+   * until every job in front of it has been written, so the output comes
+   * in input order; standard error is not held. Run by the shell itself
+   * the jobs share a process group that holds the terminal. If they are
+   * stopped they go to the job table as one stopped job and the lines not
+   * started yet are not run.
+   *
+   * @param sh The shell
+   * @param argv The command
+   * @return int The number of jobs that failed, 101 for more than 100, 2
+   * on a usage error or 128 + SIGTSTP if the jobs were stopped
+   */
+  int parallel_run(struct shell *sh, char **argv);
+
+  /**
+   * @brief Create a reader for the lines of fd. This function calls malloc
+   * internally and the reader must be released with reader_free.
+   *
+   * @param fd The descriptor to read, it is not closed
+   * @return struct line_reader* The reader, exits on allocation failure
+   */
+  struct line_reader *reader_new(int fd);
+
+  /**
+   * @brief Read the next line. The reader reads ahead, so whatever the
+   * commands read from the same descriptor starts after the block the
+   * reader has taken, the way dash reads scripts from a pipe.
+   *
+   * @param r The reader
+   * @return char* The line without its newline, NUL terminated inside the
+   * reader's buffer. It may be modified and stays valid until the next
+   * call. NULL at end of file.
+   */
+  char *reader_next(struct line_reader *r);
+
+  /**
+   * @brief Free a reader from reader_new.
+   *
+   * @param r The reader
+   */
+  void reader_free(struct line_reader *r);
+
+  /**
+   * @brief Set up an empty queue, the limits come from MY_QUEUE_JOBS
+   * (default 1), MY_QUEUE_LOAD (default 0.8 per online CPU) and
+   * MY_QUEUE_PSI (default off, a percentage of /proc/pressure/cpu avg10).
+   *
+   * @param sh The shell
+   */
+  void queue_init(struct shell *sh);
+
+  /**
+   * @brief Start queued commands as background jobs, oldest first, while
+   * fewer than sh->queue_jobs of them run and the load average and CPU
+   * pressure are below their limits. Only one is started per call while a
+   * load limit is on, the averages need time to show it. Nothing starts
+   * while a job has a builtin on a worker thread, see job_start. The shell calls
+   * this between prompts and when a child exits, a timer of the event
+   * loop brings it back every QUEUE_RECHECK_MS while the load holds the
+   * queue back.
+   *
+   * @param sh The shell
+   */
+  void queue_schedule(struct shell *sh);
+
+  /**
+   * @brief The queue builtin: queue [-j jobs] [-l load] [-p pressure]
+   * [command [arg]...] changes the limits and adds the command to the
+   * queue. Without a command it lists what is waiting. Queued jobs run
+   * in the background and show up in jobs. A script or -e that ends with
+   * commands still queued waits for them to start, see queue_drain; an
+   * interactive shell that exits drops them.
+   *
+   * @param sh The shell
+   * @param argv The command
+   * @return int The exit status, 2 on a usage error
+   */
+  int queue_run(struct shell *sh, char **argv);
+
+  /**
+   * @brief Wait in the event loop until every queued command has started,
+   * for when a script or -e ends. The load limits hold them back for at
+   * most QUEUE_DRAIN_MS, after that only the job limit does. Does nothing
+   * without an event loop.
+   *
+   * @param sh The shell
+   */
+  void queue_drain(struct shell *sh);
+
+  /**
+   * @brief Drop the commands that are still waiting, with a warning that
+   * gives their count.
+   *
+   * @param sh The shell
+   */
+  void queue_free(struct shell *sh);
+
+  /**
+   * @brief Parse a CPU list the way taskset -c reads it: CPU numbers and
+   * ranges separated by commas, a range may have a stride, as in
+   * 0-3,8,10-20:2.
+   *
+   * @param list The list
+   * @param mask Set to the CPUs in list
+   * @return bool False if list is not a valid CPU list
+   */
+  bool cpu_list_parse(const char *list, struct cpu_mask *mask);
+
+  /**
+   * @brief Pin every child the shell starts from now on to the CPUs of
+   * mask that the shell itself may run on. With rr each child gets one of
+   * them alone, in turn.
+   *
+   * @param sh The shell
+   * @param mask The CPUs
+   * @param rr Hand out the CPUs round robin
+   * @return int 0 on success, -1 if the shell may run on none of them
+   */
+  int pin_set(struct shell *sh, const struct cpu_mask *mask, bool rr);
+
+  /**
+   * @brief Let children run wherever the shell may run again.
+   *
+   * @param sh The shell
+   */
+  void pin_clear(struct shell *sh);
+
+  /**
+   * @brief Take the CPUs of the next child, advancing the round robin.
+   * sh_spawn, sh_fork and sh_exec call this for every child.
+   *
+   * @param sh The shell
+   * @param mask Set to the CPUs
+   * @return bool False if children are not pinned
+   */
+  bool pin_next(struct shell *sh, struct cpu_mask *mask);
+
+  /**
+   * @brief The pin builtin. pin [-r] CPULIST pins every child from now on,
+   * with -r one CPU each in turn; pin CPULIST command [arg]... runs one
+   * foreground job on CPULIST; pin off stops pinning and pin alone shows
+   * the setting. The shell itself is never moved. Pinned children are
+   * never started with posix_spawn, which can not set the affinity, the
+   * posix_spawn backend vforks them instead.
+   *
+   * @param sh The shell
+   * @param argv The command
+   * @return int The exit status of the job, 1 if no CPU of the list can be
+   * used, 2 on a usage error
+   */
+  int pin_run(struct shell *sh, char **argv);
+
+  /**
+   * @brief Start a thread that reads the lines of fd with a line_reader
+   * and parses them while the shell runs the ones before, up to
+   * AHEAD_LINES in front. Blank lines and comments are dropped there.
+   * fd must be one no child shares: whatever the thread has read is gone
+   * for a command reading fd as well.
+   * This function calls malloc internally and the result must be released
+   * with ahead_free.
+   *
+   * @param fd The descriptor to read, it is not closed
+   * @return struct parse_ahead* The parse-ahead stage, NULL if the thread
+   * could not be started
+   */
+  struct parse_ahead *ahead_start(int fd);
+
+  /**
+   * @brief Take the next parsed line in script order, waiting for the
+   * thread if it has not got that far.
+   *
+   * @param pa The parse-ahead stage
+   * @param out Set to the line, the caller owns out->cmd
+   * @return bool False at the end of the script
+   */
+  bool ahead_next(struct parse_ahead *pa, struct parsed_line *out);
+
+  /**
+   * @brief Stop the thread, wait for it and free the stage with the lines
+   * not taken yet. The thread is cancelled only while it waits in read,
+   * so it holds no lock when it goes; sh_destroy calls this through
+   * sh->ahead when exit ends a script early.
+   *
+   * @param pa The parse-ahead stage
+   */
+  void ahead_free(struct parse_ahead *pa);
+
+  /**
+   * @brief Initialize w to collect output for fd.
+   *
+   * @param w The writer
+   * @param fd The descriptor the output goes to, it is not closed
+   */
+  void writer_init(struct writer *w, int fd);
+
+  /**
+   * @brief Append printf style text to w, writing the buffer out first
+   * when it is full. Text longer than the buffer is cut.
+   *
+   * @param w The writer
+   * @param fmt The format
+   */
+  void writer_printf(struct writer *w, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+  /**
+   * @brief Write everything w holds to its descriptor. After a write fails
+   * the writer drops all further output.
+   *
+   * @param w The writer
+   * @return int 0 on success, -1 if any write failed
+   */
+  int writer_flush(struct writer *w);
+
+  /**
+   * @brief Print the readline history to fd, one numbered line per entry
+   * after a line with the count, through a writer.
+   *
+   * @param fd The descriptor to write
+   * @return int 0 on success, -1 if the output could not be written
+   */
+  int print_history(int fd);
+
+  /**
+   * @brief Append the readline history to w the way print_history prints
+   * it.
+   *
+   * @param w Where the history goes
+   */
+  void history_write(struct writer *w);
+
+  /**
+   * @brief Check if argv is a builtin that does nothing but print and
+   * reads nothing the main thread changes while a job runs, which is only
+   * printhistory. It can feed a pipe from a worker thread. hash also prints
+   * through builtin_write, but the loop changes the table under it.
+   *
+   * @param argv The command
+   * @return True if argv can run on a worker thread
+   */
+  bool builtin_writes(char **argv);
+
+  /**
+   * @brief Run a builtin that only prints, printhistory or hash without
+   * arguments, with its output going to w. The caller flushes w.
+   *
+   * @param sh The shell
+   * @param argv The command
+   */
+  void builtin_write(struct shell *sh, char **argv, struct writer *w);
+
+  /**
+   * @brief Check if name is a builtin that can block for good on its
+   * input, which is only tee. An interactive shell does not run it in its
+   * own process, where the terminal's Ctrl-C and Ctrl-Z never reach it:
+   * do_builtin and job_builtin run it as a foreground job in a copy of
+   * the shell.
+   *
+   * @param sh The shell
+   * @param name The command name
+   * @return True if the builtin runs as a job
+   */
+  bool builtin_forks(struct shell *sh, const char *name);
+
+  /**
+   * @brief Check if name is a builtin. A builtin inside a pipeline runs in
+   * a copy of the shell made with sh_fork, unless job_start can give it a
+   * worker thread.
+   *
+   * @param name The command name
+   * @return True if do_builtin handles name
+   */
+  bool is_builtin(const char *name);
 
   /**
    * @brief Takes an argument list and checks if the first argument is a
    * built in command such as exit, cd, jobs, etc. If the command is a
    * built in command this function will handle the command and then return
    * true. If the first argument is NOT a built in command this function will
-   * return false.
+   * return false. The exit status of a builtin is left in sh->status.
    *
    * @param sh The shell
    * @param argv The command to check
@@ -119,6 +1407,22 @@ extern "C"
    */
   void parse_args(int argc, char **argv);
 
+  /**
+   * @brief The command string given with -e, the shell runs it and exits
+   * instead of reading commands.
+   *
+   * @return const char* The command string or NULL if there is none
+   */
+  const char *get_command(void);
+
+  /**
+   * @brief The script named after the options, the shell runs its lines
+   * and exits instead of reading commands from the terminal.
+   *
+   * @return const char* The path of the script or NULL if there is none
+   */
+  const char *get_script(void);
+
 
 
 #ifdef __cplusplus
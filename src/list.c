@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lab.h"
+
+/**
+ * Helper function
+ *
+ * @brief Check if op ends a command of a list or a stage of a pipeline.
+ */
+static bool list_separator(enum cmd_op op) {
+    return op == OP_BG || op == OP_PIPE || op == OP_SEQ || op == OP_AND || op == OP_OR;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Check where the operators are in cmd. Every separator needs a
+ * word in front of it, a file name or 2>&1 ends a command as well. A line
+ * may end with ; or & but not with |, && or ||, and every redirection but
+ * 2>&1 takes a file name.
+ *
+ * @param seps Set to the number of separators other than |
+ * @return True if cmd is well formed, a syntax error has been reported
+ * otherwise
+ */
+static bool list_check(char **cmd, size_t argc, size_t *seps) {
+    *seps = 0;
+    for (size_t i = 0; i < argc; i++) {
+        enum cmd_op op = cmd_op(cmd[i]);
+        if (op == OP_NONE) {
+            continue;
+        }
+        const char *next = i + 1 < argc ? cmd[i + 1] : "newline";
+        if (list_separator(op)) {
+            enum cmd_op prev = i > 0 ? cmd_op(cmd[i - 1]) : OP_SEQ;
+            if (prev != OP_NONE && prev != OP_ERR_OUT) {
+                fprintf(stderr, "syntax error near unexpected token `%s'\n", cmd[i]);
+                return false;
+            }
+            if (i == argc - 1 && op != OP_BG && op != OP_SEQ) {
+                fprintf(stderr, "syntax error near unexpected token `newline'\n");
+                return false;
+            }
+            *seps += op != OP_PIPE;
+        } else if (op != OP_ERR_OUT && (i == argc - 1 || cmd_op(next) != OP_NONE)) {
+            fprintf(stderr, "syntax error near unexpected token `%s'\n", next);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Compile a parsed line into a flat list of commands */
+struct cmd_list *list_compile(char **cmd) {
+    size_t argc = 0;
+    while (cmd[argc] != NULL) {
+        argc++;
+    }
+    size_t seps;
+    if (!list_check(cmd, argc, &seps)) {
+        return NULL;
+    }
+
+    // at most one command per separator plus the last one, the commands
+    // take every word and one terminator each, which is never more than
+    // the tokens they replace plus one
+    size_t head = sizeof(struct cmd_list) + (seps + 1) * sizeof(struct list_insn);
+    struct arena *a = arena_new(head + (argc + 1) * sizeof(char *));
+    struct cmd_list *list = arena_alloc(a, head, _Alignof(struct cmd_list));
+    char **slot = arena_alloc(a, (argc + 1) * sizeof(char *), _Alignof(char *));
+
+    enum list_cond cond = LIST_ALWAYS;
+    char **start = slot;
+    list->n = 0;
+    for (size_t i = 0; i <= argc; i++) {
+        enum cmd_op op = i < argc ? cmd_op(cmd[i]) : OP_SEQ;
+        if (op != OP_SEQ && op != OP_BG && op != OP_AND && op != OP_OR) {
+            *slot++ = cmd[i];
+            continue;
+        }
+        if (slot == start) {
+            // nothing after a trailing ; or &
+            break;
+        }
+        // a background && or || list would need a copy of the shell to
+        // run in, only a single pipeline may go to the background
+        if (op == OP_BG && cond != LIST_ALWAYS) {
+            fprintf(stderr, "syntax error: a && or || list can not run in the background\n");
+            arena_free(a);
+            return NULL;
+        }
+        *slot++ = NULL;
+        list->insn[list->n++] = (struct list_insn){.cond = cond, .background = op == OP_BG, .argv = start};
+        cond = op == OP_AND ? LIST_IF_OK : op == OP_OR ? LIST_IF_FAIL : LIST_ALWAYS;
+        start = slot;
+    }
+
+    // the words stay in the parsed line, the list keeps it alive
+    list->cmd = cmd;
+    arena_retain(arena_head(cmd));
+
+    return list;
+}
+
+/* Check if a command runs after the status of the last one */
+bool list_runs(const struct list_insn *insn, int status) {
+    return insn->cond == LIST_ALWAYS || (insn->cond == LIST_IF_OK) == (status == 0);
+}
+
+/* Walk a compiled list */
+int list_run(struct shell *sh, const struct cmd_list *list, list_cmd_fn run, void *arg) {
+    int status = 0;
+    for (size_t i = 0; i < list->n; i++) {
+        const struct list_insn *insn = &list->insn[i];
+        // a skipped command leaves the status alone, so in a || b && c the
+        // c runs when either a or b succeeded
+        if (list_runs(insn, status)) {
+            status = run(sh, insn->argv, insn->background, arg);
+        }
+    }
+
+    return status;
+}
+
+/* Free a compiled list */
+void list_free(struct cmd_list *list) {
+    if (list != NULL) {
+        cmd_free(list->cmd);
+        arena_free(arena_head(list));
+    }
+}
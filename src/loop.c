@@ -0,0 +1,328 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+
+#include "lab.h"
+
+// Events read from epoll in one go
+#define LOOP_EVENTS 16
+
+/**
+ * @brief A descriptor the loop watches for input.
+ */
+struct loop_watch {
+    int fd;
+    loop_fd_fn fn;
+    void *arg;
+    bool enabled;
+    bool always;            // a regular file, epoll can not watch it
+    struct loop_watch *next;
+};
+
+/**
+ * @brief A one shot timer, the list is kept in deadline order.
+ */
+struct loop_timer {
+    unsigned id;
+    long long deadline;     // CLOCK_MONOTONIC in ms
+    loop_fn fn;
+    void *arg;
+    struct loop_timer *next;
+};
+
+static int epoll_fd = -1;
+static int signal_fd = -1;
+
+// The signals routed through signal_fd and who handles them
+static sigset_t loop_signals;
+static loop_signal_fn signal_fns[NSIG];
+
+static struct loop_watch *watches;
+static struct loop_timer *timers;
+static unsigned next_timer_id = 1;
+
+/**
+ * Helper function
+ *
+ * @brief The monotonic clock in milliseconds.
+ */
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Find the watch for fd.
+ */
+static struct loop_watch *loop_find(int fd) {
+    struct loop_watch *w = watches;
+    while (w != NULL && w->fd != fd) {
+        w = w->next;
+    }
+
+    return w;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Read every queued signal and hand each to its handler. Several
+ * SIGCHLDs can collapse into one so handlers must not count them.
+ */
+static void loop_signals_read(struct shell *sh) {
+    struct signalfd_siginfo si[8];
+    ssize_t n;
+    while ((n = read(signal_fd, si, sizeof(si))) > 0) {
+        for (size_t i = 0; i < (size_t)n / sizeof(si[0]); i++) {
+            int signo = (int)si[i].ssi_signo;
+            if (signo > 0 && signo < NSIG && signal_fns[signo] != NULL) {
+                signal_fns[signo](sh, signo);
+            }
+        }
+    }
+}
+
+/* Set up epoll and the signalfd */
+int loop_init(const sigset_t *signals) {
+    if (epoll_fd >= 0) {
+        return 0;
+    }
+
+    // the signals are only ever seen through the descriptor
+    loop_signals = *signals;
+    if (sigprocmask(SIG_BLOCK, &loop_signals, NULL) < 0) {
+        return -1;
+    }
+    signal_fd = signalfd(-1, &loop_signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (signal_fd < 0 || epoll_fd < 0) {
+        loop_destroy();
+        return -1;
+    }
+
+    struct epoll_event ev = {.events = EPOLLIN, .data.fd = signal_fd};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &ev) < 0) {
+        loop_destroy();
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Tear down the loop */
+void loop_destroy(void) {
+    while (watches != NULL) {
+        loop_remove_fd(watches->fd);
+    }
+    while (timers != NULL) {
+        loop_cancel(timers->id);
+    }
+    memset(signal_fns, 0, sizeof(signal_fns));
+
+    if (signal_fd >= 0) {
+        close(signal_fd);
+        signal_fd = -1;
+        // anything still pending is delivered the normal way
+        sigprocmask(SIG_UNBLOCK, &loop_signals, NULL);
+    }
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
+}
+
+/* Drop the loop in a forked copy of the shell */
+void loop_forget(void) {
+    // the epoll instance is shared with the shell, deleting the watches
+    // from it would delete them for the shell as well
+    while (watches != NULL) {
+        struct loop_watch *w = watches;
+        watches = w->next;
+        free(w);
+    }
+    while (timers != NULL) {
+        struct loop_timer *t = timers;
+        timers = t->next;
+        free(t);
+    }
+    memset(signal_fns, 0, sizeof(signal_fns));
+
+    if (signal_fd >= 0) {
+        close(signal_fd);
+        signal_fd = -1;
+    }
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
+}
+
+/* Is there a loop to wait in */
+bool loop_active(void) {
+    return epoll_fd >= 0;
+}
+
+/* Call fn whenever fd has input */
+int loop_add_fd(int fd, loop_fd_fn fn, void *arg) {
+    struct loop_watch *w = calloc(1, sizeof(struct loop_watch));
+    if (w == NULL) {
+        perror("calloc failed");
+        exit(EXIT_FAILURE);
+    }
+    w->fd = fd;
+    w->fn = fn;
+    w->arg = arg;
+    w->enabled = true;
+
+    struct epoll_event ev = {.events = EPOLLIN, .data.fd = fd};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        if (errno != EPERM) {
+            free(w);
+            return -1;
+        }
+        // regular files are always readable, they are read every turn
+        w->always = true;
+    }
+
+    w->next = watches;
+    watches = w;
+
+    return 0;
+}
+
+/* Stop watching fd */
+void loop_remove_fd(int fd) {
+    struct loop_watch **link = &watches;
+    while (*link != NULL && (*link)->fd != fd) {
+        link = &(*link)->next;
+    }
+    struct loop_watch *w = *link;
+    if (w == NULL) {
+        return;
+    }
+
+    *link = w->next;
+    if (!w->always) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    }
+    free(w);
+}
+
+/* Pause or resume a watch without forgetting it */
+void loop_enable_fd(int fd, bool enabled) {
+    struct loop_watch *w = loop_find(fd);
+    if (w == NULL || w->enabled == enabled) {
+        return;
+    }
+
+    w->enabled = enabled;
+    if (!w->always) {
+        // input that is not read must not wake every epoll_wait
+        struct epoll_event ev = {.events = enabled ? EPOLLIN : 0, .data.fd = fd};
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+    }
+}
+
+/* Route a blocked signal to fn */
+void loop_on_signal(int signo, loop_signal_fn fn) {
+    signal_fns[signo] = fn;
+}
+
+/* Call fn once after ms milliseconds */
+unsigned loop_timer(unsigned ms, loop_fn fn, void *arg) {
+    struct loop_timer *t = calloc(1, sizeof(struct loop_timer));
+    if (t == NULL) {
+        perror("calloc failed");
+        exit(EXIT_FAILURE);
+    }
+    t->id = next_timer_id++;
+    t->deadline = now_ms() + ms;
+    t->fn = fn;
+    t->arg = arg;
+
+    // timers with the same deadline fire in the order they were added
+    struct loop_timer **link = &timers;
+    while (*link != NULL && (*link)->deadline <= t->deadline) {
+        link = &(*link)->next;
+    }
+    t->next = *link;
+    *link = t;
+
+    return t->id;
+}
+
+/* Cancel a timer that has not fired */
+void loop_cancel(unsigned id) {
+    struct loop_timer **link = &timers;
+    while (*link != NULL && (*link)->id != id) {
+        link = &(*link)->next;
+    }
+    if (*link != NULL) {
+        struct loop_timer *t = *link;
+        *link = t->next;
+        free(t);
+    }
+}
+
+/* Wait for events and dispatch them */
+void loop_once(struct shell *sh) {
+    // the nearest timer bounds the wait, a readable regular file or a due
+    // timer means no wait at all
+    int timeout = -1;
+    if (timers != NULL) {
+        long long left = timers->deadline - now_ms();
+        timeout = left < 0 ? 0 : left > 60000 ? 60000 : (int)left;
+    }
+    for (struct loop_watch *w = watches; w != NULL; w = w->next) {
+        if (w->always && w->enabled) {
+            timeout = 0;
+        }
+    }
+
+    struct epoll_event events[LOOP_EVENTS];
+    int n = epoll_wait(epoll_fd, events, LOOP_EVENTS, timeout);
+    if (n < 0 && errno != EINTR) {
+        perror("epoll_wait failed");
+        return;
+    }
+
+    // signals first so a child that exited is reaped before its output is
+    // acted on
+    for (int i = 0; i < n; i++) {
+        if (events[i].data.fd == signal_fd) {
+            loop_signals_read(sh);
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        // a handler may remove watches, look every descriptor up again
+        struct loop_watch *w = loop_find(events[i].data.fd);
+        if (w != NULL && w->enabled) {
+            w->fn(sh, w->fd, w->arg);
+        }
+    }
+    for (struct loop_watch *w = watches; w != NULL; w = w->next) {
+        if (w->always && w->enabled) {
+            w->fn(sh, w->fd, w->arg);
+            break;
+        }
+    }
+
+    // a timer is unlinked before it runs so it can add new timers
+    long long now = now_ms();
+    while (timers != NULL && timers->deadline <= now) {
+        struct loop_timer *t = timers;
+        timers = t->next;
+        t->fn(sh, t->arg);
+        free(t);
+    }
+}
@@ -0,0 +1,691 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/pidfd.h>
+#include <sys/wait.h>
+
+#include "lab.h"
+
+// Bytes read from a job's output at a time
+#define PARALLEL_BUF_SIZE (64 * 1024)
+
+// How often jobs without a pidfd are checked on, in ms
+#define PARALLEL_POLL_MS 50
+
+/**
+ * @brief A job that was started and has not been reported yet. With -k
+ * its output comes in through out and is collected in buf until it is the
+ * job's turn, the job whose turn it is writes straight through.
+ */
+struct par_job {
+    size_t seq;      /* position of the line in the input */
+    pid_t pid;       /* -1 once it has been waited for */
+    int pidfd;       /* -1 if the kernel has no pidfds */
+    int out;         /* read end of its output, -1 at end of file */
+    int status;
+    char *buf;
+    size_t len;
+    size_t cap;
+};
+
+/**
+ * @brief The state of one run of the parallel builtin.
+ */
+struct parallel {
+    struct shell *sh;
+    size_t slots;     /* jobs that may run at once */
+    bool keep;        /* -k, output in input order */
+    char **tmpl;      /* the command to give each line to, NULL if lines are commands */
+    bool in_shell;    /* run by the shell itself, not a copy in a pipeline */
+    pid_t pgid;       /* group of the running jobs */
+    size_t live;      /* jobs that have not been waited for */
+    int null_fd;      /* what the jobs read, the input is parallel's */
+    struct par_job *running;
+    size_t nrunning;
+    struct par_job *done;   /* finished, waiting for their turn with -k */
+    size_t ndone;
+    size_t done_cap;
+    size_t next_seq;
+    size_t emit_seq;  /* the job whose output goes out next */
+    size_t failed;
+    bool stop;        /* interrupted, start nothing more */
+    bool stopped;     /* the jobs were stopped and handed to the job table */
+    char *cmdline;    /* the builtin as jobs shows it */
+};
+
+/**
+ * Helper function
+ *
+ * @brief Write all of buf, false on an error.
+ */
+static bool par_write(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+
+    return true;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Give line to the command template: every {} in a word is
+ * replaced by the line, without a {} the line is added as the last
+ * argument. The line is one word whatever it holds.
+ *
+ * @return char** The command, free it and every word with par_argv_free
+ */
+static char **par_argv(char **tmpl, const char *line) {
+    size_t argc = 0;
+    bool placed = false;
+    while (tmpl[argc] != NULL) {
+        placed |= strstr(tmpl[argc], "{}") != NULL;
+        argc++;
+    }
+    char **argv = malloc((argc + 2) * sizeof(char *));
+    if (argv == NULL) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t line_len = strlen(line);
+    for (size_t i = 0; i < argc; i++) {
+        size_t holes = 0;
+        for (const char *p = strstr(tmpl[i], "{}"); p != NULL; p = strstr(p + 2, "{}")) {
+            holes++;
+        }
+        argv[i] = malloc(strlen(tmpl[i]) + holes * line_len + 1);
+        if (argv[i] == NULL) {
+            perror("malloc failed");
+            exit(EXIT_FAILURE);
+        }
+        char *out = argv[i];
+        const char *p = tmpl[i];
+        for (const char *hole = strstr(p, "{}"); hole != NULL; hole = strstr(p, "{}")) {
+            out = mempcpy(out, p, (size_t)(hole - p));
+            out = mempcpy(out, line, line_len);
+            p = hole + 2;
+        }
+        strcpy(out, p);
+    }
+    argv[argc] = placed ? NULL : strdup(line);
+    if (!placed && argv[argc] == NULL) {
+        perror("strdup failed");
+        exit(EXIT_FAILURE);
+    }
+    argv[argc + !placed] = NULL;
+
+    return argv;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Free a command from par_argv.
+ */
+static void par_argv_free(char **argv) {
+    for (char **p = argv; *p != NULL; p++) {
+        free(*p);
+    }
+    free(argv);
+}
+
+/**
+ * Helper function
+ *
+ * @brief A job has finished. With -k it waits for its turn, otherwise
+ * there is nothing left of it.
+ */
+static void par_done(struct parallel *p, const struct par_job *job) {
+    p->failed += job->status != 0;
+    if (!p->keep) {
+        return;
+    }
+    if (p->ndone == p->done_cap) {
+        p->done_cap = p->done_cap == 0 ? 16 : 2 * p->done_cap;
+        struct par_job *done = realloc(p->done, p->done_cap * sizeof(struct par_job));
+        if (done == NULL) {
+            perror("realloc failed");
+            exit(EXIT_FAILURE);
+        }
+        p->done = done;
+    }
+    p->done[p->ndone++] = *job;
+}
+
+/**
+ * @brief A line run by a copy of the shell, see par_child.
+ */
+struct par_line {
+    const char *line;
+    char **last;      /* the last command of the list */
+};
+
+/**
+ * Helper function
+ *
+ * @brief Run one command of a line in the copy, for list_run. The last
+ * command replaces the copy when it can.
+ */
+static int par_command(struct shell *sh, char **argv, bool background, void *arg) {
+    const struct par_line *pl = arg;
+    if (argv == pl->last && !background) {
+        int status = job_exec(sh, argv);
+        if (status >= 0) {
+            return status;
+        }
+    }
+
+    bool pipeline = false;
+    for (char **p = argv; *p != NULL; p++) {
+        pipeline |= cmd_op(*p) == OP_PIPE;
+    }
+    if (!pipeline && job_builtin(sh, argv)) {
+        return sh->status;
+    }
+    int status = job_run(sh, argv, pl->line, background);
+
+    return status < 0 ? 127 : status;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Run a line in a copy of the shell, the way the shell runs a line
+ * of a script. The jobs it starts stay in the copy's group, the parallel
+ * group, see sh_fork.
+ *
+ * @return int The exit status of the line
+ */
+static int par_child(struct shell *sh, char **cmd, const char *line) {
+    struct cmd_list *list = list_compile(cmd);
+    if (list == NULL) {
+        return 2;
+    }
+
+    struct par_line pl = {line, list->n > 0 ? list->insn[list->n - 1].argv : NULL};
+    int status = list_run(sh, list, par_command, &pl);
+    list_free(list);
+
+    return status;
+}
+
+static void par_event(struct shell *sh, int fd, void *arg);
+
+/**
+ * Helper function
+ *
+ * @brief Start the job for line. A line that does not parse or a command
+ * that is not found counts as a failed job.
+ */
+static void par_start(struct parallel *p, const char *line) {
+    size_t seq = p->next_seq++;
+    char **cmd = p->tmpl != NULL ? par_argv(p->tmpl, line) : cmd_parse(line);
+    if (cmd == NULL) {
+        // nothing to wait for, the line still takes its turn
+        par_done(p, &(struct par_job){.seq = seq, .pid = -1, .pidfd = -1, .out = -1, .status = 2});
+        return;
+    }
+
+    // the jobs join one group that holds the terminal while any of them
+    // is alive, once they are all gone the next one starts a new group;
+    // a copy of the shell in a pipeline keeps them in its own group
+    int fds[2] = {-1, -1};
+    if (p->keep && pipe2(fds, O_CLOEXEC) < 0) {
+        perror("pipe failed");
+        fds[1] = STDOUT_FILENO;
+    }
+    // the loop may call back for a descriptor number that was reused by
+    // the time it gets to it, a read must never block
+    if (fds[0] >= 0) {
+        fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    }
+    int stdio[3] = {p->null_fd, fds[1] >= 0 ? fds[1] : STDOUT_FILENO, STDERR_FILENO};
+    struct spawn_attr attr = {
+        .pgid = !p->in_shell ? getpgrp() : p->live > 0 ? p->pgid : 0,
+        .foreground = p->in_shell,
+        .stdio = stdio,
+    };
+
+    // a plain command goes straight to exec, anything with operators or a
+    // builtin needs the shell
+    bool plain = !is_builtin(cmd[0]);
+    for (char **w = cmd; plain && p->tmpl == NULL && *w != NULL; w++) {
+        plain = cmd_op(*w) == OP_NONE;
+    }
+    pid_t pid;
+    if (plain) {
+        pid = sh_spawn(p->sh, cmd, &attr);
+    } else {
+        pid = sh_fork(p->sh, &attr);
+        if (pid == 0) {
+            int status;
+            if (p->tmpl != NULL) {
+                do_builtin(p->sh, cmd);
+                status = p->sh->status;
+            } else {
+                status = par_child(p->sh, cmd, line);
+            }
+            fflush(NULL);
+            _exit(status);
+        }
+    }
+    if (p->tmpl != NULL) {
+        par_argv_free(cmd);
+    } else {
+        cmd_free(cmd);
+    }
+    if (fds[1] > STDERR_FILENO) {
+        close(fds[1]);
+    }
+
+    if (pid < 0) {
+        if (fds[0] >= 0) {
+            close(fds[0]);
+        }
+        par_done(p, &(struct par_job){.seq = seq, .pid = -1, .pidfd = -1, .out = -1, .status = 127});
+        return;
+    }
+    if (p->live++ == 0) {
+        p->pgid = !p->in_shell ? getpgrp() : pid;
+    }
+    struct par_job *job = &p->running[p->nrunning++];
+    *job = (struct par_job){.seq = seq, .pid = pid, .pidfd = pidfd_open(pid, 0), .out = fds[0]};
+    if (loop_active()) {
+        if (job->pidfd >= 0) {
+            loop_add_fd(job->pidfd, par_event, p);
+        }
+        if (job->out >= 0) {
+            loop_add_fd(job->out, par_event, p);
+        }
+    }
+}
+
+/**
+ * Helper function
+ *
+ * @brief Collect the exit status of a job, false if it has not exited.
+ */
+static bool par_reap(struct parallel *p, struct par_job *job) {
+    int status;
+    pid_t pid = waitpid(job->pid, &status, WNOHANG);
+    if (pid == 0 || (pid < 0 && errno == EINTR)) {
+        return false;
+    }
+    if (pid < 0) {
+        // somebody else collected it
+        status = 0;
+    }
+    if (WIFSIGNALED(status)) {
+        job->status = 128 + WTERMSIG(status);
+        // Ctrl-C went to every running job, like GNU parallel start no more
+        p->stop |= WTERMSIG(status) == SIGINT;
+    } else {
+        job->status = WEXITSTATUS(status);
+    }
+    if (job->pidfd >= 0) {
+        loop_remove_fd(job->pidfd);
+        close(job->pidfd);
+        job->pidfd = -1;
+    }
+    job->pid = -1;
+    p->live--;
+
+    return true;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Read what a job wrote. The job whose turn it is writes straight
+ * through, the others are kept until their turn comes.
+ */
+static void par_read(struct parallel *p, struct par_job *job) {
+    char chunk[PARALLEL_BUF_SIZE];
+    ssize_t n = read(job->out, chunk, sizeof(chunk));
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+        return;
+    }
+    if (n <= 0) {
+        loop_remove_fd(job->out);
+        close(job->out);
+        job->out = -1;
+        return;
+    }
+
+    if (job->seq == p->emit_seq) {
+        par_write(STDOUT_FILENO, chunk, (size_t)n);
+        return;
+    }
+    if (job->len + (size_t)n > job->cap) {
+        size_t cap = job->cap == 0 ? PARALLEL_BUF_SIZE : job->cap;
+        while (cap < job->len + (size_t)n) {
+            cap *= 2;
+        }
+        char *buf = realloc(job->buf, cap);
+        if (buf == NULL) {
+            perror("realloc failed");
+            exit(EXIT_FAILURE);
+        }
+        job->buf = buf;
+        job->cap = cap;
+    }
+    memcpy(job->buf + job->len, chunk, (size_t)n);
+    job->len += (size_t)n;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Write out every job whose turn has come: finished ones in full,
+ * then whatever the next running one has so far, it writes straight
+ * through from then on.
+ */
+static void par_flush(struct parallel *p) {
+    bool moved = true;
+    while (moved) {
+        moved = false;
+        for (size_t i = 0; i < p->ndone; i++) {
+            struct par_job *job = &p->done[i];
+            if (job->seq == p->emit_seq) {
+                par_write(STDOUT_FILENO, job->buf, job->len);
+                free(job->buf);
+                p->done[i] = p->done[--p->ndone];
+                p->emit_seq++;
+                moved = true;
+                break;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < p->nrunning; i++) {
+        struct par_job *job = &p->running[i];
+        if (job->seq == p->emit_seq && job->len > 0) {
+            par_write(STDOUT_FILENO, job->buf, job->len);
+            job->len = 0;
+        }
+    }
+}
+
+/**
+ * Helper function
+ *
+ * @brief The loop saw a pidfd or an output of a running job.
+ */
+static void par_event(struct shell *sh, int fd, void *arg) {
+    UNUSED(sh);
+    struct parallel *p = arg;
+    for (size_t i = 0; i < p->nrunning; i++) {
+        struct par_job *job = &p->running[i];
+        if (job->pid >= 0 && job->pidfd == fd) {
+            par_reap(p, job);
+            return;
+        }
+        if (job->out == fd) {
+            par_read(p, job);
+            return;
+        }
+    }
+}
+
+/**
+ * Helper function
+ *
+ * @brief Wait for the running jobs without an event loop, or with jobs
+ * the kernel gave no pidfd.
+ */
+static void par_poll(struct parallel *p) {
+    struct pollfd *pfds = malloc(2 * p->nrunning * sizeof(struct pollfd));
+    if (pfds == NULL) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t n = 0;
+    int timeout = -1;
+    for (size_t i = 0; i < p->nrunning; i++) {
+        struct par_job *job = &p->running[i];
+        if (job->pid >= 0 && job->pidfd >= 0) {
+            pfds[n++] = (struct pollfd){.fd = job->pidfd, .events = POLLIN};
+        } else if (job->pid >= 0) {
+            timeout = PARALLEL_POLL_MS;
+        }
+        if (job->out >= 0) {
+            pfds[n++] = (struct pollfd){.fd = job->out, .events = POLLIN};
+        }
+    }
+    if (poll(pfds, n, timeout) < 0 && errno != EINTR) {
+        perror("poll failed");
+    }
+
+    // the descriptors went in job by job, they come back the same way
+    size_t k = 0;
+    for (size_t i = 0; i < p->nrunning; i++) {
+        struct par_job *job = &p->running[i];
+        bool ready = job->pidfd < 0;
+        if (job->pid >= 0 && job->pidfd >= 0) {
+            ready = pfds[k++].revents != 0;
+        }
+        if (job->pid >= 0 && ready) {
+            par_reap(p, job);
+        }
+        if (job->out >= 0 && pfds[k++].revents != 0) {
+            par_read(p, job);
+        }
+    }
+    free(pfds);
+}
+
+/**
+ * Helper function
+ *
+ * @brief Check if the jobs have been stopped, by Ctrl-Z or a signal sent
+ * to their group.
+ */
+static bool par_stopped(struct parallel *p) {
+    if (!p->in_shell || p->live == 0) {
+        return false;
+    }
+    siginfo_t info;
+    info.si_pid = 0;
+
+    return waitid(P_PGID, p->pgid, &info, WSTOPPED | WNOHANG) == 0 && info.si_pid != 0;
+}
+
+static void par_wait(struct parallel *p);
+
+/**
+ * Helper function
+ *
+ * @brief The jobs were stopped. They go to the job table as one stopped
+ * job, the way a stopped command does, and the run ends: lines not
+ * started yet are not run. With -k a copy of the shell joins the group to
+ * write out the rest of their output in order once they go on.
+ */
+static void par_suspend(struct parallel *p) {
+    pid_t *pids = malloc((p->nrunning + 1) * sizeof(pid_t));
+    if (pids == NULL) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < p->nrunning; i++) {
+        if (p->running[i].pid >= 0) {
+            pids[n++] = p->running[i].pid;
+        }
+    }
+    if (p->keep) {
+        struct spawn_attr attr = {.pgid = p->pgid, .foreground = false};
+        pid_t pid = sh_fork(p->sh, &attr);
+        if (pid == 0) {
+            // the jobs are not the copy's children, their pidfds still
+            // tell when they exit
+            p->in_shell = false;
+            while (p->nrunning > 0) {
+                par_wait(p);
+            }
+            _exit(0);
+        }
+        if (pid > 0) {
+            pids[n++] = pid;
+        }
+    }
+
+    // the jobs and their output belong to the job table and the copy now
+    for (size_t i = 0; i < p->nrunning; i++) {
+        struct par_job *job = &p->running[i];
+        if (job->pidfd >= 0) {
+            loop_remove_fd(job->pidfd);
+            close(job->pidfd);
+        }
+        if (job->out >= 0) {
+            loop_remove_fd(job->out);
+            close(job->out);
+        }
+        free(job->buf);
+    }
+    p->nrunning = 0;
+    p->live = 0;
+    p->stop = true;
+    p->stopped = true;
+    job_adopt(p->sh, p->pgid, pids, n, p->cmdline);
+    free(pids);
+}
+
+/**
+ * Helper function
+ *
+ * @brief Wait until at least one running job has exited, written
+ * something or stopped, and move the jobs that are finished out of the
+ * way.
+ */
+static void par_wait(struct parallel *p) {
+    // the shell's loop wakes up for SIGCHLD as well, which is how a stop
+    // shows, and keeps timers and other jobs going meanwhile
+    bool pidfds = loop_active();
+    for (size_t i = 0; pidfds && i < p->nrunning; i++) {
+        pidfds = p->running[i].pid < 0 || p->running[i].pidfd >= 0;
+    }
+    if (pidfds) {
+        loop_once(p->sh);
+    } else {
+        par_poll(p);
+    }
+
+    for (size_t i = 0; i < p->nrunning;) {
+        struct par_job *job = &p->running[i];
+        if (job->pid >= 0 || job->out >= 0) {
+            i++;
+            continue;
+        }
+        par_done(p, job);
+        p->running[i] = p->running[--p->nrunning];
+    }
+    par_flush(p);
+    if (par_stopped(p)) {
+        par_suspend(p);
+    }
+}
+
+/* Run lines of input as jobs, a few at a time */
+int parallel_run(struct shell *sh, char **argv) {
+    struct parallel p;
+    memset(&p, 0, sizeof(p));
+    p.sh = sh;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    p.slots = cpus > 0 ? (size_t)cpus : 1;
+
+    int i = 1;
+    for (; argv[i] != NULL && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if (strcmp(argv[i], "-k") == 0) {
+            p.keep = true;
+            continue;
+        }
+        const char *slots = strncmp(argv[i], "-j", 2) != 0 ? NULL
+                          : argv[i][2] != '\0' ? argv[i] + 2 : argv[++i];
+        char *end;
+        long n = slots != NULL ? strtol(slots, &end, 10) : 0;
+        if (slots == NULL || *slots == '\0' || *end != '\0' || n <= 0) {
+            fprintf(stderr, "parallel: usage: parallel [-j slots] [-k] [command [arg]...]\n");
+            return 2;
+        }
+        p.slots = (size_t)n;
+    }
+    p.tmpl = argv[i] != NULL ? argv + i : NULL;
+
+    p.null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (p.null_fd < 0) {
+        perror("parallel: /dev/null");
+        return 1;
+    }
+    p.in_shell = getpgrp() == sh->shell_pgid;
+    p.cmdline = join_args(argv);
+    p.running = malloc(p.slots * sizeof(struct par_job));
+    if (p.running == NULL) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+
+    struct line_reader *r = reader_new(STDIN_FILENO);
+    bool more = true;
+    for (;;) {
+        while (more && !p.stop && p.nrunning < p.slots) {
+            char *line = reader_next(r);
+            if (line == NULL) {
+                more = false;
+                break;
+            }
+            line = trim_white(line);
+            if (*line != '\0') {
+                par_start(&p, line);
+                par_flush(&p);
+            }
+        }
+        if (p.nrunning == 0) {
+            break;
+        }
+        par_wait(&p);
+    }
+    reader_free(r);
+    // an interrupted run leaves jobs that never finished without output
+    for (size_t j = 0; j < p.ndone; j++) {
+        free(p.done[j].buf);
+    }
+    close(p.null_fd);
+    free(p.running);
+    free(p.done);
+    free(p.cmdline);
+    if (p.stopped) {
+        if (more) {
+            fprintf(stderr, "parallel: stopped, the rest of the input is not run\n");
+        }
+        return 128 + SIGTSTP;
+    }
+
+    // the last group had the terminal
+    if (p.in_shell && sh->shell_is_interactive) {
+        tcsetpgrp(sh->shell_terminal, sh->shell_pgid);
+    }
+
+    // like GNU parallel the status is the number of jobs that failed
+    return p.failed > 100 ? 101 : (int)p.failed;
+}
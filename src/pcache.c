@@ -0,0 +1,158 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "lab.h"
+
+// Hash buckets, a power of two at least twice the number of entries
+#define PCACHE_BUCKETS 128
+
+/**
+ * @brief One cached line. The key and the vector live in the same arena so
+ * the entry holds a single reference for both.
+ */
+struct pcache_entry {
+    unsigned long hash;
+    size_t len;
+    const char *key;
+    char **cmd;
+    struct pcache_entry *chain;   // next entry in the same bucket
+    struct pcache_entry *prev;    // LRU list, most recently used first
+    struct pcache_entry *next;
+};
+
+static struct pcache_entry entries[PCACHE_ENTRIES];
+static struct pcache_entry *buckets[PCACHE_BUCKETS];
+static struct pcache_entry *lru_head;
+static struct pcache_entry *lru_tail;
+static size_t used;
+static unsigned long hits;
+static unsigned long misses;
+
+/**
+ * Helper function
+ *
+ * @brief Unlink an entry from the LRU list.
+ */
+static void lru_unlink(struct pcache_entry *e) {
+    if (e->prev != NULL) {
+        e->prev->next = e->next;
+    } else {
+        lru_head = e->next;
+    }
+    if (e->next != NULL) {
+        e->next->prev = e->prev;
+    } else {
+        lru_tail = e->prev;
+    }
+}
+
+/**
+ * Helper function
+ *
+ * @brief Put an entry at the most recently used end of the list.
+ */
+static void lru_push(struct pcache_entry *e) {
+    e->prev = NULL;
+    e->next = lru_head;
+    if (lru_head != NULL) {
+        lru_head->prev = e;
+    } else {
+        lru_tail = e;
+    }
+    lru_head = e;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Remove an entry from its bucket and drop the cache's reference.
+ */
+static void entry_drop(struct pcache_entry *e) {
+    struct pcache_entry **link = &buckets[e->hash & (PCACHE_BUCKETS - 1)];
+    while (*link != e) {
+        link = &(*link)->chain;
+    }
+    *link = e->chain;
+
+    cmd_free(e->cmd);
+    e->cmd = NULL;
+}
+
+/* 64 bit FNV-1a */
+unsigned long pcache_hash(const char *line, size_t len) {
+    unsigned long long h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)line[i];
+        h *= 0x100000001b3ULL;
+    }
+
+    return (unsigned long)h;
+}
+
+/* Find a line and take a reference to its vector */
+char **pcache_lookup(const char *line, size_t len, unsigned long hash) {
+    struct pcache_entry *e = buckets[hash & (PCACHE_BUCKETS - 1)];
+    while (e != NULL) {
+        // the hash only narrows it down, the line has to match exactly
+        if (e->hash == hash && e->len == len && memcmp(e->key, line, len) == 0) {
+            lru_unlink(e);
+            lru_push(e);
+            arena_retain(arena_head(e->cmd));
+            hits++;
+            return e->cmd;
+        }
+        e = e->chain;
+    }
+
+    misses++;
+
+    return NULL;
+}
+
+/* Remember a parsed line, evicting the least recently used one if full */
+void pcache_insert(const char *key, size_t len, unsigned long hash, char **cmd) {
+    if (len > PCACHE_MAX_LEN) {
+        return;
+    }
+
+    struct pcache_entry *e;
+    if (used < PCACHE_ENTRIES) {
+        e = &entries[used++];
+    } else {
+        // reuse the slot of the entry that went unused the longest
+        e = lru_tail;
+        lru_unlink(e);
+        entry_drop(e);
+    }
+
+    e->hash = hash;
+    e->len = len;
+    e->key = key;
+    e->cmd = cmd;
+    arena_retain(arena_head(cmd));
+
+    struct pcache_entry **bucket = &buckets[hash & (PCACHE_BUCKETS - 1)];
+    e->chain = *bucket;
+    *bucket = e;
+    lru_push(e);
+}
+
+/* Report the counters */
+void pcache_stats(unsigned long *hits_out, unsigned long *misses_out) {
+    *hits_out = hits;
+    *misses_out = misses;
+}
+
+/* Empty the cache */
+void pcache_clear(void) {
+    while (lru_head != NULL) {
+        struct pcache_entry *e = lru_head;
+        lru_unlink(e);
+        entry_drop(e);
+    }
+
+    used = 0;
+    hits = 0;
+    misses = 0;
+}
@@ -0,0 +1,226 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lab.h"
+
+_Static_assert(sizeof(struct cpu_mask) == sizeof(cpu_set_t), "cpu_mask must match cpu_set_t");
+
+// Bits in one word of a cpu_mask
+#define CPU_MASK_WORD (8 * sizeof(unsigned long))
+
+/**
+ * Helper function
+ *
+ * @brief Check if cpu is in mask. The bits are read as words, the mask is
+ * never looked at through a cpu_set_t pointer.
+ */
+static bool cpu_mask_isset(const struct cpu_mask *mask, unsigned cpu) {
+    return (mask->bits[cpu / CPU_MASK_WORD] >> (cpu % CPU_MASK_WORD)) & 1;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Add cpu to mask.
+ */
+static void cpu_mask_set(struct cpu_mask *mask, unsigned cpu) {
+    mask->bits[cpu / CPU_MASK_WORD] |= 1UL << (cpu % CPU_MASK_WORD);
+}
+
+/**
+ * Helper function
+ *
+ * @brief Read a CPU number, false if there is none or it is too big.
+ */
+static bool cpu_number(const char **p, unsigned *cpu) {
+    char *end;
+    if (**p < '0' || **p > '9') {
+        return false;
+    }
+    unsigned long n = strtoul(*p, &end, 10);
+    if (n >= CPU_MASK_BITS) {
+        return false;
+    }
+    *p = end;
+    *cpu = (unsigned)n;
+
+    return true;
+}
+
+/* Parse a CPU list the way taskset -c reads it */
+bool cpu_list_parse(const char *list, struct cpu_mask *mask) {
+    memset(mask, 0, sizeof(*mask));
+    const char *p = list;
+    do {
+        unsigned first, last, stride = 1;
+        if (!cpu_number(&p, &first)) {
+            return false;
+        }
+        last = first;
+        if (*p == '-') {
+            p++;
+            if (!cpu_number(&p, &last) || last < first) {
+                return false;
+            }
+            if (*p == ':') {
+                p++;
+                if (!cpu_number(&p, &stride) || stride == 0) {
+                    return false;
+                }
+            }
+        }
+        for (unsigned cpu = first; cpu <= last; cpu += stride) {
+            cpu_mask_set(mask, cpu);
+        }
+    } while (*p++ == ',');
+
+    return p[-1] == '\0';
+}
+
+/* Make mask the CPUs children run on */
+int pin_set(struct shell *sh, const struct cpu_mask *mask, bool rr) {
+    // a CPU the shell may not use itself is one its children may not use
+    // either, round robin would hand it out and the child would run
+    // anywhere
+    cpu_set_t wanted, usable;
+    memcpy(&wanted, mask, sizeof(wanted));
+    if (sched_getaffinity(0, sizeof(usable), &usable) == 0) {
+        CPU_AND(&usable, &usable, &wanted);
+    } else {
+        usable = wanted;
+    }
+    int count = CPU_COUNT(&usable);
+    if (count == 0) {
+        return -1;
+    }
+
+    memcpy(&sh->cpus, &usable, sizeof(sh->cpus));
+    sh->cpus_count = count;
+    sh->cpus_rr = rr;
+    sh->cpus_next = 0;
+
+    return 0;
+}
+
+/* Stop pinning children */
+void pin_clear(struct shell *sh) {
+    memset(&sh->cpus, 0, sizeof(sh->cpus));
+    sh->cpus_count = 0;
+    sh->cpus_rr = false;
+    sh->cpus_next = 0;
+}
+
+/* The CPUs of the next child */
+bool pin_next(struct shell *sh, struct cpu_mask *mask) {
+    if (sh->cpus_count == 0) {
+        return false;
+    }
+    if (!sh->cpus_rr) {
+        *mask = sh->cpus;
+        return true;
+    }
+
+    // the n-th CPU of the mask alone, n goes round
+    int n = sh->cpus_next++ % sh->cpus_count;
+    sh->cpus_next %= sh->cpus_count;
+    memset(mask, 0, sizeof(*mask));
+    for (unsigned cpu = 0; cpu < CPU_MASK_BITS; cpu++) {
+        if (cpu_mask_isset(&sh->cpus, cpu) && n-- == 0) {
+            cpu_mask_set(mask, cpu);
+            break;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Print a mask as a CPU list, ranges folded.
+ */
+static void cpu_list_print(const struct cpu_mask *mask) {
+    const char *sep = "";
+    for (unsigned cpu = 0; cpu < CPU_MASK_BITS; cpu++) {
+        if (!cpu_mask_isset(mask, cpu)) {
+            continue;
+        }
+        unsigned last = cpu;
+        while (last + 1 < CPU_MASK_BITS && cpu_mask_isset(mask, last + 1)) {
+            last++;
+        }
+        if (last > cpu) {
+            printf("%s%u-%u", sep, cpu, last);
+        } else {
+            printf("%s%u", sep, cpu);
+        }
+        sep = ",";
+        cpu = last;
+    }
+}
+
+/* The pin builtin */
+int pin_run(struct shell *sh, char **argv) {
+    if (argv[1] == NULL) {
+        if (sh->cpus_count == 0) {
+            printf("pin: off\n");
+        } else {
+            printf("pin: ");
+            cpu_list_print(&sh->cpus);
+            printf("%s\n", sh->cpus_rr ? " round robin" : "");
+        }
+        return 0;
+    }
+    if (strcmp(argv[1], "off") == 0 && argv[2] == NULL) {
+        pin_clear(sh);
+        return 0;
+    }
+
+    int i = 1;
+    bool rr = strcmp(argv[i], "-r") == 0;
+    i += rr;
+    struct cpu_mask mask;
+    if (argv[i] == NULL || (rr && argv[i + 1] != NULL)) {
+        fprintf(stderr, "pin: usage: pin [-r] cpulist | pin cpulist command [arg]... | pin off\n");
+        return 2;
+    }
+    if (!cpu_list_parse(argv[i], &mask)) {
+        fprintf(stderr, "pin: invalid cpu list '%s'\n", argv[i]);
+        return 2;
+    }
+
+    if (argv[i + 1] == NULL) {
+        if (pin_set(sh, &mask, rr) < 0) {
+            fprintf(stderr, "pin: no usable cpu in '%s'\n", argv[i]);
+            return 1;
+        }
+        return 0;
+    }
+
+    // every process of the job is started by job_start, the shell's own
+    // setting is back in place before anything else runs
+    struct cpu_mask cpus = sh->cpus;
+    int count = sh->cpus_count;
+    bool cpus_rr = sh->cpus_rr;
+    int next = sh->cpus_next;
+    if (pin_set(sh, &mask, false) < 0) {
+        fprintf(stderr, "pin: no usable cpu in '%s'\n", argv[i]);
+        return 1;
+    }
+    hash_drain();
+    char *cmdline = join_args(argv);
+    struct job *job = job_start(sh, argv + i + 1, cmdline, false);
+    free(cmdline);
+    sh->cpus = cpus;
+    sh->cpus_count = count;
+    sh->cpus_rr = cpus_rr;
+    sh->cpus_next = next;
+    if (job == NULL) {
+        return 127;
+    }
+
+    return job_foreground(sh, job, false);
+}
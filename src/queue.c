@@ -0,0 +1,378 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lab.h"
+
+/**
+ * Helper function
+ *
+ * @brief Read a small /proc file into buf.
+ *
+ * @return True if the file could be read
+ */
+static bool queue_read(const char *path, char *buf, size_t size) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    ssize_t n = read(fd, buf, size - 1);
+    close(fd);
+    if (n <= 0) {
+        return false;
+    }
+    buf[n] = '\0';
+
+    return true;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Read the one minute load average, the first field of loadavg.
+ *
+ * @return True if it could be read
+ */
+static bool queue_loadavg(double *value) {
+    char buf[256];
+    if (!queue_read("/proc/loadavg", buf, sizeof(buf))) {
+        return false;
+    }
+    char *end;
+    *value = strtod(buf, &end);
+
+    return end != buf;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Read the number after key in a small /proc file.
+ *
+ * @return True if the file could be read and has key
+ */
+static bool queue_gauge(const char *path, const char *key, double *value) {
+    char buf[256];
+    if (!queue_read(path, buf, sizeof(buf))) {
+        return false;
+    }
+
+    const char *p = strstr(buf, key);
+    if (p == NULL) {
+        return false;
+    }
+    p += strlen(key);
+    char *end;
+    *value = strtod(p, &end);
+
+    return end != p;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Parse a load or pressure limit: a non-negative number, 0 turns
+ * the limit off. value is left alone if arg is not.
+ *
+ * @return True if arg is a valid limit
+ */
+static bool queue_parse_limit(const char *arg, double *value) {
+    char *end;
+    double n = strtod(arg, &end);
+    if (end == arg || *end != '\0' || !(n >= 0)) {
+        return false;
+    }
+    *value = n;
+
+    return true;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Parse a job limit: a whole number of at least 1. value is left
+ * alone if arg is not.
+ *
+ * @return True if arg is a valid limit
+ */
+static bool queue_parse_jobs(const char *arg, int *value) {
+    char *end;
+    errno = 0;
+    long n = strtol(arg, &end, 10);
+    if (end == arg || *end != '\0' || errno != 0 || n < 1 || n > INT_MAX) {
+        return false;
+    }
+    *value = (int)n;
+
+    return true;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Check if the machine has room for another queued job. A gauge
+ * that can not be read does not hold the queue back.
+ */
+static bool queue_idle(const struct shell *sh) {
+    double value;
+    if (sh->queue_load > 0 && queue_loadavg(&value) && value >= sh->queue_load) {
+        return false;
+    }
+    // share of the last 10 s in which something was waiting for a CPU
+    if (sh->queue_psi > 0 && queue_gauge("/proc/pressure/cpu", "some avg10=", &value) &&
+        value >= sh->queue_psi) {
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Count the queued jobs that have not finished.
+ */
+static int queue_running(const struct shell *sh) {
+    int running = 0;
+    for (struct job *job = sh->jobs; job != NULL; job = job->next) {
+        running += job->queued && job->state != JOB_DONE;
+    }
+
+    return running;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Check if a builtin of the foreground job runs on a worker thread.
+ * Nothing may be forked then, the child could get a copy of a lock the
+ * thread holds; the shell schedules again once the job is done.
+ */
+static bool queue_held(const struct shell *sh) {
+    for (const struct job *job = sh->jobs; job != NULL; job = job->next) {
+        if (job->worker != NULL) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Helper function
+ *
+ * @brief The load was too high a while ago, look again.
+ */
+static void queue_recheck(struct shell *sh, void *arg) {
+    UNUSED(arg);
+    sh->queue_timer = 0;
+    queue_schedule(sh);
+}
+
+/**
+ * Helper function
+ *
+ * @brief Free a queued command.
+ */
+static void queue_entry_free(struct queue_entry *e) {
+    for (char **p = e->argv; *p != NULL; p++) {
+        free(*p);
+    }
+    free(e->argv);
+    free(e->cmdline);
+    free(e);
+}
+
+/**
+ * Helper function
+ *
+ * @brief Start the oldest queued command as a background job.
+ *
+ * @return int 1 if it started, 0 otherwise
+ */
+static int queue_start(struct shell *sh) {
+    struct queue_entry *e = sh->queue;
+    sh->queue = e->next;
+
+    hash_drain();
+    struct job *job = job_start(sh, e->argv, e->cmdline, true);
+    if (job != NULL) {
+        job->queued = true;
+    }
+    queue_entry_free(e);
+
+    return job != NULL;
+}
+
+/**
+ * Helper function
+ *
+ * @brief The load has held the queue back for QUEUE_DRAIN_MS.
+ */
+static void queue_expire(struct shell *sh, void *arg) {
+    UNUSED(sh);
+    *(bool *)arg = true;
+}
+
+/* Read the queue limits from the environment */
+void queue_init(struct shell *sh) {
+    sh->queue = NULL;
+    sh->queue_timer = 0;
+
+    // one at a time below 0.8 of a load per CPU like atd's batch, PSI is
+    // only looked at when asked for
+    const char *jobs = getenv("MY_QUEUE_JOBS");
+    const char *load = getenv("MY_QUEUE_LOAD");
+    const char *psi = getenv("MY_QUEUE_PSI");
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    sh->queue_jobs = 1;
+    sh->queue_load = 0.8 * (cpus > 0 ? cpus : 1);
+    sh->queue_psi = 0;
+    if (jobs != NULL && !queue_parse_jobs(jobs, &sh->queue_jobs)) {
+        fprintf(stderr, "Invalid queue job limit '%s', using 1\n", jobs);
+    }
+    if (load != NULL && !queue_parse_limit(load, &sh->queue_load)) {
+        fprintf(stderr, "Invalid queue load limit '%s', using %g\n", load, sh->queue_load);
+    }
+    if (psi != NULL && !queue_parse_limit(psi, &sh->queue_psi)) {
+        fprintf(stderr, "Invalid queue pressure limit '%s', not used\n", psi);
+    }
+}
+
+/* Start queued commands while the limits allow */
+void queue_schedule(struct shell *sh) {
+    if (sh->queue == NULL || queue_held(sh)) {
+        return;
+    }
+
+    int running = queue_running(sh);
+    bool idle = running < sh->queue_jobs && queue_idle(sh);
+    while (sh->queue != NULL && running < sh->queue_jobs && idle) {
+        running += queue_start(sh);
+        // the load average trails behind, one new job per look keeps a
+        // burst from going over the limit before it shows
+        idle = sh->queue_load <= 0 && sh->queue_psi <= 0;
+    }
+
+    // a child exiting brings the scheduler back, a busy machine does not
+    if (sh->queue != NULL && running < sh->queue_jobs && sh->queue_timer == 0 && loop_active()) {
+        sh->queue_timer = loop_timer(QUEUE_RECHECK_MS, queue_recheck, NULL);
+    }
+}
+
+/* The queue builtin */
+int queue_run(struct shell *sh, char **argv) {
+    int i = 1;
+    for (; argv[i] != NULL && argv[i][0] == '-'; i += 2) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        const char *arg = argv[i + 1];
+        bool ok = arg != NULL;
+        if (ok && strcmp(argv[i], "-j") == 0) {
+            ok = queue_parse_jobs(arg, &sh->queue_jobs);
+        } else if (ok && strcmp(argv[i], "-l") == 0) {
+            ok = queue_parse_limit(arg, &sh->queue_load);
+        } else if (ok && strcmp(argv[i], "-p") == 0) {
+            ok = queue_parse_limit(arg, &sh->queue_psi);
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            fprintf(stderr, "queue: usage: queue [-j jobs] [-l load] [-p pressure] [command [arg]...]\n");
+            return 2;
+        }
+    }
+
+    if (argv[i] == NULL) {
+        // show what is waiting and what holds it back
+        int n = 0;
+        for (struct queue_entry *e = sh->queue; e != NULL; e = e->next) {
+            printf("%d\t%s\n", ++n, e->cmdline);
+        }
+        printf("queue: %d waiting, %d of %d running, load limit %g, pressure limit %g\n",
+               n, queue_running(sh), sh->queue_jobs, sh->queue_load, sh->queue_psi);
+        // limits may have changed
+        queue_schedule(sh);
+        return 0;
+    }
+
+    // the words are the builtin's, the entry keeps its own
+    struct queue_entry *e = calloc(1, sizeof(struct queue_entry));
+    size_t argc = 0;
+    while (argv[i + argc] != NULL) {
+        argc++;
+    }
+    char **words = e != NULL ? calloc(argc + 1, sizeof(char *)) : NULL;
+    if (words == NULL) {
+        perror("calloc failed");
+        exit(EXIT_FAILURE);
+    }
+    e->argv = words;
+    for (size_t j = 0; j < argc; j++) {
+        words[j] = strdup(argv[i + j]);
+        if (words[j] == NULL) {
+            perror("strdup failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    e->cmdline = join_args(words);
+
+    struct queue_entry **link = &sh->queue;
+    while (*link != NULL) {
+        link = &(*link)->next;
+    }
+    *link = e;
+    queue_schedule(sh);
+
+    return 0;
+}
+
+/* Start what is still queued before the shell exits */
+void queue_drain(struct shell *sh) {
+    if (sh->queue == NULL || !loop_active()) {
+        return;
+    }
+
+    // the load gets QUEUE_DRAIN_MS to come down, after that only the job
+    // limit holds the rest back
+    bool expired = false;
+    unsigned timer = loop_timer(QUEUE_DRAIN_MS, queue_expire, &expired);
+    while (sh->queue != NULL) {
+        queue_schedule(sh);
+        while (expired && sh->queue != NULL && queue_running(sh) < sh->queue_jobs) {
+            queue_start(sh);
+        }
+        if (sh->queue != NULL) {
+            // a child exiting or the recheck timer comes back here
+            loop_once(sh);
+            jobs_update(sh);
+        }
+    }
+    if (!expired) {
+        loop_cancel(timer);
+    }
+}
+
+/* Drop the commands that never started */
+void queue_free(struct shell *sh) {
+    int dropped = 0;
+    while (sh->queue != NULL) {
+        struct queue_entry *e = sh->queue;
+        sh->queue = e->next;
+        queue_entry_free(e);
+        dropped++;
+    }
+    if (dropped > 0) {
+        fprintf(stderr, "queue: %d queued command%s never started\n", dropped, dropped == 1 ? "" : "s");
+    }
+    if (sh->queue_timer != 0) {
+        loop_cancel(sh->queue_timer);
+        sh->queue_timer = 0;
+    }
+}
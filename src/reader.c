@@ -0,0 +1,97 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lab.h"
+
+/* Start reading lines from fd */
+struct line_reader *reader_new(int fd) {
+    struct line_reader *r = malloc(sizeof(struct line_reader));
+    if (r == NULL) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    // one byte more than is read so the last line can always be terminated
+    r->cap = READER_BUF_SIZE;
+    r->buf = malloc(r->cap + 1);
+    if (r->buf == NULL) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    r->fd = fd;
+    r->pos = 0;
+    r->len = 0;
+    r->eof = false;
+
+    return r;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Move the unread bytes to the front of the buffer and read more
+ * behind them, growing the buffer when a single line fills it.
+ */
+static void reader_fill(struct line_reader *r) {
+    size_t rest = r->len - r->pos;
+    memmove(r->buf, r->buf + r->pos, rest);
+    r->pos = 0;
+    r->len = rest;
+
+    if (r->len == r->cap) {
+        char *buf = realloc(r->buf, 2 * r->cap + 1);
+        if (buf == NULL) {
+            perror("realloc failed");
+            exit(EXIT_FAILURE);
+        }
+        r->buf = buf;
+        r->cap *= 2;
+    }
+
+    ssize_t n;
+    do {
+        n = read(r->fd, r->buf + r->len, r->cap - r->len);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        // nothing more can be read, run what is there
+        perror("read failed");
+        n = 0;
+    }
+    if (n == 0) {
+        r->eof = true;
+    }
+    r->len += (size_t)n;
+}
+
+/* Hand out the next line */
+char *reader_next(struct line_reader *r) {
+    for (;;) {
+        char *start = r->buf + r->pos;
+        char *nl = memchr(start, '\n', r->len - r->pos);
+        if (nl != NULL) {
+            *nl = '\0';
+            r->pos = (size_t)(nl + 1 - r->buf);
+            return start;
+        }
+        if (r->eof) {
+            if (r->pos == r->len) {
+                return NULL;
+            }
+            // the last line has no newline
+            r->buf[r->len] = '\0';
+            r->pos = r->len;
+            return start;
+        }
+        reader_fill(r);
+    }
+}
+
+/* Free the reader */
+void reader_free(struct line_reader *r) {
+    if (r != NULL) {
+        free(r->buf);
+        free(r);
+    }
+}
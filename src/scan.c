@@ -0,0 +1,212 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+#include "lab.h"
+
+/* Signature shared by every delimiter scanner */
+typedef const char *(*scan_fn)(const char *p, const char *end);
+
+// Whitespace as the C locale defines it: space, \t, \n, \v, \f and \r
+static const bool space_table[256] = {
+    [' '] = true, ['\t'] = true, ['\n'] = true,
+    ['\v'] = true, ['\f'] = true, ['\r'] = true,
+};
+
+// Bytes the lexer has to look at: whitespace, quotes, backslash and the
+// bytes that start an operator
+static const bool delim_table[256] = {
+    [' '] = true, ['\t'] = true, ['\n'] = true,
+    ['\v'] = true, ['\f'] = true, ['\r'] = true,
+    ['"'] = true, ['\''] = true, ['\\'] = true,
+    ['&'] = true, ['|'] = true, ['<'] = true, ['>'] = true, [';'] = true,
+};
+
+/* Check a byte against the C locale whitespace set */
+bool scan_is_space(char c) {
+    return space_table[(unsigned char)c];
+}
+
+/* Skip over whitespace, runs are short so this stays scalar */
+const char *scan_skip_space(const char *p, const char *end) {
+    while (p < end && space_table[(unsigned char)*p]) {
+        p++;
+    }
+
+    return p;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Reference implementation, one table lookup per byte. The vector
+ * versions fall back to this for the tail of the buffer that is shorter than
+ * one vector.
+ */
+static const char *scan_delim_scalar(const char *p, const char *end) {
+    while (p < end && !delim_table[(unsigned char)*p]) {
+        p++;
+    }
+
+    return p;
+}
+
+#ifdef SCAN_X86
+/**
+ * Helper function
+ *
+ * @brief Classify 16 bytes at a time. \t..\r are contiguous so they are
+ * matched with a signed range compare, bytes >= 0x80 are negative and fall
+ * outside the range.
+ */
+__attribute__((target("sse2")))
+static const char *scan_delim_sse2(const char *p, const char *end) {
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i squote = _mm_set1_epi8('\'');
+    const __m128i bslash = _mm_set1_epi8('\\');
+    const __m128i amp = _mm_set1_epi8('&');
+    const __m128i bar = _mm_set1_epi8('|');
+    const __m128i less = _mm_set1_epi8('<');
+    const __m128i greater = _mm_set1_epi8('>');
+    const __m128i semi = _mm_set1_epi8(';');
+    const __m128i lo = _mm_set1_epi8('\t' - 1);
+    const __m128i hi = _mm_set1_epi8('\r' + 1);
+
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, quote));
+        hit = _mm_or_si128(hit, _mm_or_si128(_mm_cmpeq_epi8(v, squote), _mm_cmpeq_epi8(v, bslash)));
+        hit = _mm_or_si128(hit, _mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi)));
+        hit = _mm_or_si128(hit, _mm_or_si128(_mm_cmpeq_epi8(v, amp), _mm_cmpeq_epi8(v, bar)));
+        hit = _mm_or_si128(hit, _mm_or_si128(_mm_cmpeq_epi8(v, less), _mm_cmpeq_epi8(v, greater)));
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, semi));
+
+        // one bit per byte, the lowest set bit is the first delimiter
+        unsigned mask = (unsigned)_mm_movemask_epi8(hit);
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+
+    return scan_delim_scalar(p, end);
+}
+
+/**
+ * Helper function
+ *
+ * @brief Same classification as scan_delim_sse2 on 32 bytes at a time.
+ */
+__attribute__((target("avx2")))
+static const char *scan_delim_avx2(const char *p, const char *end) {
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i squote = _mm256_set1_epi8('\'');
+    const __m256i bslash = _mm256_set1_epi8('\\');
+    const __m256i amp = _mm256_set1_epi8('&');
+    const __m256i bar = _mm256_set1_epi8('|');
+    const __m256i less = _mm256_set1_epi8('<');
+    const __m256i greater = _mm256_set1_epi8('>');
+    const __m256i semi = _mm256_set1_epi8(';');
+    const __m256i lo = _mm256_set1_epi8('\t' - 1);
+    const __m256i hi = _mm256_set1_epi8('\r' + 1);
+
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(v, space), _mm256_cmpeq_epi8(v, quote));
+        hit = _mm256_or_si256(hit, _mm256_or_si256(_mm256_cmpeq_epi8(v, squote), _mm256_cmpeq_epi8(v, bslash)));
+        hit = _mm256_or_si256(hit, _mm256_and_si256(_mm256_cmpgt_epi8(v, lo), _mm256_cmpgt_epi8(hi, v)));
+        hit = _mm256_or_si256(hit, _mm256_or_si256(_mm256_cmpeq_epi8(v, amp), _mm256_cmpeq_epi8(v, bar)));
+        hit = _mm256_or_si256(hit, _mm256_or_si256(_mm256_cmpeq_epi8(v, less), _mm256_cmpeq_epi8(v, greater)));
+        hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, semi));
+
+        unsigned mask = (unsigned)_mm256_movemask_epi8(hit);
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+
+    // finish the last partial vector with the narrower unit
+    return scan_delim_sse2(p, end);
+}
+#endif
+
+static const char *scan_delim_resolve(const char *p, const char *end);
+
+// The scanner in use, picked on first call; the shell and the parse-ahead
+// thread can both make that call, they store the same pointer
+static _Atomic scan_fn scan_delim_impl = scan_delim_resolve;
+
+/**
+ * Helper function
+ *
+ * @brief Switch to scanner fn. Relaxed is enough, every scanner gives the
+ * same answer so a thread that still sees the old one is not wrong.
+ */
+static void scan_set(scan_fn fn) {
+    atomic_store_explicit(&scan_delim_impl, fn, memory_order_relaxed);
+}
+
+/**
+ * Helper function
+ *
+ * @brief First call through scan_delim lands here, pick the widest
+ * implementation the CPU supports and forward to it.
+ */
+static const char *scan_delim_resolve(const char *p, const char *end) {
+    scan_use(SCAN_AUTO);
+
+    return atomic_load_explicit(&scan_delim_impl, memory_order_relaxed)(p, end);
+}
+
+/* Select the delimiter scanner */
+bool scan_use(enum scan_impl impl) {
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    bool has_sse2 = __builtin_cpu_supports("sse2");
+    bool has_avx2 = __builtin_cpu_supports("avx2");
+#else
+    bool has_sse2 = false;
+    bool has_avx2 = false;
+#endif
+
+    // fall back from the widest unit to the scalar loop
+    if (impl == SCAN_AUTO) {
+        impl = has_avx2 ? SCAN_AVX2 : has_sse2 ? SCAN_SSE2 : SCAN_SCALAR;
+    }
+
+    switch (impl) {
+        case SCAN_SCALAR:
+            scan_set(scan_delim_scalar);
+            return true;
+#ifdef SCAN_X86
+        case SCAN_SSE2:
+            if (has_sse2) {
+                scan_set(scan_delim_sse2);
+                return true;
+            }
+            return false;
+        case SCAN_AVX2:
+            if (has_avx2) {
+                scan_set(scan_delim_avx2);
+                return true;
+            }
+            return false;
+#endif
+        default:
+            return false;
+    }
+}
+
+/* Find the next byte the lexer has to look at */
+const char *scan_delim(const char *p, const char *end) {
+    return atomic_load_explicit(&scan_delim_impl, memory_order_relaxed)(p, end);
+}
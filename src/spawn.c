@@ -0,0 +1,851 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/sched.h>
+
+#include "lab.h"
+
+// Stack for children created with clone3, they share the shell's memory
+// until they exec so they can not use the shell's stack
+#define CLONE_STACK_SIZE (64 * 1024)
+
+// Job control signals the shell ignores and every child gets back
+static const int child_signals[] = {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU};
+
+// Names accepted by spawn_backend_parse, in enum spawn_backend order
+static const char *backend_names[] = {"fork", "vfork", "posix_spawn", "clone3", "zygote"};
+
+// The shell's end of the socket to the zygote and the zygote itself
+static int zygote_fd = -1;
+static pid_t zygote_pid = -1;
+
+/**
+ * @brief What the shell sends the zygote for each command. The header is
+ * followed by len bytes of NUL terminated strings: the path to exec, the
+ * working directory, argc arguments and envc environment entries. The
+ * child's stdin, stdout and stderr ride along as SCM_RIGHTS, followed by
+ * the terminal; the zygote's own fd 0 is /dev/null so a descriptor number
+ * would name the wrong file there.
+ */
+struct zygote_request {
+    pid_t pgid;
+    bool terminal;          // give the terminal, the fourth descriptor, to the group
+    sigset_t mask;
+    bool pinned;
+    cpu_set_t cpus;
+    size_t argc;
+    size_t envc;
+    size_t len;
+};
+
+/**
+ * @brief The zygote's answer: the pid of the child or the errno of the
+ * failed clone.
+ */
+struct zygote_reply {
+    pid_t pid;
+    int err;
+};
+
+/**
+ * @brief Everything a child needs between its creation and exec. For the
+ * backends that share memory with the shell this lives on the shell's
+ * stack and the child only reads it.
+ */
+struct child_args {
+    char **argv;
+    const char *path;
+    pid_t pgid;
+    int terminal;           // give the terminal to the group, -1 to not
+    sigset_t mask;          // signal mask to exec with
+    bool pinned;            // run on cpus only
+    cpu_set_t cpus;
+    int stdio[3];           // becomes 0, 1 and 2
+    int moved[3];           // copies made by child_args_init, -1 if none
+};
+
+/**
+ * Helper function
+ *
+ * @brief Write a message to stderr as "what: errno N" without stdio or
+ * strerror. stdio buffers are shared with the shell when the child runs
+ * in its memory, and strerror may take the locale lock, so only write(2)
+ * is safe after vfork or clone3.
+ */
+static void child_error(const char *what, int err) {
+    // the digits are filled in from the end
+    char num[16];
+    char *p = num + sizeof(num);
+    *--p = '\n';
+    unsigned value = err < 0 ? 0 : (unsigned)err;
+    do {
+        *--p = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0 && p > num);
+    const char *parts[] = {what, ": errno ", p};
+    size_t lens[] = {strlen(what), strlen(": errno "), (size_t)(num + sizeof(num) - p)};
+
+    for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); i++) {
+        if (write(STDERR_FILENO, parts[i], lens[i]) < 0) {
+            break;
+        }
+    }
+}
+
+/**
+ * Helper function
+ *
+ * @brief Put a new child where the job wants it. Only async-signal-safe
+ * calls are made here so the same code is correct for every backend.
+ */
+static void child_setup(const struct child_args *c) {
+    // join the job's process group and give it the terminal, the shell does
+    // the same from its side so neither order can race
+    setpgid(0, c->pgid);
+    if (c->terminal >= 0) {
+        tcsetpgrp(c->terminal, c->pgid != 0 ? c->pgid : getpid());
+    }
+
+    // undo what the shell ignores and blocks for itself
+    struct sigaction dfl;
+    memset(&dfl, 0, sizeof(dfl));
+    dfl.sa_handler = SIG_DFL;
+    for (size_t i = 0; i < sizeof(child_signals) / sizeof(child_signals[0]); i++) {
+        sigaction(child_signals[i], &dfl, NULL);
+    }
+    sigprocmask(SIG_SETMASK, &c->mask, NULL);
+    // before exec, so the command never runs anywhere else
+    if (c->pinned) {
+        sched_setaffinity(0, sizeof(c->cpus), &c->cpus);
+    }
+
+    // pipe ends are close on exec, only the copies on 0, 1 and 2 survive
+    for (int fd = 0; fd < 3; fd++) {
+        if (c->stdio[fd] != fd) {
+            dup2(c->stdio[fd], fd);
+        }
+    }
+}
+
+/**
+ * Helper function
+ *
+ * @brief The child side of fork, vfork and clone3.
+ */
+static int child_exec(void *arg) {
+    struct child_args *c = arg;
+
+    child_setup(c);
+    // the command gets 0, 1 and 2 and nothing else, whatever the shell or
+    // a library opened without O_CLOEXEC stays behind
+    close_range(3, ~0U, 0);
+    execv(c->path, c->argv);
+    // the hashed file is gone: search PATH again
+    execvp(c->argv[0], c->argv);
+    child_error("execvp failed", errno);
+    _exit(127);
+}
+
+/**
+ * Helper function
+ *
+ * @brief Start the child with a plain fork.
+ */
+static pid_t spawn_fork(struct child_args *c) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        child_exec(c);
+    }
+
+    return pid;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Run fn(arg) in a child created by clone3 with CLONE_VM and
+ * CLONE_VFORK: the child shares the shell's memory and the shell is
+ * suspended until the child execs or exits. There is no libc wrapper for
+ * clone3 so the child is started on its own stack by hand.
+ *
+ * @return pid_t The child's pid or -1 with errno set
+ */
+static pid_t clone3_vfork(int (*fn)(void *), void *arg) {
+#if defined(__x86_64__)
+    static void *stack;
+    if (stack == NULL) {
+        stack = mmap(NULL, CLONE_STACK_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+        if (stack == MAP_FAILED) {
+            stack = NULL;
+            return -1;
+        }
+    }
+
+    struct clone_args ca;
+    memset(&ca, 0, sizeof(ca));
+    ca.flags = CLONE_VM | CLONE_VFORK;
+    ca.exit_signal = SIGCHLD;
+    ca.stack = (unsigned long)stack;
+    ca.stack_size = CLONE_STACK_SIZE;
+
+    // the child comes back from the syscall on the new stack with the same
+    // registers, fn and arg ride along in callee saved registers
+    register long rax __asm__("rax") = SYS_clone3;
+    register void *rdi __asm__("rdi") = &ca;
+    register size_t rsi __asm__("rsi") = sizeof(ca);
+    register int (*r12)(void *) __asm__("r12") = fn;
+    register void *r13 __asm__("r13") = arg;
+    __asm__ volatile(
+        "syscall\n\t"
+        "test %%rax, %%rax\n\t"
+        "jnz 1f\n\t"
+        "xor %%ebp, %%ebp\n\t"
+        "mov %%r13, %%rdi\n\t"
+        "call *%%r12\n\t"
+        "mov %%eax, %%edi\n\t"
+        "mov %[exit], %%eax\n\t"
+        "syscall\n\t"
+        "hlt\n"
+        "1:"
+        : "+r"(rax)
+        : "r"(rdi), "r"(rsi), "r"(r12), "r"(r13), [exit] "i"(SYS_exit)
+        : "rcx", "r11", "memory");
+
+    if (rax < 0) {
+        errno = (int)-rax;
+        return -1;
+    }
+
+    return (pid_t)rax;
+#else
+    UNUSED(fn);
+    UNUSED(arg);
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/**
+ * Helper function
+ *
+ * @brief Start the child with posix_spawn. The process group, the terminal,
+ * the default signals and the mask are all spawn attributes so glibc does
+ * the same child setup as child_exec.
+ */
+static pid_t spawn_posix(struct child_args *c) {
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_init(&attr);
+    posix_spawn_file_actions_init(&actions);
+
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    for (size_t i = 0; i < sizeof(child_signals) / sizeof(child_signals[0]); i++) {
+        sigaddset(&defaults, child_signals[i]);
+    }
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF |
+                             POSIX_SPAWN_SETSIGMASK);
+    posix_spawnattr_setpgroup(&attr, c->pgid);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setsigmask(&attr, &c->mask);
+    if (c->terminal >= 0) {
+        posix_spawn_file_actions_addtcsetpgrp_np(&actions, c->terminal);
+    }
+    for (int fd = 0; fd < 3; fd++) {
+        if (c->stdio[fd] != fd) {
+            posix_spawn_file_actions_adddup2(&actions, c->stdio[fd], fd);
+        }
+    }
+    posix_spawn_file_actions_addclosefrom_np(&actions, 3);
+
+    extern char **environ;
+    pid_t pid;
+    int err = posix_spawn(&pid, c->path, &actions, &attr, c->argv, environ);
+    if (err == ENOENT) {
+        // the hashed file is gone: search PATH again
+        err = posix_spawnp(&pid, c->argv[0], &actions, &attr, c->argv, environ);
+    }
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (err != 0) {
+        fprintf(stderr, "posix_spawn failed: %s\n", strerror(err));
+        return -1;
+    }
+
+    return pid;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Write all of buf to a socket, the zygote end going away is an
+ * error and not a SIGPIPE.
+ */
+static bool send_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+
+    return true;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Read exactly len bytes, false on an error or end of file.
+ */
+static bool recv_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+
+    return true;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Unpack a request and clone the child. CLONE_PARENT makes the
+ * child a child of the shell and not of the zygote, so the shell reaps it
+ * and moves it between process groups exactly as if it had forked it.
+ */
+static struct zygote_reply zygote_clone(const struct zygote_request *req, char *strings,
+                                        const int *fds) {
+    struct zygote_reply reply = {.pid = -1, .err = ENOMEM};
+    char **argv = malloc((req->argc + 1) * sizeof(char *));
+    char **envp = malloc((req->envc + 1) * sizeof(char *));
+    if (argv == NULL || envp == NULL) {
+        free(argv);
+        free(envp);
+        return reply;
+    }
+
+    char *p = strings;
+    const char *path = p;
+    p += strlen(p) + 1;
+    const char *cwd = p;
+    p += strlen(p) + 1;
+    for (size_t i = 0; i < req->argc; i++, p += strlen(p) + 1) {
+        argv[i] = p;
+    }
+    argv[req->argc] = NULL;
+    for (size_t i = 0; i < req->envc; i++, p += strlen(p) + 1) {
+        envp[i] = p;
+    }
+    envp[req->envc] = NULL;
+
+    struct child_args c;
+    c.argv = argv;
+    c.path = path;
+    c.pgid = req->pgid;
+    c.terminal = req->terminal ? fds[3] : -1;
+    c.mask = req->mask;
+    c.pinned = req->pinned;
+    c.cpus = req->cpus;
+    // the shell's descriptors are already in place when child_exec runs
+    for (int fd = 0; fd < 3; fd++) {
+        c.stdio[fd] = fd;
+        c.moved[fd] = -1;
+    }
+
+    // no CLONE_VM so this is a plain fork that reports to our parent
+    long pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, NULL, NULL, 0);
+    if (pid == 0) {
+        // take over the shell's view of the world at the time of the call
+        for (int fd = 0; fd < 3; fd++) {
+            if (fds[fd] == fd) {
+                fcntl(fd, F_SETFD, 0);
+            } else {
+                dup2(fds[fd], fd);
+            }
+        }
+        if (cwd[0] != '\0' && chdir(cwd) < 0) {
+            child_error(cwd, errno);
+        }
+        extern char **environ;
+        environ = envp;
+        child_exec(&c);
+    }
+
+    reply.pid = (pid_t)pid;
+    reply.err = pid < 0 ? errno : 0;
+    free(argv);
+    free(envp);
+
+    return reply;
+}
+
+/**
+ * Helper function
+ *
+ * @brief The zygote's main loop: one request in, one child and one reply
+ * out, until the shell closes its end.
+ */
+static void zygote_main(int fd) {
+    // do not keep the shell's terminal or pipes open, every child gets the
+    // ones the shell sends with the request
+    int null = open("/dev/null", O_RDWR | O_CLOEXEC);
+    for (int i = 0; i < 3 && null >= 0; i++) {
+        dup2(null, i);
+    }
+    if (null > 2) {
+        close(null);
+    }
+    // nor anything else the shell had open when it forked us, a pipe end
+    // held here would keep the reader of a pipeline from seeing end of file
+    if (fd > 3) {
+        close_range(3, (unsigned)fd - 1, 0);
+    }
+    close_range((unsigned)fd + 1, ~0U, 0);
+
+    while (true) {
+        struct zygote_request req;
+        int fds[4];
+        union {
+            char buf[CMSG_SPACE(sizeof(fds))];
+            struct cmsghdr align;
+        } control;
+        struct iovec iov = {.iov_base = &req, .iov_len = sizeof(req)};
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+
+        // the descriptors arrive with the first byte of the header
+        ssize_t n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            _exit(EXIT_SUCCESS);
+        }
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS ||
+            cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+            _exit(EXIT_FAILURE);
+        }
+        memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+        char *strings = malloc(req.len);
+        if (strings == NULL || !recv_all(fd, (char *)&req + n, sizeof(req) - (size_t)n) ||
+            !recv_all(fd, strings, req.len)) {
+            _exit(EXIT_FAILURE);
+        }
+
+        struct zygote_reply reply = zygote_clone(&req, strings, fds);
+        free(strings);
+        for (int i = 0; i < 4; i++) {
+            close(fds[i]);
+        }
+        if (!send_all(fd, &reply, sizeof(reply))) {
+            _exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/**
+ * Helper function
+ *
+ * @brief Append a string and its terminator to a growing buffer.
+ */
+static char *put_string(char *p, const char *s) {
+    size_t len = strlen(s) + 1;
+    memcpy(p, s, len);
+
+    return p + len;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Ask the zygote for a child. The request carries everything the
+ * child inherits from the shell at the time of the call: its stdio, the
+ * working directory, the environment and the signal mask.
+ *
+ * @return pid_t The child or -1 with errno set, EPIPE if there is no
+ * zygote to ask
+ */
+static pid_t spawn_zygote(struct child_args *c) {
+    if (zygote_fd < 0 && zygote_start() < 0) {
+        errno = EPIPE;
+        return -1;
+    }
+
+    extern char **environ;
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        // the child stays where the zygote is
+        cwd[0] = '\0';
+    }
+
+    struct zygote_request req;
+    memset(&req, 0, sizeof(req));
+    req.pgid = c->pgid;
+    req.terminal = c->terminal >= 0;
+    req.mask = c->mask;
+    req.pinned = c->pinned;
+    req.cpus = c->cpus;
+    req.len = strlen(c->path) + 1 + strlen(cwd) + 1;
+    for (; c->argv[req.argc] != NULL; req.argc++) {
+        req.len += strlen(c->argv[req.argc]) + 1;
+    }
+    for (; environ[req.envc] != NULL; req.envc++) {
+        req.len += strlen(environ[req.envc]) + 1;
+    }
+
+    char *strings = malloc(req.len);
+    if (strings == NULL) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    char *p = put_string(strings, c->path);
+    p = put_string(p, cwd);
+    for (size_t i = 0; i < req.argc; i++) {
+        p = put_string(p, c->argv[i]);
+    }
+    for (size_t i = 0; i < req.envc; i++) {
+        p = put_string(p, environ[i]);
+    }
+
+    // the message always carries four descriptors, without a terminal to
+    // hand over stdin stands in for it
+    int fds[4] = {c->stdio[0], c->stdio[1], c->stdio[2], c->terminal >= 0 ? c->terminal : c->stdio[0]};
+    union {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct iovec iov = {.iov_base = &req, .iov_len = sizeof(req)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    struct zygote_reply reply;
+    ssize_t n;
+    while ((n = sendmsg(zygote_fd, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR) {
+    }
+    bool ok = n > 0 && send_all(zygote_fd, (char *)&req + n, sizeof(req) - (size_t)n) &&
+              send_all(zygote_fd, strings, req.len) &&
+              recv_all(zygote_fd, &reply, sizeof(reply));
+    free(strings);
+
+    if (!ok) {
+        // the zygote is gone, the next request starts a new one
+        zygote_stop();
+        errno = EPIPE;
+        return -1;
+    }
+    if (reply.pid < 0) {
+        errno = reply.err;
+        return -1;
+    }
+
+    return reply.pid;
+}
+
+/* Fork the zygote */
+int zygote_start(void) {
+    if (zygote_fd >= 0) {
+        return 0;
+    }
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        close(sv[0]);
+        zygote_main(sv[1]);
+    }
+
+    close(sv[1]);
+    zygote_fd = sv[0];
+    zygote_pid = pid;
+
+    return 0;
+}
+
+/* Stop the zygote */
+void zygote_stop(void) {
+    if (zygote_fd < 0) {
+        return;
+    }
+
+    // end of file on the socket makes the zygote exit
+    close(zygote_fd);
+    zygote_fd = -1;
+    waitpid(zygote_pid, NULL, 0);
+    zygote_pid = -1;
+}
+
+/* Map a backend name to the backend */
+int spawn_backend_parse(const char *name) {
+    for (size_t i = 0; i < sizeof(backend_names) / sizeof(backend_names[0]); i++) {
+        if (strcmp(name, backend_names[i]) == 0) {
+            return (int)i;
+        }
+    }
+
+    return -1;
+}
+
+/* Map a backend to its name */
+const char *spawn_backend_name(enum spawn_backend backend) {
+    return backend_names[backend];
+}
+
+/**
+ * Helper function
+ *
+ * @brief Fill in the child's setup from the spawn attributes.
+ */
+static void child_args_init(struct shell *sh, struct child_args *c, char **argv,
+                            const char *path, const struct spawn_attr *attr) {
+    c->argv = argv;
+    c->path = path;
+    c->pgid = attr->pgid;
+    c->terminal = attr->foreground && sh->shell_is_interactive ? sh->shell_terminal : -1;
+    // not the shell's own mask, that blocks the event loop's signals
+    c->mask = sh->child_mask;
+    struct cpu_mask cpus;
+    c->pinned = pin_next(sh, &cpus);
+    memcpy(&c->cpus, &cpus, sizeof(c->cpus));
+    for (int fd = 0; fd < 3; fd++) {
+        c->stdio[fd] = attr->stdio != NULL ? attr->stdio[fd] : fd;
+        c->moved[fd] = -1;
+    }
+
+    // the child fills 0, 1 and 2 in order, a source that is one of them
+    // and gets replaced itself, as in 2>&1 >file, must be copied first
+    for (int fd = 0; fd < 3; fd++) {
+        int src = c->stdio[fd];
+        if (src >= 0 && src < 3 && src != fd && c->stdio[src] != src) {
+            c->moved[fd] = fcntl(src, F_DUPFD_CLOEXEC, 3);
+            if (c->moved[fd] >= 0) {
+                c->stdio[fd] = c->moved[fd];
+            }
+        }
+    }
+}
+
+/**
+ * Helper function
+ *
+ * @brief Close the copies child_args_init made, the child has its own.
+ */
+static void child_args_release(struct child_args *c) {
+    for (int fd = 0; fd < 3; fd++) {
+        if (c->moved[fd] >= 0) {
+            close(c->moved[fd]);
+        }
+    }
+}
+
+/**
+ * Helper function
+ *
+ * @brief This is in the parent put the child process into its own
+ * process group and give it control of the terminal to avoid a race
+ * condition.
+ */
+static void parent_setup(const struct child_args *c, pid_t pid) {
+    pid_t pgid = c->pgid != 0 ? c->pgid : pid;
+    setpgid(pid, pgid);
+    if (c->terminal >= 0) {
+        tcsetpgrp(c->terminal, pgid);
+    }
+}
+
+/* Start argv as a new child */
+pid_t sh_spawn(struct shell *sh, char **argv, const struct spawn_attr *attr) {
+    // resolve the command before spawning so the child goes straight to
+    // execve instead of trying every PATH directory, a command that is not
+    // there is reported without creating a child at all
+    const char *path = hash_lookup(argv[0]);
+    if (path == NULL) {
+        fprintf(stderr, "%s: command not found\n", argv[0]);
+        return -1;
+    }
+
+    struct child_args c;
+    child_args_init(sh, &c, argv, path, attr);
+
+    // nothing may be delivered to a child running in the shell's memory
+    // before it has reset its handlers, block everything until then
+    sigset_t all, saved;
+    sigfillset(&all);
+    sigprocmask(SIG_SETMASK, &all, &saved);
+
+    // posix_spawn has no attribute for the affinity, a pinned child is
+    // vforked instead so it never runs on a CPU it is kept off
+    enum spawn_backend backend = sh->spawn;
+    if (backend == SPAWN_POSIX && c.pinned) {
+        backend = SPAWN_VFORK;
+    }
+
+    pid_t pid;
+    switch (backend) {
+        case SPAWN_VFORK:
+            pid = vfork();
+            if (pid == 0) {
+                child_exec(&c);
+            }
+            break;
+        case SPAWN_POSIX:
+            pid = spawn_posix(&c);
+            break;
+        case SPAWN_CLONE3:
+            pid = clone3_vfork(child_exec, &c);
+            if (pid < 0 && errno == ENOSYS) {
+                // the kernel is too old for clone3
+                pid = spawn_fork(&c);
+            }
+            break;
+        case SPAWN_ZYGOTE:
+            pid = spawn_zygote(&c);
+            if (pid < 0 && errno == EPIPE) {
+                // no zygote to ask, the shell forks this one itself
+                pid = spawn_fork(&c);
+            }
+            break;
+        case SPAWN_FORK:
+        default:
+            pid = spawn_fork(&c);
+            break;
+    }
+
+    sigprocmask(SIG_SETMASK, &saved, NULL);
+    child_args_release(&c);
+
+    if (pid < 0) {
+        if (backend != SPAWN_POSIX) {
+            perror("Process creation failed");
+        }
+        return -1;
+    }
+    parent_setup(&c, pid);
+
+    return pid;
+}
+
+/* Fork a child that runs shell code */
+pid_t sh_fork(struct shell *sh, const struct spawn_attr *attr) {
+    struct child_args c;
+    child_args_init(sh, &c, NULL, NULL, attr);
+
+    // whatever is buffered belongs to the shell, the child must not write
+    // it a second time
+    fflush(NULL);
+
+    sigset_t all, saved;
+    sigfillset(&all);
+    sigprocmask(SIG_SETMASK, &all, &saved);
+    pid_t pid = fork();
+    if (pid == 0) {
+        child_setup(&c);
+        child_args_release(&c);
+        // a copy of the shell does no job control, the terminal stays with
+        // its group and every job it starts joins that group so Ctrl-C and
+        // Ctrl-Z reach them as well
+        sh->shell_is_interactive = 0;
+        sh->job_pgid = getpgrp();
+        sh->shell_terminal = STDIN_FILENO;
+        // threads do not survive fork, the parse-ahead one stays the shell's
+        sh->ahead = NULL;
+        // the loop, the zygote, the jobs and the PATH watch belong to the
+        // shell, then whatever else the shell had open goes: its pipe ends
+        // are close on exec but a copy never execs
+        loop_forget();
+        if (zygote_fd >= 0) {
+            close(zygote_fd);
+            zygote_fd = -1;
+            zygote_pid = -1;
+        }
+        jobs_forget(sh);
+        hash_unwatch();
+        close_range(3, ~0U, 0);
+        return 0;
+    }
+    sigprocmask(SIG_SETMASK, &saved, NULL);
+    child_args_release(&c);
+
+    if (pid < 0) {
+        perror("Process creation failed");
+        return -1;
+    }
+    parent_setup(&c, pid);
+
+    return pid;
+}
+
+/* Replace the shell with argv */
+int sh_exec(struct shell *sh, char **argv, const int *stdio) {
+    const char *path = hash_lookup(argv[0]);
+    if (path == NULL) {
+        fprintf(stderr, "%s: command not found\n", argv[0]);
+        return 127;
+    }
+
+    // the command takes the shell's place in its process group, the
+    // terminal already belongs to that group if it belongs to anyone
+    struct spawn_attr attr = {.pgid = getpgrp(), .foreground = false, .stdio = stdio};
+    struct child_args c;
+    child_args_init(sh, &c, argv, path, &attr);
+
+    // nothing the shell buffered may be lost and the zygote would be left
+    // behind as a child of the command
+    fflush(NULL);
+    zygote_stop();
+
+    return child_exec(&c);
+}
@@ -0,0 +1,279 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#include "lab.h"
+
+// Bytes moved per round when the data has to be copied by hand
+#define TEE_BUF_SIZE (64 * 1024)
+
+/**
+ * @brief Where tee_fds sends a copy of its input. copy is set once the
+ * descriptor has refused splice and the bytes go through a buffer.
+ */
+struct tee_out {
+    int fd;
+    bool copy;
+};
+
+/**
+ * Helper function
+ *
+ * @brief Write all of buf, false on an error.
+ */
+static bool write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+
+    return true;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Move *len bytes that are already in the pipe from to out. splice
+ * does it without touching the data. Descriptors it does not support, such
+ * as a terminal, make it fail with EINVAL before anything moved and from
+ * then on that output is copied through buf. *len is left at the number of
+ * bytes still in the pipe when the output fails.
+ */
+static bool tee_move(int from, struct tee_out *out, size_t *len, char *buf) {
+    while (*len > 0) {
+        ssize_t n;
+        if (!out->copy) {
+            n = splice(from, NULL, out->fd, NULL, *len, SPLICE_F_MOVE);
+            if (n < 0 && errno == EINVAL) {
+                out->copy = true;
+                continue;
+            }
+        } else {
+            n = read(from, buf, *len < TEE_BUF_SIZE ? *len : TEE_BUF_SIZE);
+            if (n > 0) {
+                // what was read has left the pipe even if it is not written
+                *len -= (size_t)n;
+                if (!write_all(out->fd, buf, (size_t)n)) {
+                    return false;
+                }
+                continue;
+            }
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        *len -= (size_t)n;
+    }
+
+    return true;
+}
+
+/**
+ * Helper function
+ *
+ * @brief The plain read and write loop for input that is not a pipe.
+ */
+static int tee_copy(int in, struct tee_out *outs, size_t nouts, char *buf) {
+    int status = 0;
+    ssize_t n;
+    while ((n = read(in, buf, TEE_BUF_SIZE)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("tee: read failed");
+            return -1;
+        }
+        for (size_t i = 0; i < nouts; i++) {
+            if (outs[i].fd >= 0 && !write_all(outs[i].fd, buf, (size_t)n)) {
+                perror("tee: write failed");
+                outs[i].fd = -1;
+                status = -1;
+            }
+        }
+    }
+
+    return status;
+}
+
+/**
+ * Helper function
+ *
+ * @brief Copy a pipe without reading it. Each round waits for input and
+ * asks the pipe how much it holds, tee(2) then duplicates that much into
+ * the scratch pipe once for every output but the last, which is spliced
+ * the input itself. An output that fails is dropped and what it did not
+ * take is spliced to the sink.
+ */
+static int tee_pipe(int in, struct tee_out *outs, size_t nouts, const int *scratch,
+                    struct tee_out *sink, char *buf) {
+    int status = 0;
+    struct pollfd pfd = {.fd = in, .events = POLLIN};
+    while (true) {
+        int avail = 0;
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        // nothing in the pipe after poll returned means every writer is gone
+        if (ioctl(in, FIONREAD, &avail) < 0 || avail == 0) {
+            break;
+        }
+
+        size_t last = nouts;
+        while (last > 0 && outs[last - 1].fd < 0) {
+            last--;
+        }
+        if (last-- == 0) {
+            return -1;
+        }
+
+        for (size_t i = 0; i < last; i++) {
+            if (outs[i].fd < 0) {
+                continue;
+            }
+            // the scratch pipe is as big as the input so tee takes it all
+            ssize_t n;
+            while ((n = tee(in, scratch[1], (size_t)avail, 0)) < 0 && errno == EINTR) {
+            }
+            if (n != avail) {
+                return -1;
+            }
+            size_t len = (size_t)avail;
+            if (!tee_move(scratch[0], &outs[i], &len, buf)) {
+                perror("tee: write failed");
+                outs[i].fd = -1;
+                status = -1;
+                if (!tee_move(scratch[0], sink, &len, buf)) {
+                    return -1;
+                }
+            }
+        }
+
+        size_t len = (size_t)avail;
+        if (!tee_move(in, &outs[last], &len, buf)) {
+            perror("tee: write failed");
+            outs[last].fd = -1;
+            status = -1;
+            if (!tee_move(in, sink, &len, buf)) {
+                return -1;
+            }
+        }
+    }
+
+    return status;
+}
+
+/* Copy in to every descriptor in fds */
+int tee_fds(int in, const int *fds, size_t nouts) {
+    struct tee_out *outs = calloc(nouts, sizeof(struct tee_out));
+    char *buf = malloc(TEE_BUF_SIZE);
+    if (outs == NULL || buf == NULL) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < nouts; i++) {
+        outs[i].fd = fds[i];
+    }
+    struct tee_out sink = {.fd = open("/dev/null", O_WRONLY | O_CLOEXEC)};
+
+    // tee(2) needs the input and the scratch pipe to be pipes, the scratch
+    // pipe has to hold everything the input can
+    int scratch[2] = {-1, -1};
+    struct stat st;
+    bool splice_in = sink.fd >= 0 && fstat(in, &st) == 0 && S_ISFIFO(st.st_mode);
+    if (splice_in) {
+        int size = fcntl(in, F_GETPIPE_SZ);
+        splice_in = size > 0 && pipe2(scratch, O_CLOEXEC) == 0 &&
+                    fcntl(scratch[1], F_SETPIPE_SZ, size) >= size;
+    }
+
+    int status = splice_in ? tee_pipe(in, outs, nouts, scratch, &sink, buf)
+                           : tee_copy(in, outs, nouts, buf);
+
+    for (int i = 0; i < 2; i++) {
+        if (scratch[i] >= 0) {
+            close(scratch[i]);
+        }
+    }
+    if (sink.fd >= 0) {
+        close(sink.fd);
+    }
+    free(buf);
+    free(outs);
+
+    return status;
+}
+
+/* The tee builtin */
+int tee_run(char **argv) {
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    int i = 1;
+    if (argv[i] != NULL && strcmp(argv[i], "-a") == 0) {
+        // not O_APPEND: splice(2) fails with EINVAL on a file opened with
+        // it, the file is opened at its end with lseek instead
+        flags &= ~O_TRUNC;
+        i++;
+    }
+
+    size_t nfiles = 0;
+    while (argv[i + nfiles] != NULL) {
+        nfiles++;
+    }
+    int *fds = malloc((nfiles + 1) * sizeof(int));
+    if (fds == NULL) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+
+    int status = 0;
+    size_t nouts = 0;
+    fds[nouts++] = STDOUT_FILENO;
+    for (size_t f = 0; f < nfiles; f++) {
+        const char *name = argv[i + f];
+        int fd = open(name, flags, 0666);
+        // a FIFO or a terminal has no end to seek to and appends anyway
+        if (fd < 0 || ((flags & O_TRUNC) == 0 && lseek(fd, 0, SEEK_END) < 0 && errno != ESPIPE)) {
+            fprintf(stderr, "tee: %s: %s\n", name, strerror(errno));
+            status = 1;
+            if (fd >= 0) {
+                close(fd);
+            }
+            continue;
+        }
+        fds[nouts++] = fd;
+    }
+
+    // the shell may have output of its own waiting in the stdio buffer
+    fflush(stdout);
+    if (tee_fds(STDIN_FILENO, fds, nouts) < 0) {
+        status = 1;
+    }
+
+    for (size_t f = 1; f < nouts; f++) {
+        close(fds[f]);
+    }
+    free(fds);
+
+    return status;
+}
@@ -0,0 +1,69 @@
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lab.h"
+
+/* Start buffering output for fd */
+void writer_init(struct writer *w, int fd) {
+    w->fd = fd;
+    w->len = 0;
+    w->failed = false;
+}
+
+/* Write out everything buffered */
+int writer_flush(struct writer *w) {
+    const char *p = w->buf;
+    while (w->len > 0 && !w->failed) {
+        ssize_t n = write(w->fd, p, w->len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // a closed pipe or a full disk, the rest is thrown away
+            w->failed = true;
+            break;
+        }
+        p += n;
+        w->len -= (size_t)n;
+    }
+    w->len = 0;
+
+    return w->failed ? -1 : 0;
+}
+
+/* Append formatted text */
+void writer_printf(struct writer *w, const char *fmt, ...) {
+    if (w->failed) {
+        return;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(w->buf + w->len, sizeof(w->buf) - w->len, fmt, ap);
+    va_end(ap);
+    if (n < 0) {
+        return;
+    }
+    if ((size_t)n < sizeof(w->buf) - w->len) {
+        w->len += (size_t)n;
+        return;
+    }
+
+    // it did not fit, make room and try again
+    writer_flush(w);
+    va_start(ap, fmt);
+    n = vsnprintf(w->buf, sizeof(w->buf), fmt, ap);
+    va_end(ap);
+    if (n < 0) {
+        return;
+    }
+    if ((size_t)n < sizeof(w->buf)) {
+        w->len = (size_t)n;
+        return;
+    }
+
+    // longer than the whole buffer, the text has to be cut
+    w->len = sizeof(w->buf) - 1;
+}
@@ -1,6 +1,13 @@
+#define _GNU_SOURCE
 #include <string.h>
+#include <time.h>
 #include <signal.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <readline/history.h>
 #include "harness/unity.h"
 #include "../src/lab.h"
@@ -15,10 +22,11 @@
 #define CAPTURE_OUTPUT_END() \
     fflush(stdout); \
     dup2(stdout_fd, STDOUT_FILENO); \
+    close(stdout_fd); \
     fseek(stdout_file, 0, SEEK_SET); \
     char output[1024]; \
-    fread(output, sizeof(char), sizeof(output) - 1, stdout_file); \
-    output[sizeof(output) - 1] = '\0'; \
+    size_t output_len = fread(output, sizeof(char), sizeof(output) - 1, stdout_file); \
+    output[output_len] = '\0'; \
     fclose(stdout_file);
 
 void setUp(void) {
@@ -69,6 +77,1573 @@ void test_cmd_parse(void)
   cmd_free(rval);
 }
 
+void test_cmd_parse_quoted(void)
+{
+  char **rval = cmd_parse("  echo \"hello   world\" \"\" end  ");
+  TEST_ASSERT_EQUAL_STRING("echo", rval[0]);
+  TEST_ASSERT_EQUAL_STRING("hello   world", rval[1]);
+  TEST_ASSERT_EQUAL_STRING("", rval[2]);
+  TEST_ASSERT_EQUAL_STRING("end", rval[3]);
+  TEST_ASSERT_NULL(rval[4]);
+  cmd_free(rval);
+}
+
+void test_cmd_parse_empty(void)
+{
+  char **rval = cmd_parse("");
+  TEST_ASSERT_NULL(rval[0]);
+  cmd_free(rval);
+}
+
+void test_cmd_parse_inplace(void)
+{
+  char line[] = "cp  \"a b\" c";
+  char **rval = cmd_parse_inplace(line);
+  TEST_ASSERT_EQUAL_STRING("cp", rval[0]);
+  TEST_ASSERT_EQUAL_STRING("a b", rval[1]);
+  TEST_ASSERT_EQUAL_STRING("c", rval[2]);
+  TEST_ASSERT_NULL(rval[3]);
+  // every token points into the caller's buffer
+  for (int i = 0; rval[i] != NULL; i++) {
+    TEST_ASSERT_TRUE(rval[i] >= line && rval[i] < line + sizeof(line));
+  }
+  cmd_free(rval);
+}
+
+void test_scan_impls_agree(void)
+{
+  // every byte value lands at every offset of a vector at least once
+  static const char alphabet[] = " \t\n\v\f\r\"'\\&|<>;2ab/-\x80\xa0\xff";
+  char buf[200];
+  unsigned seed = 42;
+  for (size_t i = 0; i < sizeof(buf); i++) {
+    seed = seed * 1103515245 + 12345;
+    buf[i] = alphabet[(seed >> 16) % (sizeof(alphabet) - 1)];
+  }
+
+  enum scan_impl impls[] = {SCAN_SSE2, SCAN_AVX2};
+  for (size_t k = 0; k < sizeof(impls) / sizeof(impls[0]); k++) {
+    for (size_t start = 0; start < 40; start++) {
+      for (size_t len = 0; start + len <= sizeof(buf); len += 7) {
+        const char *end = buf + start + len;
+        TEST_ASSERT_TRUE(scan_use(SCAN_SCALAR));
+        const char *expected = scan_delim(buf + start, end);
+        if (!scan_use(impls[k])) {
+          continue; // the CPU does not have this unit
+        }
+        TEST_ASSERT_EQUAL_PTR(expected, scan_delim(buf + start, end));
+      }
+    }
+  }
+  TEST_ASSERT_TRUE(scan_use(SCAN_AUTO));
+}
+
+void test_cmd_parse_long_line(void)
+{
+  // tokens that straddle vector boundaries
+  char line[1024] = "";
+  for (int i = 0; i < 40; i++) {
+    strcat(line, i % 3 ? "some/long/path/component " : "\"quoted arg\"\t");
+  }
+  char **rval = cmd_parse(line);
+  for (int i = 0; i < 40; i++) {
+    TEST_ASSERT_EQUAL_STRING(i % 3 ? "some/long/path/component" : "quoted arg", rval[i]);
+  }
+  TEST_ASSERT_NULL(rval[40]);
+  cmd_free(rval);
+}
+
+void test_cmd_parse_posix_quoting(void)
+{
+  char **rval = cmd_parse("a\"b c\"d 'it''s \"raw\"' esc\\ aped \"q\\\" \\$ \\n\"");
+  TEST_ASSERT_NOT_NULL(rval);
+  TEST_ASSERT_EQUAL_STRING("ab cd", rval[0]);
+  TEST_ASSERT_EQUAL_STRING("its \"raw\"", rval[1]);
+  TEST_ASSERT_EQUAL_STRING("esc aped", rval[2]);
+  TEST_ASSERT_EQUAL_STRING("q\" $ \\n", rval[3]);
+  TEST_ASSERT_NULL(rval[4]);
+  cmd_free(rval);
+}
+
+void test_cmd_parse_syntax_errors(void)
+{
+  // errors are reported to the caller rather than exiting the shell
+  TEST_ASSERT_NULL(cmd_parse("echo \"unterminated"));
+  TEST_ASSERT_NULL(cmd_parse("echo 'unterminated"));
+  TEST_ASSERT_NULL(cmd_parse("echo trailing\\"));
+  char line[] = "echo \"a\\\"";
+  TEST_ASSERT_NULL(cmd_parse_inplace(line));
+}
+
+void test_pcache_hit(void)
+{
+  pcache_clear();
+  char **first = cmd_parse("ls -l /tmp");
+  char **second = cmd_parse("ls -l /tmp");
+  // the second parse is served from the cache and shares the vector
+  TEST_ASSERT_EQUAL_PTR(first, second);
+  unsigned long hits, misses;
+  pcache_stats(&hits, &misses);
+  TEST_ASSERT_EQUAL(1, hits);
+  TEST_ASSERT_EQUAL(1, misses);
+  cmd_free(first);
+  // still valid, the cache and second hold their own references
+  TEST_ASSERT_EQUAL_STRING("/tmp", second[2]);
+  cmd_free(second);
+  pcache_clear();
+}
+
+void test_pcache_evicts_lru(void)
+{
+  pcache_clear();
+  char line[32];
+  char **keep = cmd_parse("echo keep");
+  for (int i = 0; i < PCACHE_ENTRIES; i++) {
+    snprintf(line, sizeof(line), "echo %d", i);
+    cmd_free(cmd_parse(line));
+  }
+  // the first line was evicted but the caller's vector is untouched
+  char **again = cmd_parse("echo keep");
+  TEST_ASSERT_TRUE(again != keep);
+  TEST_ASSERT_EQUAL_STRING("keep", keep[1]);
+  TEST_ASSERT_EQUAL_STRING("keep", again[1]);
+  cmd_free(keep);
+  cmd_free(again);
+  // the most recent line is still cached
+  snprintf(line, sizeof(line), "echo %d", PCACHE_ENTRIES - 1);
+  unsigned long hits, misses;
+  pcache_stats(&hits, &misses);
+  cmd_free(cmd_parse(line));
+  unsigned long hits_after;
+  pcache_stats(&hits_after, &misses);
+  TEST_ASSERT_EQUAL(hits + 1, hits_after);
+  pcache_clear();
+}
+
+void test_arena_alloc(void)
+{
+  struct arena *a = arena_new(64);
+  char *first = arena_alloc(a, 3, 1);
+  long *second = arena_alloc(a, sizeof(long), _Alignof(long));
+  TEST_ASSERT_NOT_NULL(first);
+  TEST_ASSERT_NOT_NULL(second);
+  TEST_ASSERT_EQUAL(0, (size_t)second % _Alignof(long));
+  TEST_ASSERT_TRUE(arena_head(first) == a);
+  // the arena never grows past its capacity
+  TEST_ASSERT_NULL(arena_alloc(a, 64, 1));
+  arena_free(a);
+}
+
+void test_argsplit_fixed(void)
+{
+  char *rm[] = {"rm", "-f", "-v", "a", "-b", NULL};
+  TEST_ASSERT_EQUAL(3, argsplit_fixed(rm));
+  char *dashdash[] = {"rm", "-f", "--", "-b", NULL};
+  TEST_ASSERT_EQUAL(3, argsplit_fixed(dashdash));
+  char *bare[] = {"ls", NULL};
+  TEST_ASSERT_EQUAL(1, argsplit_fixed(bare));
+}
+
+void test_argsplit_plan(void)
+{
+  // every argument costs 2 bytes plus a pointer
+  char *cmd[] = {"rm", "-f", "a", "b", "c", "d", "e", NULL};
+  size_t arg = 2 + sizeof(char *);
+  size_t base = sizeof(char *) + 3 + sizeof(char *) + 3 + sizeof(char *);
+  size_t ends[5];
+
+  // room for two operands per batch
+  TEST_ASSERT_EQUAL(3, argsplit_plan(cmd, 2, base + 2 * arg, ends));
+  TEST_ASSERT_EQUAL(4, ends[0]);
+  TEST_ASSERT_EQUAL(6, ends[1]);
+  TEST_ASSERT_EQUAL(7, ends[2]);
+
+  // everything fits in one
+  TEST_ASSERT_EQUAL(1, argsplit_plan(cmd, 2, base + 5 * arg, ends));
+  TEST_ASSERT_EQUAL(7, ends[0]);
+
+  // not even a single operand fits
+  TEST_ASSERT_EQUAL(0, argsplit_plan(cmd, 2, base + arg - 1, ends));
+  TEST_ASSERT_EQUAL(exec_args_size(cmd), base + 5 * arg);
+}
+
+void test_hash_lookup(void)
+{
+  char *saved = strdup(getenv("PATH"));
+  setenv("PATH", "/nonexistent:/bin:/usr/bin", 1);
+  hash_clear();
+
+  const char *first = hash_lookup("sh");
+  TEST_ASSERT_NOT_NULL(first);
+  TEST_ASSERT_EQUAL_STRING("/bin/sh", first);
+  // the second lookup is served from the table
+  TEST_ASSERT_EQUAL_PTR(first, hash_lookup("sh"));
+  TEST_ASSERT_NULL(hash_lookup("no-such-command-here"));
+  TEST_ASSERT_EQUAL_STRING("./sh", hash_lookup("./sh"));
+
+  // hash -p overrides the search
+  hash_add("sh", "/custom/sh");
+  TEST_ASSERT_EQUAL_STRING("/custom/sh", hash_lookup("sh"));
+
+  // changing PATH forgets everything
+  setenv("PATH", "/usr/bin:/bin", 1);
+  const char *again = hash_lookup("sh");
+  TEST_ASSERT_NOT_NULL(again);
+  TEST_ASSERT_NOT_EQUAL(0, strcmp("/custom/sh", again));
+
+  setenv("PATH", saved, 1);
+  free(saved);
+  hash_clear();
+}
+
+void test_hash_relative(void)
+{
+  char *saved = strdup(getenv("PATH"));
+  char cwd[PATH_MAX];
+  TEST_ASSERT_NOT_NULL(getcwd(cwd, sizeof(cwd)));
+  char dir[] = "/tmp/test-lab-XXXXXX";
+  TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+  TEST_ASSERT_EQUAL(0, chdir(dir));
+  setenv("PATH", "rel:/bin", 1);
+  hash_clear();
+
+  // rel does not exist here, the match in /bin must not be remembered
+  TEST_ASSERT_EQUAL_STRING("/bin/sh", hash_lookup("sh"));
+  TEST_ASSERT_EQUAL(0, mkdir("rel", 0755));
+  FILE *f = fopen("rel/sh", "w");
+  fputs("#!/bin/sh\n", f);
+  fclose(f);
+  chmod("rel/sh", 0755);
+  TEST_ASSERT_EQUAL_STRING("rel/sh", hash_lookup("sh"));
+
+  unlink("rel/sh");
+  rmdir("rel");
+  TEST_ASSERT_EQUAL(0, chdir(cwd));
+  rmdir(dir);
+  setenv("PATH", saved, 1);
+  free(saved);
+  hash_clear();
+}
+
+void test_hash_inotify(void)
+{
+  char *saved = strdup(getenv("PATH"));
+  char dir[] = "/tmp/test-lab-XXXXXX";
+  TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+  setenv("PATH", dir, 1);
+  hash_clear();
+
+  // the miss is remembered, the directory is watched
+  TEST_ASSERT_NULL(hash_lookup("freshcmd"));
+  TEST_ASSERT_TRUE(hash_watch_fd() >= 0);
+
+  char file[64];
+  snprintf(file, sizeof(file), "%s/freshcmd", dir);
+  FILE *f = fopen(file, "w");
+  fputs("#!/bin/sh\n", f);
+  fclose(f);
+  chmod(file, 0755);
+
+  // the events forget the miss
+  hash_drain();
+  TEST_ASSERT_EQUAL_STRING(file, hash_lookup("freshcmd"));
+
+  // and removing the file forgets the hit
+  unlink(file);
+  hash_drain();
+  TEST_ASSERT_NULL(hash_lookup("freshcmd"));
+
+  rmdir(dir);
+  hash_drain();
+  setenv("PATH", saved, 1);
+  free(saved);
+  hash_clear();
+}
+
+void test_builtin_hash(void)
+{
+  struct shell sh;
+  sh_init(&sh);
+  char **cmd = cmd_parse("hash -r");
+  TEST_ASSERT_TRUE(do_builtin(&sh, cmd));
+  cmd_free(cmd);
+  fflush(stdout);
+  CAPTURE_OUTPUT_START();
+  cmd = cmd_parse("hash");
+  TEST_ASSERT_TRUE(do_builtin(&sh, cmd));
+  CAPTURE_OUTPUT_END();
+  TEST_ASSERT_EQUAL_STRING("hash: hash table empty\n", output);
+  cmd_free(cmd);
+  sh_destroy(&sh);
+}
+
+void test_spawn_backend_names(void)
+{
+  TEST_ASSERT_EQUAL(SPAWN_FORK, spawn_backend_parse("fork"));
+  TEST_ASSERT_EQUAL(SPAWN_VFORK, spawn_backend_parse("vfork"));
+  TEST_ASSERT_EQUAL(SPAWN_POSIX, spawn_backend_parse("posix_spawn"));
+  TEST_ASSERT_EQUAL(SPAWN_CLONE3, spawn_backend_parse("clone3"));
+  TEST_ASSERT_EQUAL(-1, spawn_backend_parse("rfork"));
+  TEST_ASSERT_EQUAL(SPAWN_ZYGOTE, spawn_backend_parse("zygote"));
+  TEST_ASSERT_EQUAL_STRING("clone3", spawn_backend_name(SPAWN_CLONE3));
+}
+
+void test_spawn_backends(void)
+{
+  struct shell sh;
+  sh_init(&sh);
+  char **ok = cmd_parse("sh -c 'exit 3'");
+  char **missing = cmd_parse("no-such-command-here");
+  struct spawn_attr attr = {.pgid = 0, .foreground = false};
+
+  // every backend runs the command in its own process group
+  for (int b = SPAWN_FORK; b <= SPAWN_ZYGOTE; b++) {
+    sh.spawn = (enum spawn_backend)b;
+    pid_t pid = sh_spawn(&sh, ok, &attr);
+    TEST_ASSERT_TRUE_MESSAGE(pid > 0, spawn_backend_name(sh.spawn));
+    TEST_ASSERT_EQUAL(pid, getpgid(pid));
+    int status;
+    TEST_ASSERT_EQUAL(pid, waitpid(pid, &status, 0));
+    TEST_ASSERT_TRUE(WIFEXITED(status));
+    TEST_ASSERT_EQUAL_MESSAGE(3, WEXITSTATUS(status), spawn_backend_name(sh.spawn));
+
+    // nothing is started for a command that is not there
+    TEST_ASSERT_EQUAL(-1, sh_spawn(&sh, missing, &attr));
+  }
+
+  cmd_free(ok);
+  cmd_free(missing);
+  sh_destroy(&sh);
+  hash_clear();
+}
+
+void test_spawn_zygote_inherits(void)
+{
+  struct shell sh;
+  sh_init(&sh);
+  sh.spawn = SPAWN_ZYGOTE;
+  TEST_ASSERT_EQUAL(0, zygote_start());
+  char *cwd = getcwd(NULL, 0);
+  TEST_ASSERT_EQUAL(0, chdir("/tmp"));
+  setenv("ZYGOTE_TEST", "from-shell", 1);
+
+  // the zygote was started elsewhere but the child sees the shell as it is
+  // now: working directory, environment and stdout
+  char **cmd = cmd_parse("sh -c 'echo $PWD $ZYGOTE_TEST'");
+  struct spawn_attr attr = {.pgid = 0, .foreground = false};
+  fflush(stdout);
+  CAPTURE_OUTPUT_START();
+  pid_t pid = sh_spawn(&sh, cmd, &attr);
+  waitpid(pid, NULL, 0);
+  CAPTURE_OUTPUT_END();
+  TEST_ASSERT_TRUE(pid > 0);
+  TEST_ASSERT_EQUAL_STRING("/tmp from-shell\n", output);
+
+  // killing the zygote falls back to fork and the next spawn restarts it
+  zygote_stop();
+  pid = sh_spawn(&sh, cmd, &attr);
+  TEST_ASSERT_TRUE(pid > 0);
+  waitpid(pid, NULL, 0);
+
+  unsetenv("ZYGOTE_TEST");
+  TEST_ASSERT_EQUAL(0, chdir(cwd));
+  free(cwd);
+  cmd_free(cmd);
+  sh_destroy(&sh);
+  hash_clear();
+}
+
+void test_cmd_parse_operators(void)
+{
+  char **cmd = cmd_parse("sleep 10&");
+  TEST_ASSERT_EQUAL_STRING("sleep", cmd[0]);
+  TEST_ASSERT_EQUAL_STRING("10", cmd[1]);
+  TEST_ASSERT_EQUAL(OP_BG, cmd_op(cmd[2]));
+  TEST_ASSERT_EQUAL(OP_NONE, cmd_op(cmd[1]));
+  TEST_ASSERT_NULL(cmd[3]);
+  cmd_free(cmd);
+
+  // quoted and escaped operators are words
+  cmd = cmd_parse("echo '&' \"&\" \\&");
+  for (int i = 1; i <= 3; i++) {
+    TEST_ASSERT_EQUAL_STRING("&", cmd[i]);
+    TEST_ASSERT_EQUAL(OP_NONE, cmd_op(cmd[i]));
+  }
+  cmd_free(cmd);
+
+  // no space is needed around an operator, every byte can be a token
+  char line[] = "a&b&c";
+  cmd = cmd_parse_inplace(line);
+  TEST_ASSERT_EQUAL_STRING("a", cmd[0]);
+  TEST_ASSERT_EQUAL(OP_BG, cmd_op(cmd[1]));
+  TEST_ASSERT_EQUAL_STRING("b", cmd[2]);
+  TEST_ASSERT_EQUAL(OP_BG, cmd_op(cmd[3]));
+  TEST_ASSERT_EQUAL_STRING("c", cmd[4]);
+  TEST_ASSERT_NULL(cmd[5]);
+  cmd_free(cmd);
+
+  // a 2 only names stderr at the start of a token
+  cmd = cmd_parse("cat<in>out 2>err 2>&1>>log a2>b");
+  const char *words[] = {"cat", "<", "in", ">", "out", "2>", "err", "2>&1", ">>", "log",
+                         "a2", ">", "b"};
+  enum cmd_op ops[] = {OP_NONE, OP_IN, OP_NONE, OP_OUT, OP_NONE, OP_ERR, OP_NONE, OP_ERR_OUT,
+                       OP_APPEND, OP_NONE, OP_NONE, OP_OUT, OP_NONE};
+  for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+    TEST_ASSERT_EQUAL_STRING(words[i], cmd[i]);
+    TEST_ASSERT_EQUAL(ops[i], cmd_op(cmd[i]));
+  }
+  TEST_ASSERT_NULL(cmd[sizeof(words) / sizeof(words[0])]);
+  cmd_free(cmd);
+
+  // list operators, the longest operator wins
+  cmd = cmd_parse("a;b&&c||d|e&f");
+  const char *list_words[] = {"a", ";", "b", "&&", "c", "||", "d", "|", "e", "&", "f"};
+  enum cmd_op list_ops[] = {OP_NONE, OP_SEQ, OP_NONE, OP_AND, OP_NONE, OP_OR, OP_NONE, OP_PIPE,
+                            OP_NONE, OP_BG, OP_NONE};
+  for (size_t i = 0; i < sizeof(list_words) / sizeof(list_words[0]); i++) {
+    TEST_ASSERT_EQUAL_STRING(list_words[i], cmd[i]);
+    TEST_ASSERT_EQUAL(list_ops[i], cmd_op(cmd[i]));
+  }
+  cmd_free(cmd);
+
+  cmd = cmd_parse("ls|wc -l '|'");
+  TEST_ASSERT_EQUAL_STRING("ls", cmd[0]);
+  TEST_ASSERT_EQUAL(OP_PIPE, cmd_op(cmd[1]));
+  TEST_ASSERT_EQUAL_STRING("wc", cmd[2]);
+  TEST_ASSERT_EQUAL(OP_NONE, cmd_op(cmd[4]));
+  cmd_free(cmd);
+}
+
+/**
+ * @brief Poll the job table until job id has stopped or finished.
+ */
+static struct job *wait_job_state(struct shell *sh, int id, enum job_state state)
+{
+  char spec[16];
+  snprintf(spec, sizeof(spec), "%%%d", id);
+  for (int i = 0; i < 500; i++) {
+    jobs_update(sh);
+    struct job *job = job_find(sh, spec);
+    if (job == NULL || job->state == state) {
+      return job;
+    }
+    usleep(10000);
+  }
+  return NULL;
+}
+
+void test_list_compile(void)
+{
+  char **cmd = cmd_parse("a 1 | b > f; c && d || e; f &");
+  struct cmd_list *list = list_compile(cmd);
+  cmd_free(cmd);
+  TEST_ASSERT_NOT_NULL(list);
+  TEST_ASSERT_EQUAL(5, list->n);
+  enum list_cond conds[] = {LIST_ALWAYS, LIST_ALWAYS, LIST_IF_OK, LIST_IF_FAIL, LIST_ALWAYS};
+  const char *firsts[] = {"a", "c", "d", "e", "f"};
+  for (size_t i = 0; i < list->n; i++) {
+    TEST_ASSERT_EQUAL(conds[i], list->insn[i].cond);
+    TEST_ASSERT_EQUAL_STRING(firsts[i], list->insn[i].argv[0]);
+  }
+  // pipes and redirections stay with their command
+  TEST_ASSERT_EQUAL(OP_PIPE, cmd_op(list->insn[0].argv[2]));
+  TEST_ASSERT_EQUAL_STRING("f", list->insn[0].argv[5]);
+  TEST_ASSERT_NULL(list->insn[0].argv[6]);
+  TEST_ASSERT_NULL(list->insn[1].argv[1]);
+  TEST_ASSERT_FALSE(list->insn[2].background);
+  TEST_ASSERT_FALSE(list->insn[3].background);
+  TEST_ASSERT_TRUE(list->insn[4].background);
+  list_free(list);
+
+  const char *bad[] = {"; a", "a ;; b", "a &&", "a || ", "&& a", "a | ; b", "a > ; b",
+                       "a && b &", "a | &&"};
+  for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    cmd = cmd_parse(bad[i]);
+    TEST_ASSERT_NULL_MESSAGE(list_compile(cmd), bad[i]);
+    cmd_free(cmd);
+  }
+}
+
+/**
+ * Helper function
+ *
+ * @brief A list command that records the name it was given and fails when
+ * the name starts with f.
+ */
+static int record_command(struct shell *sh, char **argv, bool background, void *arg)
+{
+  UNUSED(sh);
+  UNUSED(background);
+  strcat(arg, argv[0]);
+  return argv[0][0] == 'f';
+}
+
+void test_list_run(void)
+{
+  // which commands run, a skipped one leaves the status alone
+  const char *lines[] = {"t1 && t2 || t3", "f1 && t2 || t3", "f1 || f2 && t3",
+                         "t1 || t2 && t3", "f1 ; t2 && t3", "f1 || f2 || f3 ; t4"};
+  const char *ran[] = {"t1t2", "f1t3", "f1f2", "t1t3", "f1t2t3", "f1f2f3t4"};
+  int status[] = {0, 0, 1, 0, 0, 0};
+  for (size_t i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+    char trace[64] = "";
+    char **cmd = cmd_parse(lines[i]);
+    struct cmd_list *list = list_compile(cmd);
+    cmd_free(cmd);
+    TEST_ASSERT_EQUAL_MESSAGE(status[i], list_run(NULL, list, record_command, trace), lines[i]);
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(ran[i], trace, lines[i]);
+    list_free(list);
+  }
+}
+
+void test_argsplit_limit(void)
+{
+  // negative or garbled values leave splitting off, large ones are capped
+  const char *values[] = {"3", "-1", "4x", "100000"};
+  int want[] = {3, 0, 0, ARGSPLIT_MAX_JOBS};
+  for (size_t i = 0; i < 4; i++) {
+    setenv("MY_ARGSPLIT", values[i], 1);
+    struct shell sh;
+    sh_init(&sh);
+    TEST_ASSERT_EQUAL_MESSAGE(want[i], sh.argsplit, values[i]);
+    sh_destroy(&sh);
+  }
+  unsetenv("MY_ARGSPLIT");
+}
+
+/**
+ * Helper function
+ *
+ * @brief A list command run the way the shell runs it: split when it does
+ * not fit in ARG_MAX, as a job otherwise. The name goes in the trace.
+ */
+static int split_command(struct shell *sh, char **argv, bool background, void *arg)
+{
+  strcat(arg, argv[0]);
+  int status = argsplit_run(sh, argv, argv[0]);
+  return status >= 0 ? status : job_run(sh, argv, argv[0], background);
+}
+
+void test_list_run_split(void)
+{
+  struct shell sh;
+  sh_init(&sh);
+  sh.argsplit = 2;
+  // a command that fits is left to the caller
+  TEST_ASSERT_EQUAL(-1, argsplit_run(&sh, (char *[]){"false", "0", NULL}, "false 0"));
+
+  // enough operands for two or three batches, each of them fails
+  size_t words = sysconf(_SC_ARG_MAX) / (2 + sizeof(char *)) + 1000;
+  const char *tails[] = {" && true", " || true"};
+  const char *ran[] = {"false", "falsetrue"};
+  int status[] = {1, 0};
+  for (size_t i = 0; i < 2; i++) {
+    char *line = malloc(strlen("false") + 2 * words + strlen(tails[i]) + 1);
+    TEST_ASSERT_NOT_NULL(line);
+    char *p = stpcpy(line, "false");
+    for (size_t w = 0; w < words; w++) {
+      p = stpcpy(p, " 0");
+    }
+    strcpy(p, tails[i]);
+
+    char trace[64] = "";
+    char **cmd = cmd_parse(line);
+    struct cmd_list *list = list_compile(cmd);
+    cmd_free(cmd);
+    TEST_ASSERT_NOT_NULL(list);
+    TEST_ASSERT_EQUAL_MESSAGE(status[i], list_run(&sh, list, split_command, trace), tails[i]);
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(ran[i], trace, tails[i]);
+    list_free(list);
+    free(line);
+  }
+  TEST_ASSERT_NULL(sh.jobs);
+  sh_destroy(&sh);
+}
+
+void test_job_foreground(void)
+{
+  struct shell sh;
+  sh_init(&sh);
+  char **cmd = cmd_parse("sh -c 'exit 3'");
+  TEST_ASSERT_EQUAL(3, job_run(&sh, cmd, "sh -c 'exit 3'", false));
+  // a finished foreground job leaves nothing behind
+  TEST_ASSERT_NULL(sh.jobs);
+  cmd_free(cmd);
+
+  cmd = cmd_parse("no-such-command-here");
+  TEST_ASSERT_EQUAL(-1, job_run(&sh, cmd, "no-such-command-here", false));
+  TEST_ASSERT_NULL(sh.jobs);
+  cmd_free(cmd);
+  sh_destroy(&sh);
+}
+
+void test_job_background(void)
+{
+  struct shell sh;
+  sh_init(&sh);
+  char **cmd = cmd_parse("sh -c 'exit 2'");
+  TEST_ASSERT_EQUAL(0, job_run(&sh, cmd, "sh -c 'exit 2' &", true));
+  struct job *job = job_find(&sh, NULL);
+  TEST_ASSERT_NOT_NULL(job);
+  TEST_ASSERT_EQUAL(1, job->id);
+  TEST_ASSERT_EQUAL_PTR(job, job_find(&sh, "%1"));
+  TEST_ASSERT_NULL(job_find(&sh, "%2"));
+  TEST_ASSERT_NULL(job_find(&sh, "%x"));
+
+  TEST_ASSERT_EQUAL_PTR(job, wait_job_state(&sh, 1, JOB_DONE));
+  fflush(stdout);
+  CAPTURE_OUTPUT_START();
+  jobs_print(&sh);
+  CAPTURE_OUTPUT_END();
+  TEST_ASSERT_EQUAL_STRING("[1]+  Exit 2                  sh -c 'exit 2' &\n", output);
+
+  // once shown the finished job is dropped
+  jobs_notify(&sh);
+  TEST_ASSERT_NULL(sh.jobs);
+  cmd_free(cmd);
+  sh_destroy(&sh);
+}
+
+void test_builtin_fg(void)
+{
+  struct shell sh;
+  sh_init(&sh);
+  // the job stops itself, fg continues it and collects its status
+  char **cmd = cmd_parse("sh -c 'kill -STOP $$; exit 4'");
+  TEST_ASSERT_EQUAL(0, job_run(&sh, cmd, "stopper", true));
+  TEST_ASSERT_NOT_NULL(wait_job_state(&sh, 1, JOB_STOPPED));
+  cmd_free(cmd);
+
+  cmd = cmd_parse("fg %1");
+  fflush(stdout);
+  CAPTURE_OUTPUT_START();
+  TEST_ASSERT_TRUE(do_builtin(&sh, cmd));
+  CAPTURE_OUTPUT_END();
+  TEST_ASSERT_EQUAL_STRING("stopper\n", output);
+  TEST_ASSERT_NULL(sh.jobs);
+  cmd_free(cmd);
+  sh_destroy(&sh);
+}
+
+static int loop_calls[4];
+
+static void loop_test_fd(struct shell *sh, int fd, void *arg)
+{
+  UNUSED(sh);
+  char c;
+  TEST_ASSERT_EQUAL(1, read(fd, &c, 1));
+  *(int *)arg += 1;
+}
+
+static void loop_test_timer(struct shell *sh, void *arg)
+{
+  UNUSED(sh);
+  // record the order the timers fired in
+  static int fired;
+  loop_calls[(intptr_t)arg] = ++fired;
+}
+
+static void loop_test_signal(struct shell *sh, int signo)
+{
+  UNUSED(sh);
+  TEST_ASSERT_EQUAL(SIGUSR1, signo);
+  loop_calls[0]++;
+}
+
+void test_loop_events(void)
+{
+  struct shell sh;
+  sh_init(&sh);
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGUSR1);
+  TEST_ASSERT_EQUAL(0, loop_init(&signals));
+  TEST_ASSERT_TRUE(loop_active());
+  memset(loop_calls, 0, sizeof(loop_calls));
+
+  // input on a watched descriptor
+  int fds[2];
+  TEST_ASSERT_EQUAL(0, pipe(fds));
+  int reads = 0;
+  TEST_ASSERT_EQUAL(0, loop_add_fd(fds[0], loop_test_fd, &reads));
+  TEST_ASSERT_EQUAL(1, write(fds[1], "x", 1));
+  loop_once(&sh);
+  TEST_ASSERT_EQUAL(1, reads);
+
+  // a paused descriptor does not wake the loop, a timer bounds the wait
+  loop_enable_fd(fds[0], false);
+  TEST_ASSERT_EQUAL(1, write(fds[1], "y", 1));
+  loop_timer(20, loop_test_timer, (void *)1);
+  loop_timer(10, loop_test_timer, (void *)2);
+  loop_cancel(loop_timer(5, loop_test_timer, (void *)3));
+  while (loop_calls[1] == 0) {
+    loop_once(&sh);
+  }
+  TEST_ASSERT_EQUAL(1, reads);
+  TEST_ASSERT_TRUE(loop_calls[2] < loop_calls[1]);
+  TEST_ASSERT_EQUAL(0, loop_calls[3]);
+  loop_enable_fd(fds[0], true);
+  loop_once(&sh);
+  TEST_ASSERT_EQUAL(2, reads);
+
+  // a blocked signal is handled from the loop
+  loop_on_signal(SIGUSR1, loop_test_signal);
+  raise(SIGUSR1);
+  loop_once(&sh);
+  TEST_ASSERT_EQUAL(1, loop_calls[0]);
+
+  loop_destroy();
+  TEST_ASSERT_FALSE(loop_active());
+  close(fds[0]);
+  close(fds[1]);
+  sh_destroy(&sh);
+}
+
+void test_job_foreground_loop(void)
+{
+  struct shell sh;
+  sh_init(&sh);
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGCHLD);
+  TEST_ASSERT_EQUAL(0, loop_init(&signals));
+  memset(loop_calls, 0, sizeof(loop_calls));
+
+  // the shell keeps serving timers while the foreground job runs and the
+  // job is collected through SIGCHLD
+  loop_timer(10, loop_test_timer, (void *)1);
+  char **cmd = cmd_parse("sh -c 'sleep 0.1; exit 5'");
+  TEST_ASSERT_EQUAL(5, job_run(&sh, cmd, "slow", false));
+  TEST_ASSERT_NOT_EQUAL(0, loop_calls[1]);
+  TEST_ASSERT_NULL(sh.jobs);
+
+  cmd_free(cmd);
+  loop_destroy();
+  sh_destroy(&sh);
+}
+
+void test_job_pidfd(void)
+{
+  struct shell sh;
+  sh_init(&sh);
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGCHLD);
+  TEST_ASSERT_EQUAL(0, loop_init(&signals));
+
+  // nobody handles SIGCHLD, the exit is seen through the pidfd alone
+  char **cmd = cmd_parse("sh -c 'exit 6'");
+  struct job *job = job_start(&sh, cmd, "pidfd", true);
+  TEST_ASSERT_NOT_NULL(job);
+  TEST_ASSERT_TRUE(job->procs[0].pidfd >= 0);
+  for (int i = 0; i < 100 && job->state != JOB_DONE; i++) {
+    loop_once(&sh);
+  }
+  TEST_ASSERT_EQUAL(JOB_DONE, job->state);
+  TEST_ASSERT_EQUAL(-1, job->procs[0].pidfd);
+  TEST_ASSERT_EQUAL(6, WEXITSTATUS(job->procs[0].status));
+  TEST_ASSERT_TRUE(jobs_update(&sh));
+
+  cmd_free(cmd);
+  loop_destroy();
+  sh_destroy(&sh);
+}
+
+void test_job_timeout(void)
+{
+  struct shell sh;
+  sh_init(&sh);
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGCHLD);
+  TEST_ASSERT_EQUAL(0, loop_init(&signals));
+  time_t start = time(NULL);
+
+  // SIGTERM is enough
+  char **cmd = cmd_parse("sleep 5");
+  struct job *job = job_start(&sh, cmd, "sleep 5", false);
+  TEST_ASSERT_EQUAL(0, job_timeout(&sh, job, 50, 5000));
+  TEST_ASSERT_EQUAL(124, job_foreground(&sh, job, false));
+  cmd_free(cmd);
+
+  // SIGTERM is ignored, SIGKILL follows
+  cmd = cmd_parse("sh -c 'trap \"\" TERM; sleep 5'");
+  job = job_start(&sh, cmd, "stubborn", false);
+  TEST_ASSERT_EQUAL(0, job_timeout(&sh, job, 50, 50));
+  TEST_ASSERT_EQUAL(137, job_foreground(&sh, job, false));
+  cmd_free(cmd);
+
+  // a job that finishes in time keeps its own status
+  cmd = cmd_parse("sh -c 'exit 7'");
+  job = job_start(&sh, cmd, "quick", false);
+  TEST_ASSERT_EQUAL(0, job_timeout(&sh, job, 5000, 5000));
+  TEST_ASSERT_EQUAL(7, job_foreground(&sh, job, false));
+  cmd_free(cmd);
+
+  TEST_ASSERT_TRUE(time(NULL) - start < 4);
+  TEST_ASSERT_NULL(sh.jobs);
+  loop_destroy();
+  sh_destroy(&sh);
+}
+
+void test_spawn_stdio(void)
+{
+  struct shell sh;
+  sh_init(&sh);
+  char *argv[] = {"echo", "through the pipe", NULL};
+  for (int b = SPAWN_FORK; b <= SPAWN_ZYGOTE; b++) {
+    sh.spawn = (enum spawn_backend)b;
+    int fds[2];
+    TEST_ASSERT_EQUAL(0, pipe2(fds, O_CLOEXEC));
+    int stdio[3] = {STDIN_FILENO, fds[1], STDERR_FILENO};
+    struct spawn_attr attr = {.pgid = 0, .foreground = false, .stdio = stdio};
+    pid_t pid = sh_spawn(&sh, argv, &attr);
+    TEST_ASSERT_TRUE(pid > 0);
+    close(fds[1]);
+
+    // the read end sees end of file once echo exits, nobody else holds
+    // the write end
+    char buf[64] = {0};
+    size_t len = 0;
+    ssize_t n;
+    while ((n = read(fds[0], buf + len, sizeof(buf) - 1 - len)) > 0) {
+      len += (size_t)n;
+    }
+    close(fds[0]);
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("through the pipe\n", buf, spawn_backend_name(sh.spawn));
+    waitpid(pid, NULL, 0);
+  }
+  sh_destroy(&sh);
+}
+
+void test_job_pipeline(void)
+{
+  struct shell sh;
+  sh_init(&sh);
+
+  // the status is the last stage's
+  const char *lines[] = {
+    "echo hello | tr a-z A-Z | grep -q HELLO",
+    "echo hello | grep -q nope",
+    "false | true",
+    "true | sh -c 'exit 5'",
+    "no-such-command-here | true",
+    "true | no-such-command-here",
+  };
+  int expected[] = {0, 1, 0, 5, 0, 127};
+  for (size_t i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+    char **cmd = cmd_parse(lines[i]);
+    TEST_ASSERT_EQUAL_MESSAGE(expected[i], job_run(&sh, cmd, lines[i], false), lines[i]);
+    TEST_ASSERT_NULL(sh.jobs);
+    cmd_free(cmd);
+  }
+
+  // every stage runs at the same time in the same process group
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  char **cmd = cmd_parse("sleep 0.3 | sleep 0.3 | sleep 0.3");
+  struct job *job = job_start(&sh, cmd, "sleeps", true);
+  TEST_ASSERT_EQUAL(3, job->nprocs);
+  for (size_t i = 0; i < job->nprocs; i++) {
+    TEST_ASSERT_EQUAL(job->pgid, getpgid(job->procs[i].pid));
+  }
+  TEST_ASSERT_EQUAL(0, job_foreground(&sh, job, false));
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double elapsed = (double)(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  TEST_ASSERT_TRUE(elapsed < 0.8);
+  cmd_free(cmd);
+
+  sh_destroy(&sh);
+}
+
+/**
+ * Read everything left in fd from its start.
+ */
+static size_t read_back(int fd, char *buf, size_t size)
+{
+  size_t len = 0;
+  ssize_t n;
+  lseek(fd, 0, SEEK_SET);
+  while (len < size && (n = read(fd, buf + len, size - len)) > 0) {
+    len += (size_t)n;
+  }
+  return len;
+}
+
+void test_tee_fds(void)
+{
+  static char data[20000];
+  for (size_t i = 0; i < sizeof(data); i++) {
+    data[i] = (char)('a' + i % 26);
+  }
+  static char buf[sizeof(data) + 1];
+
+  // a pipe in goes through tee(2) and splice(2), to a pipe and a file
+  int in[2], out[2];
+  TEST_ASSERT_EQUAL(0, pipe2(in, O_CLOEXEC));
+  TEST_ASSERT_EQUAL(0, pipe2(out, O_CLOEXEC));
+  TEST_ASSERT_EQUAL(sizeof(data), write(in[1], data, sizeof(data)));
+  close(in[1]);
+  FILE *file = tmpfile();
+  int fds[] = {out[1], fileno(file)};
+  TEST_ASSERT_EQUAL(0, tee_fds(in[0], fds, 2));
+  close(in[0]);
+  close(out[1]);
+  TEST_ASSERT_EQUAL(sizeof(data), read_back(out[0], buf, sizeof(buf)));
+  TEST_ASSERT_EQUAL_MEMORY(data, buf, sizeof(data));
+  TEST_ASSERT_EQUAL(sizeof(data), read_back(fileno(file), buf, sizeof(buf)));
+  TEST_ASSERT_EQUAL_MEMORY(data, buf, sizeof(data));
+  close(out[0]);
+
+  // a file in is copied by hand
+  FILE *copy = tmpfile();
+  lseek(fileno(file), 0, SEEK_SET);
+  int one[] = {fileno(copy)};
+  TEST_ASSERT_EQUAL(0, tee_fds(fileno(file), one, 1));
+  TEST_ASSERT_EQUAL(sizeof(data), read_back(fileno(copy), buf, sizeof(buf)));
+  TEST_ASSERT_EQUAL_MEMORY(data, buf, sizeof(data));
+  fclose(copy);
+  fclose(file);
+}
+
+void test_tee_pipeline(void)
+{
+  struct shell sh;
+  sh_init(&sh);
+  sh.pipe_size = 1 << 20;
+  char first[] = "/tmp/test-tee-XXXXXX";
+  char second[] = "/tmp/test-tee-XXXXXX";
+  int fd1 = mkstemp(first);
+  int fd2 = mkstemp(second);
+
+  // a builtin stage runs in a copy of the shell, -a appends
+  TEST_ASSERT_EQUAL(3, write(fd2, "0\n\n", 3));
+  char line[128];
+  snprintf(line, sizeof(line), "seq 1000 | tee %s | tee -a %s | sh -c 'cat > /dev/null'",
+           first, second);
+  char **cmd = cmd_parse(line);
+  TEST_ASSERT_EQUAL(0, job_run(&sh, cmd, line, false));
+  cmd_free(cmd);
+
+  static char buf[8192];
+  TEST_ASSERT_EQUAL(3893, read_back(fd1, buf, sizeof(buf)));
+  TEST_ASSERT_EQUAL(3 + 3893, read_back(fd2, buf, sizeof(buf)));
+  TEST_ASSERT_EQUAL_MEMORY("0\n\n1\n2\n", buf, 7);
+  close(fd1);
+  close(fd2);
+  unlink(first);
+  unlink(second);
+  sh_destroy(&sh);
+}
+
+void test_tee_append_fifo(void)
+{
+  struct shell sh;
+  sh_init(&sh);
+  char dir[] = "/tmp/test-tee-XXXXXX";
+  TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+  char fifo[64];
+  snprintf(fifo, sizeof(fifo), "%s/fifo", dir);
+  TEST_ASSERT_EQUAL(0, mkfifo(fifo, 0600));
+  // held open so tee can open the FIFO without waiting for a reader
+  int rd = open(fifo, O_RDONLY | O_NONBLOCK);
+  TEST_ASSERT_TRUE(rd >= 0);
+
+  // a FIFO can not seek to its end, tee -a writes to it anyway
+  char line[128];
+  snprintf(line, sizeof(line), "echo hello | tee -a %s > /dev/null", fifo);
+  char **cmd = cmd_parse(line);
+  TEST_ASSERT_EQUAL(0, job_run(&sh, cmd, line, false));
+  cmd_free(cmd);
+
+  char buf[16];
+  TEST_ASSERT_EQUAL(6, read(rd, buf, sizeof(buf)));
+  TEST_ASSERT_EQUAL_MEMORY("hello\n", buf, 6);
+  close(rd);
+  unlink(fifo);
+  rmdir(dir);
+  sh_destroy(&sh);
+}
+
+/**
+ * Parse and run line in the foreground.
+ */
+static int run_job(struct shell *sh, const char *line)
+{
+  char **cmd = cmd_parse(line);
+  int status = job_run(sh, cmd, line, false);
+  cmd_free(cmd);
+  return status;
+}
+
+void test_job_redirect(void)
+{
+  struct shell sh;
+  sh_init(&sh);
+  char path[] = "/tmp/test-redirect-XXXXXX";
+  int fd = mkstemp(path);
+  char line[256];
+  static char buf[256];
+
+  snprintf(line, sizeof(line), "echo one > %s", path);
+  TEST_ASSERT_EQUAL(0, run_job(&sh, line));
+  snprintf(line, sizeof(line), "echo two >> %s", path);
+  TEST_ASSERT_EQUAL(0, run_job(&sh, line));
+  snprintf(line, sizeof(line), "grep -q two < %s", path);
+  TEST_ASSERT_EQUAL(0, run_job(&sh, line));
+  TEST_ASSERT_EQUAL(8, read_back(fd, buf, sizeof(buf)));
+  TEST_ASSERT_EQUAL_MEMORY("one\ntwo\n", buf, 8);
+
+  // 2>&1 copies stdout as it is at that point, left to right
+  snprintf(line, sizeof(line), "sh -c 'echo out; echo err >&2' > %s 2>&1", path);
+  TEST_ASSERT_EQUAL(0, run_job(&sh, line));
+  TEST_ASSERT_EQUAL(8, read_back(fd, buf, sizeof(buf)));
+  snprintf(line, sizeof(line), "sh -c 'echo err >&2' 2>&1 > %s | grep -q err", path);
+  TEST_ASSERT_EQUAL(0, run_job(&sh, line));
+  TEST_ASSERT_EQUAL(0, read_back(fd, buf, sizeof(buf)));
+  snprintf(line, sizeof(line), "sh -c 'echo err >&2' 2> %s", path);
+  TEST_ASSERT_EQUAL(0, run_job(&sh, line));
+  TEST_ASSERT_EQUAL(4, read_back(fd, buf, sizeof(buf)));
+
+  // a file that can not be opened fails the stage, not the shell
+  TEST_ASSERT_EQUAL(-1, run_job(&sh, "true < /no/such/file"));
+  TEST_ASSERT_EQUAL(1, run_job(&sh, "true | true > /no/such/file"));
+  TEST_ASSERT_NULL(sh.jobs);
+
+  close(fd);
+  unlink(path);
+  sh_destroy(&sh);
+}
+
+void test_spawn_closes_fds(void)
+{
+  struct shell sh;
+  sh_init(&sh);
+  // a descriptor opened without O_CLOEXEC must not reach the command
+  int stray = dup(STDOUT_FILENO);
+  char check[64];
+  snprintf(check, sizeof(check), "test -e /proc/self/fd/%d", stray);
+  char *argv[] = {"sh", "-c", check, NULL};
+  for (int b = SPAWN_FORK; b <= SPAWN_ZYGOTE; b++) {
+    sh.spawn = (enum spawn_backend)b;
+    struct spawn_attr attr = {.pgid = 0, .foreground = false};
+    pid_t pid = sh_spawn(&sh, argv, &attr);
+    int status;
+    waitpid(pid, &status, 0);
+    TEST_ASSERT_EQUAL_MESSAGE(1, WEXITSTATUS(status), spawn_backend_name(sh.spawn));
+  }
+  close(stray);
+  sh_destroy(&sh);
+}
+
+void test_job_builtin(void)
+{
+  struct shell sh;
+  sh_init(&sh);
+  clear_history();
+  add_history("echo a");
+  add_history("echo b");
+  char path[] = "/tmp/test-builtin-XXXXXX";
+  int fd = mkstemp(path);
+  char line[256];
+  static char buf[256];
+  struct stat before, after;
+  fstat(STDOUT_FILENO, &before);
+
+  snprintf(line, sizeof(line), "printhistory > %s", path);
+  char **cmd = cmd_parse(line);
+  TEST_ASSERT_TRUE(job_builtin(&sh, cmd));
+  cmd_free(cmd);
+  const char *expected = "History length: 2\n0: echo a\n1: echo b\n";
+  TEST_ASSERT_EQUAL(strlen(expected), read_back(fd, buf, sizeof(buf)));
+  TEST_ASSERT_EQUAL_MEMORY(expected, buf, strlen(expected));
+  // the shell's own stdout is back
+  fstat(STDOUT_FILENO, &after);
+  TEST_ASSERT_EQUAL(before.st_ino, after.st_ino);
+
+  // the redirection may come first, >> appends
+  snprintf(line, sizeof(line), ">> %s printhistory", path);
+  cmd = cmd_parse(line);
+  TEST_ASSERT_TRUE(job_builtin(&sh, cmd));
+  cmd_free(cmd);
+  TEST_ASSERT_EQUAL(2 * strlen(expected), read_back(fd, buf, sizeof(buf)));
+
+  // it ran in the shell itself
+  char cwd[1024];
+  getcwd(cwd, sizeof(cwd));
+  snprintf(line, sizeof(line), "cd /tmp 2> %s", path);
+  cmd = cmd_parse(line);
+  TEST_ASSERT_TRUE(job_builtin(&sh, cmd));
+  cmd_free(cmd);
+  char here[1024];
+  TEST_ASSERT_EQUAL_STRING("/tmp", getcwd(here, sizeof(here)));
+  chdir(cwd);
+
+  // other commands are left to job_run and nothing is opened for them
+  cmd = cmd_parse("true > /tmp/test-builtin-none");
+  TEST_ASSERT_FALSE(job_builtin(&sh, cmd));
+  cmd_free(cmd);
+  TEST_ASSERT_EQUAL(-1, access("/tmp/test-builtin-none", F_OK));
+  cmd = cmd_parse("printhistory < /no/such/file");
+  TEST_ASSERT_TRUE(job_builtin(&sh, cmd));
+  cmd_free(cmd);
+
+  clear_history();
+  close(fd);
+  unlink(path);
+  sh_destroy(&sh);
+}
+
+void test_sh_fork_fds(void)
+{
+  struct shell sh;
+  sh_init(&sh);
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGCHLD);
+  TEST_ASSERT_EQUAL(0, loop_init(&signals));
+  clear_history();
+  add_history("echo a");
+  char path[] = "/tmp/test-fork-XXXXXX";
+  int fd = mkstemp(path);
+  static char buf[256];
+
+  // the worker's copy of the first pipe's write end must not end up in
+  // the copy of the shell running tee, it would wait for end of file for
+  // good; the timeout turns a hang into 124
+  char line[256];
+  snprintf(line, sizeof(line), "printhistory | tee %s | cat > /dev/null", path);
+  char **cmd = cmd_parse(line);
+  struct job *job = job_start(&sh, cmd, line, false);
+  TEST_ASSERT_NOT_NULL(job);
+  TEST_ASSERT_EQUAL(0, job_timeout(&sh, job, 5000, 100));
+  TEST_ASSERT_EQUAL(0, job_foreground(&sh, job, false));
+  cmd_free(cmd);
+  const char *text = "History length: 1\n0: echo a\n";
+  TEST_ASSERT_EQUAL(strlen(text), read_back(fd, buf, sizeof(buf)));
+
+  close(fd);
+  unlink(path);
+  clear_history();
+  loop_destroy();
+  sh_destroy(&sh);
+}
+
+void test_job_builtin_worker(void)
+{
+  struct shell sh;
+  sh_init(&sh);
+  clear_history();
+  add_history("echo a");
+  add_history("echo b");
+  char path[] = "/tmp/test-worker-XXXXXX";
+  int fd = mkstemp(path);
+  char line[256];
+  static char buf[256];
+
+  const char *lines[] = {
+    "printhistory | grep -q 'echo b'",
+    "printhistory | grep -q nope",
+    // grep was hashed by the lines before
+    "hash | grep -q /grep",
+  };
+  int expected[] = {0, 1, 0};
+  hash_clear();
+  for (size_t i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+    char **cmd = cmd_parse(lines[i]);
+    TEST_ASSERT_EQUAL_MESSAGE(expected[i], job_run(&sh, cmd, lines[i], false), lines[i]);
+    cmd_free(cmd);
+  }
+
+  // the builtin stage is a thread, only the external stage is a process
+  snprintf(line, sizeof(line), "printhistory | cat > %s", path);
+  char **cmd = cmd_parse(line);
+  struct job *job = job_start(&sh, cmd, line, false);
+  TEST_ASSERT_NOT_NULL(job->worker);
+  TEST_ASSERT_EQUAL(2, job->nprocs);
+  TEST_ASSERT_EQUAL(-1, job->procs[0].pid);
+  TEST_ASSERT_EQUAL(0, job_foreground(&sh, job, false));
+  cmd_free(cmd);
+  const char *text = "History length: 2\n0: echo a\n1: echo b\n";
+  TEST_ASSERT_EQUAL(strlen(text), read_back(fd, buf, sizeof(buf)));
+  TEST_ASSERT_EQUAL_MEMORY(text, buf, strlen(text));
+
+  // a reader that stops early fails the worker's writes, not the shell
+  for (int i = 0; i < 20000; i++) {
+    add_history("a history line long enough to fill a pipe quickly");
+  }
+  cmd = cmd_parse("printhistory | head -c 10 > /dev/null");
+  TEST_ASSERT_EQUAL(0, job_run(&sh, cmd, "head", false));
+  cmd_free(cmd);
+
+  // in the background the builtin still gets a copy of the shell
+  cmd = cmd_parse("printhistory | true");
+  job = job_start(&sh, cmd, "bg", true);
+  TEST_ASSERT_NULL(job->worker);
+  TEST_ASSERT_TRUE(job->procs[0].pid > 0);
+  TEST_ASSERT_EQUAL(0, job_foreground(&sh, job, false));
+  cmd_free(cmd);
+
+  clear_history();
+  close(fd);
+  unlink(path);
+  sh_destroy(&sh);
+}
+
+void test_job_exec(void)
+{
+  struct shell sh;
+  sh_init(&sh);
+  char path[] = "/tmp/test-exec-XXXXXX";
+  int fd = mkstemp(path);
+  char line[256];
+  static char buf[64];
+
+  // builtins and pipelines are left to the caller
+  char **cmd = cmd_parse("cd /tmp");
+  TEST_ASSERT_EQUAL(-1, job_exec(&sh, cmd));
+  cmd_free(cmd);
+  cmd = cmd_parse("true | true");
+  TEST_ASSERT_EQUAL(-1, job_exec(&sh, cmd));
+  cmd_free(cmd);
+
+  // the command runs in the process that called job_exec
+  snprintf(line, sizeof(line), "sh -c 'echo $$; exit 3' > %s", path);
+  cmd = cmd_parse(line);
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    _exit(job_exec(&sh, cmd) + 100);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  TEST_ASSERT_EQUAL(3, WEXITSTATUS(status));
+  cmd_free(cmd);
+  size_t len = read_back(fd, buf, sizeof(buf) - 1);
+  buf[len] = '\0';
+  TEST_ASSERT_EQUAL(pid, atoi(buf));
+
+  // a command that is not there comes back
+  cmd = cmd_parse("no-such-command-here");
+  pid = fork();
+  if (pid == 0) {
+    _exit(job_exec(&sh, cmd));
+  }
+  waitpid(pid, &status, 0);
+  TEST_ASSERT_EQUAL(127, WEXITSTATUS(status));
+  cmd_free(cmd);
+
+  close(fd);
+  unlink(path);
+  sh_destroy(&sh);
+}
+
+void test_writer(void)
+{
+  FILE *tmp = tmpfile();
+  struct writer *w = malloc(sizeof(struct writer));
+  writer_init(w, fileno(tmp));
+  // more than the buffer holds goes out in several writes
+  size_t total = 0;
+  for (int i = 0; i < 20000; i++) {
+    writer_printf(w, "line %d\n", i);
+    total += (size_t)snprintf(NULL, 0, "line %d\n", i);
+  }
+  TEST_ASSERT_EQUAL(0, writer_flush(w));
+  TEST_ASSERT_EQUAL(total, (size_t)lseek(fileno(tmp), 0, SEEK_END));
+  fclose(tmp);
+
+  // a failed write drops the rest
+  writer_init(w, -1);
+  writer_printf(w, "lost\n");
+  TEST_ASSERT_EQUAL(-1, writer_flush(w));
+  TEST_ASSERT_EQUAL(-1, writer_flush(w));
+  free(w);
+}
+
+void test_reader(void)
+{
+  FILE *tmp = tmpfile();
+  size_t big = READER_BUF_SIZE + 100;
+  char *long_line = malloc(big + 1);
+  memset(long_line, 'x', big);
+  long_line[big] = '\0';
+  fprintf(tmp, "first\n\n%s\nlast", long_line);
+  fflush(tmp);
+  rewind(tmp);
+
+  struct line_reader *r = reader_new(fileno(tmp));
+  TEST_ASSERT_EQUAL_STRING("first", reader_next(r));
+  TEST_ASSERT_EQUAL_STRING("", reader_next(r));
+  // a line longer than the buffer grows it
+  TEST_ASSERT_EQUAL_STRING(long_line, reader_next(r));
+  // the last line does not need a newline
+  TEST_ASSERT_EQUAL_STRING("last", reader_next(r));
+  TEST_ASSERT_NULL(reader_next(r));
+  TEST_ASSERT_NULL(reader_next(r));
+  reader_free(r);
+
+  free(long_line);
+  fclose(tmp);
+}
+
+void test_ahead(void)
+{
+  // more lines than the ring holds so the thread has to wait for us
+  FILE *tmp = tmpfile();
+  int lines = 4 * AHEAD_LINES;
+  for (int i = 0; i < lines; i++) {
+    fprintf(tmp, "  echo %d\n\n# comment\n", i);
+  }
+  fprintf(tmp, "echo 'open\nlast");
+  fflush(tmp);
+  rewind(tmp);
+
+  struct parse_ahead *pa = ahead_start(fileno(tmp));
+  TEST_ASSERT_NOT_NULL(pa);
+  struct parsed_line pl;
+  char want[32];
+  for (int i = 0; i < lines; i++) {
+    TEST_ASSERT_TRUE(ahead_next(pa, &pl));
+    snprintf(want, sizeof(want), "echo %d", i);
+    TEST_ASSERT_EQUAL_STRING(want, pl.line);
+    TEST_ASSERT_EQUAL_STRING("echo", pl.cmd[0]);
+    TEST_ASSERT_EQUAL_STRING(want + 5, pl.cmd[1]);
+    TEST_ASSERT_NULL(pl.err);
+    cmd_free(pl.cmd);
+  }
+  // a syntax error comes back in its place
+  TEST_ASSERT_TRUE(ahead_next(pa, &pl));
+  TEST_ASSERT_NULL(pl.cmd);
+  TEST_ASSERT_EQUAL_STRING("Unmatched single quote", pl.err);
+  TEST_ASSERT_TRUE(ahead_next(pa, &pl));
+  TEST_ASSERT_EQUAL_STRING("last", pl.cmd[0]);
+  cmd_free(pl.cmd);
+  TEST_ASSERT_FALSE(ahead_next(pa, &pl));
+  ahead_free(pa);
+
+  // exit in the middle: the thread waits for room in a full ring
+  rewind(tmp);
+  pa = ahead_start(fileno(tmp));
+  TEST_ASSERT_NOT_NULL(pa);
+  TEST_ASSERT_TRUE(ahead_next(pa, &pl));
+  cmd_free(pl.cmd);
+  ahead_free(pa);
+  fclose(tmp);
+
+  // or it waits in read for a line that never comes
+  int fds[2];
+  TEST_ASSERT_EQUAL(0, pipe(fds));
+  TEST_ASSERT_EQUAL(7, write(fds[1], "echo 1\n", 7));
+  pa = ahead_start(fds[0]);
+  TEST_ASSERT_NOT_NULL(pa);
+  TEST_ASSERT_TRUE(ahead_next(pa, &pl));
+  TEST_ASSERT_EQUAL_STRING("echo 1", pl.line);
+  cmd_free(pl.cmd);
+  ahead_free(pa);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+/* Run parallel with input as its standard input, the output lands in buf */
+static int run_parallel(struct shell *sh, char **argv, const char *input, char *buf, size_t size)
+{
+  FILE *in = tmpfile();
+  FILE *out = tmpfile();
+  fputs(input, in);
+  fflush(in);
+  rewind(in);
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    dup2(fileno(in), STDIN_FILENO);
+    dup2(fileno(out), STDOUT_FILENO);
+    _exit(parallel_run(sh, argv));
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  size_t len = read_back(fileno(out), buf, size - 1);
+  buf[len] = '\0';
+  fclose(in);
+  fclose(out);
+  return WEXITSTATUS(status);
+}
+
+void test_parallel(void)
+{
+  struct shell sh;
+  sh_init(&sh);
+  static char buf[256];
+
+  // the first line finishes last, -k still writes it first
+  char *keep[] = {"parallel", "-j", "3", "-k", NULL};
+  TEST_ASSERT_EQUAL(1, run_parallel(&sh, keep,
+      "sleep 0.2; echo a\necho b | tr b B\n\nfalse\necho c && echo d\n", buf, sizeof(buf)));
+  TEST_ASSERT_EQUAL_STRING("a\nB\nc\nd\n", buf);
+
+  // each line goes in place of {}, or at the end
+  char *tmpl[] = {"parallel", "-k", "-j1", "echo", "<{}>", NULL};
+  TEST_ASSERT_EQUAL(0, run_parallel(&sh, tmpl, "x y\nz\n", buf, sizeof(buf)));
+  TEST_ASSERT_EQUAL_STRING("<x y>\n<z>\n", buf);
+  char *append[] = {"parallel", "-k", "echo", "n", NULL};
+  TEST_ASSERT_EQUAL(0, run_parallel(&sh, append, "1\n2\n", buf, sizeof(buf)));
+  TEST_ASSERT_EQUAL_STRING("n 1\nn 2\n", buf);
+
+  // every failed job counts
+  char *fail[] = {"parallel", NULL};
+  TEST_ASSERT_EQUAL(3, run_parallel(&sh, fail, "false\nno-such-command-here\nsh -c 'exit 3'\ntrue\n", buf, sizeof(buf)));
+
+  char *usage[] = {"parallel", "-j", "0", NULL};
+  TEST_ASSERT_EQUAL(2, parallel_run(&sh, usage));
+
+  sh_destroy(&sh);
+}
+
+void test_queue(void)
+{
+  struct shell sh;
+  sh_init(&sh);
+  // only the job limit holds the queue back
+  sh.queue_load = 0;
+  sh.queue_psi = 0;
+
+  char *first[] = {"queue", "-j", "1", "sh", "-c", "exit 4", NULL};
+  char *second[] = {"queue", "true", NULL};
+  TEST_ASSERT_TRUE(do_builtin(&sh, first));
+  TEST_ASSERT_EQUAL(0, sh.status);
+  TEST_ASSERT_TRUE(do_builtin(&sh, second));
+  TEST_ASSERT_NOT_NULL(sh.jobs);
+  TEST_ASSERT_TRUE(sh.jobs->queued);
+  TEST_ASSERT_EQUAL_STRING("sh -c exit 4", sh.jobs->cmdline);
+  TEST_ASSERT_NULL(sh.jobs->next);
+  TEST_ASSERT_NOT_NULL(sh.queue);
+  TEST_ASSERT_EQUAL_STRING("true", sh.queue->cmdline);
+
+  // the first one finishing makes room for the next
+  TEST_ASSERT_EQUAL(4, job_foreground(&sh, sh.jobs, false));
+  queue_schedule(&sh);
+  TEST_ASSERT_NULL(sh.queue);
+  TEST_ASSERT_NOT_NULL(sh.jobs);
+  TEST_ASSERT_TRUE(sh.jobs->queued);
+  TEST_ASSERT_EQUAL_STRING("true", sh.jobs->cmdline);
+  TEST_ASSERT_EQUAL(0, job_foreground(&sh, sh.jobs, false));
+
+  // a job limit is a whole number of at least 1, a bad one is no change
+  char *usage[] = {"queue", "-j", "0", "true", NULL};
+  TEST_ASSERT_TRUE(do_builtin(&sh, usage));
+  TEST_ASSERT_EQUAL(2, sh.status);
+  TEST_ASSERT_NULL(sh.queue);
+  char *negative[] = {"queue", "-j", "-2", NULL};
+  char *fraction[] = {"queue", "-j", "2.5", NULL};
+  char *load[] = {"queue", "-l", "high", NULL};
+  TEST_ASSERT_EQUAL(2, queue_run(&sh, negative));
+  TEST_ASSERT_EQUAL(2, queue_run(&sh, fraction));
+  TEST_ASSERT_EQUAL(2, queue_run(&sh, load));
+  TEST_ASSERT_EQUAL(1, sh.queue_jobs);
+  TEST_ASSERT_TRUE(sh.queue_load == 0);
+
+  sh_destroy(&sh);
+}
+
+void test_queue_drain(void)
+{
+  struct shell sh;
+  sh_init(&sh);
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGCHLD);
+  TEST_ASSERT_EQUAL(0, loop_init(&signals));
+  sh.queue_load = 0;
+  sh.queue_psi = 0;
+
+  // the second one can only start once the first has exited
+  char *first[] = {"queue", "-j", "1", "sh", "-c", "sleep 0.1", NULL};
+  char *second[] = {"queue", "true", NULL};
+  TEST_ASSERT_TRUE(do_builtin(&sh, first));
+  TEST_ASSERT_TRUE(do_builtin(&sh, second));
+  TEST_ASSERT_NOT_NULL(sh.queue);
+  queue_drain(&sh);
+  TEST_ASSERT_NULL(sh.queue);
+  TEST_ASSERT_NOT_NULL(sh.jobs);
+  TEST_ASSERT_NOT_NULL(sh.jobs->next);
+  TEST_ASSERT_EQUAL_STRING("true", sh.jobs->next->cmdline);
+  TEST_ASSERT_EQUAL(0, job_foreground(&sh, sh.jobs->next, false));
+
+  loop_destroy();
+  sh_destroy(&sh);
+}
+
+static bool mask_has(const struct cpu_mask *mask, unsigned cpu)
+{
+  size_t bits = 8 * sizeof(unsigned long);
+  return (mask->bits[cpu / bits] >> (cpu % bits)) & 1;
+}
+
+void test_pin(void)
+{
+  struct cpu_mask mask;
+  TEST_ASSERT_TRUE(cpu_list_parse("0-2,8,10-14:2", &mask));
+  unsigned want[] = {0, 1, 2, 8, 10, 12, 14};
+  size_t n = 0;
+  for (unsigned cpu = 0; cpu < CPU_MASK_BITS; cpu++) {
+    if (mask_has(&mask, cpu)) {
+      TEST_ASSERT_LESS_THAN(sizeof(want) / sizeof(want[0]), n);
+      TEST_ASSERT_EQUAL(want[n++], cpu);
+    }
+  }
+  TEST_ASSERT_EQUAL(7, n);
+  TEST_ASSERT_FALSE(cpu_list_parse("", &mask));
+  TEST_ASSERT_FALSE(cpu_list_parse("3-1", &mask));
+  TEST_ASSERT_FALSE(cpu_list_parse("0,", &mask));
+  TEST_ASSERT_FALSE(cpu_list_parse("1x", &mask));
+  TEST_ASSERT_FALSE(cpu_list_parse("0-4:0", &mask));
+  TEST_ASSERT_FALSE(cpu_list_parse("1024", &mask));
+
+  struct shell sh;
+  sh_init(&sh);
+  TEST_ASSERT_FALSE(pin_next(&sh, &mask));
+
+  // round robin hands out one CPU at a time and starts over
+  TEST_ASSERT_TRUE(cpu_list_parse("1,4-5", &sh.cpus));
+  sh.cpus_count = 3;
+  sh.cpus_rr = true;
+  unsigned order[] = {1, 4, 5, 1};
+  for (size_t i = 0; i < 4; i++) {
+    TEST_ASSERT_TRUE(pin_next(&sh, &mask));
+    for (unsigned cpu = 0; cpu < 8; cpu++) {
+      TEST_ASSERT_EQUAL(cpu == order[i], mask_has(&mask, cpu));
+    }
+  }
+
+  // a CPU the shell may not run on is never handed out
+  TEST_ASSERT_TRUE(cpu_list_parse("1023", &mask));
+  TEST_ASSERT_EQUAL(-1, pin_set(&sh, &mask, false));
+
+  // the child runs on the CPU it was given, whatever the shell does
+  char path[] = "/tmp/test-pin-XXXXXX";
+  int fd = mkstemp(path);
+  char line[128];
+  static char buf[128];
+  snprintf(line, sizeof(line), "grep Cpus_allowed_list /proc/self/status > %s", path);
+  char **cmd = cmd_parse(line);
+  char *pin[8] = {"pin", "0"};
+  memcpy(pin + 2, cmd, 5 * sizeof(char *));
+  TEST_ASSERT_TRUE(do_builtin(&sh, pin));
+  TEST_ASSERT_EQUAL(0, sh.status);
+  size_t len = read_back(fd, buf, sizeof(buf) - 1);
+  buf[len] = '\0';
+  TEST_ASSERT_EQUAL_STRING("Cpus_allowed_list:\t0\n", buf);
+  // the shell's own setting is back
+  TEST_ASSERT_TRUE(sh.cpus_rr);
+  cmd_free(cmd);
+  close(fd);
+  unlink(path);
+
+  pin_clear(&sh);
+  TEST_ASSERT_FALSE(pin_next(&sh, &mask));
+  sh_destroy(&sh);
+}
+
 void test_trim_white_no_whitespace(void)
 {
   char *line = (char*) calloc(10, sizeof(char));
@@ -255,6 +1830,55 @@ int main(void) {
 
     RUN_TEST(test_cmd_parse);
     RUN_TEST(test_cmd_parse2);
+    RUN_TEST(test_cmd_parse_quoted);
+    RUN_TEST(test_cmd_parse_empty);
+    RUN_TEST(test_cmd_parse_inplace);
+    RUN_TEST(test_scan_impls_agree);
+    RUN_TEST(test_cmd_parse_long_line);
+    RUN_TEST(test_cmd_parse_posix_quoting);
+    RUN_TEST(test_cmd_parse_syntax_errors);
+    RUN_TEST(test_arena_alloc);
+    RUN_TEST(test_pcache_hit);
+    RUN_TEST(test_pcache_evicts_lru);
+    RUN_TEST(test_argsplit_fixed);
+    RUN_TEST(test_argsplit_plan);
+    RUN_TEST(test_argsplit_limit);
+    RUN_TEST(test_hash_lookup);
+    RUN_TEST(test_hash_relative);
+    RUN_TEST(test_hash_inotify);
+    RUN_TEST(test_builtin_hash);
+    RUN_TEST(test_spawn_backend_names);
+    RUN_TEST(test_spawn_backends);
+    RUN_TEST(test_spawn_zygote_inherits);
+    RUN_TEST(test_cmd_parse_operators);
+    RUN_TEST(test_list_compile);
+    RUN_TEST(test_list_run);
+    RUN_TEST(test_list_run_split);
+    RUN_TEST(test_job_foreground);
+    RUN_TEST(test_job_background);
+    RUN_TEST(test_builtin_fg);
+    RUN_TEST(test_loop_events);
+    RUN_TEST(test_job_foreground_loop);
+    RUN_TEST(test_job_pidfd);
+    RUN_TEST(test_job_timeout);
+    RUN_TEST(test_spawn_stdio);
+    RUN_TEST(test_job_pipeline);
+    RUN_TEST(test_tee_fds);
+    RUN_TEST(test_tee_pipeline);
+    RUN_TEST(test_tee_append_fifo);
+    RUN_TEST(test_job_redirect);
+    RUN_TEST(test_spawn_closes_fds);
+    RUN_TEST(test_job_builtin);
+    RUN_TEST(test_job_builtin_worker);
+    RUN_TEST(test_sh_fork_fds);
+    RUN_TEST(test_job_exec);
+    RUN_TEST(test_writer);
+    RUN_TEST(test_reader);
+    RUN_TEST(test_ahead);
+    RUN_TEST(test_parallel);
+    RUN_TEST(test_queue);
+    RUN_TEST(test_queue_drain);
+    RUN_TEST(test_pin);
     RUN_TEST(test_trim_white_no_whitespace);
     RUN_TEST(test_trim_white_start_whitespace);
     RUN_TEST(test_trim_white_end_whitespace);